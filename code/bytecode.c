@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+#include "bytecode.h"
+
+// a script can't start with the escape character
+static uint8_t const BYTECODE_MAGIC[4] = {0x1b, 'L', 'o', 'x'};
+
+#define BYTECODE_DEPTH_MAX 256
+#define BYTECODE_NO_NAME UINT32_MAX
+
+typedef enum {
+	CONSTANT_NUMBER,
+	CONSTANT_INT,
+	CONSTANT_STRING,
+	CONSTANT_FUNCTION,
+} Constant_Tag;
+
+typedef struct VM VM;
+typedef struct Obj_String Obj_String;
+typedef struct Obj_Function Obj_Function;
+typedef struct Chunk Chunk;
+
+// -- writing
+void bytecode_write_bytes(Bytecode_Writer * writer, void const * bytes, size_t count) {
+	if (writer->capacity - writer->count < count) {
+		size_t capacity = GROW_CAPACITY(writer->capacity);
+		while (capacity - writer->count < count) { capacity *= GROWTH_FACTOR; }
+		uint8_t * new_bytes = realloc(writer->bytes, capacity);
+		if (new_bytes == NULL) { exit(1); }
+		writer->bytes = new_bytes;
+		writer->capacity = capacity;
+	}
+	memcpy(writer->bytes + writer->count, bytes, count);
+	writer->count += count;
+}
+
+void bytecode_write_u8(Bytecode_Writer * writer, uint8_t value) {
+	bytecode_write_bytes(writer, &value, 1);
+}
+
+void bytecode_write_u32(Bytecode_Writer * writer, uint32_t value) {
+	uint8_t bytes[4];
+	for (int i = 0; i < 4; i++) { bytes[i] = (uint8_t)(value >> (i * 8)); }
+	bytecode_write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void bytecode_write_u64(Bytecode_Writer * writer, uint64_t value) {
+	uint8_t bytes[8];
+	for (int i = 0; i < 8; i++) { bytes[i] = (uint8_t)(value >> (i * 8)); }
+	bytecode_write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void bytecode_write_code(Bytecode_Writer * writer, Chunk * chunk) {
+	bytecode_write_u32(writer, chunk->count);
+	bytecode_write_bytes(writer, chunk->code, chunk->count);
+	bytecode_write_u32(writer, chunk->line_count);
+	for (uint32_t i = 0; i < chunk->line_count; i++) {
+		bytecode_write_u32(writer, chunk->lines[i].offset);
+		bytecode_write_u32(writer, chunk->lines[i].line);
+	}
+}
+
+static void write_string(Bytecode_Writer * writer, Obj_String * string) {
+	if (string == NULL) {
+		bytecode_write_u32(writer, BYTECODE_NO_NAME);
+		return;
+	}
+	bytecode_write_u32(writer, string->length);
+	bytecode_write_bytes(writer, string->chars, string->length);
+}
+
+static bool write_function(VM * vm, Bytecode_Writer * writer, Obj_Function * function) {
+	if (function->lazy != NULL) {
+		fprintf(stderr, "can't serialize '%s' before its first call\n", function->name->chars);
+		return false;
+	}
+
+	bytecode_write_u8(writer, function->arity);
+	bytecode_write_u8(writer, function->is_generator);
+	bytecode_write_u32(writer, function->upvalue_count);
+	bytecode_write_u32(writer, function->stack_max);
+	write_string(writer, function->name);
+
+	Chunk * chunk = &function->chunk;
+	bytecode_write_code(writer, chunk);
+
+	bytecode_write_u32(writer, chunk->constants.count);
+	for (uint32_t i = 0; i < chunk->constants.count; i++) {
+		Value constant = chunk->constants.values[i];
+		if (IS_INT(constant)) {
+			bytecode_write_u8(writer, CONSTANT_INT);
+			bytecode_write_u32(writer, (uint32_t)AS_INT(constant));
+		}
+		else if (IS_DOUBLE(constant)) {
+			double number = AS_NUMBER(constant);
+			uint64_t bits;
+			memcpy(&bits, &number, sizeof(bits));
+			bytecode_write_u8(writer, CONSTANT_NUMBER);
+			bytecode_write_u64(writer, bits);
+		}
+		else if (IS_STRING(constant)) {
+			bytecode_write_u8(writer, CONSTANT_STRING);
+			write_string(writer, AS_STRING(constant));
+		}
+		else if (IS_FUNCTION(constant)) {
+			bytecode_write_u8(writer, CONSTANT_FUNCTION);
+			if (!write_function(vm, writer, AS_FUNCTION(constant))) { return false; }
+		}
+		else {
+			fprintf(stderr, "can't serialize a constant of '%s'\n", function->name != NULL ? function->name->chars : "<script>");
+			return false;
+		}
+	}
+	return true;
+}
+
+uint8_t * bytecode_write(VM * vm, Obj_Function * function, size_t * length) {
+	Bytecode_Writer writer = {.bytes = NULL, .count = 0, .capacity = 0};
+	bytecode_write_bytes(&writer, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+	bytecode_write_u32(&writer, BYTECODE_VERSION);
+
+	// `OP_CALL_NATIVE` operands are indices into this table
+	bytecode_write_u32(&writer, vm->native_count);
+	for (uint32_t i = 0; i < vm->native_count; i++) {
+		write_string(&writer, vm->natives[i]->name);
+	}
+
+	if (!write_function(vm, &writer, function)) {
+		free(writer.bytes);
+		return NULL;
+	}
+	*length = writer.count;
+	return writer.bytes;
+}
+
+// -- reading
+uint8_t const * bytecode_read_bytes(Bytecode_Reader * reader, size_t count) {
+	if (reader->had_error || (size_t)(reader->end - reader->bytes) < count) {
+		reader->had_error = true;
+		return NULL;
+	}
+	uint8_t const * bytes = reader->bytes;
+	reader->bytes += count;
+	return bytes;
+}
+
+uint8_t bytecode_read_u8(Bytecode_Reader * reader) {
+	uint8_t const * bytes = bytecode_read_bytes(reader, 1);
+	return bytes != NULL ? bytes[0] : 0;
+}
+
+uint32_t bytecode_read_u32(Bytecode_Reader * reader) {
+	uint8_t const * bytes = bytecode_read_bytes(reader, 4);
+	if (bytes == NULL) { return 0; }
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++) { value |= (uint32_t)bytes[i] << (i * 8); }
+	return value;
+}
+
+uint64_t bytecode_read_u64(Bytecode_Reader * reader) {
+	uint8_t const * bytes = bytecode_read_bytes(reader, 8);
+	if (bytes == NULL) { return 0; }
+	uint64_t value = 0;
+	for (int i = 0; i < 8; i++) { value |= (uint64_t)bytes[i] << (i * 8); }
+	return value;
+}
+
+bool bytecode_read_code(VM * vm, Bytecode_Reader * reader, Chunk * chunk) {
+	uint32_t count = bytecode_read_u32(reader);
+	uint8_t const * code = bytecode_read_bytes(reader, count);
+	uint32_t line_count = bytecode_read_u32(reader);
+	uint8_t const * lines = bytecode_read_bytes(reader, (size_t)line_count * 8);
+	if (code == NULL || lines == NULL) { return false; }
+
+	// runs start at the first byte and go in order
+	Bytecode_Reader line_reader = {.bytes = lines, .end = lines + (size_t)line_count * 8};
+	for (uint32_t i = 0, previous = 0; i < line_count; i++) {
+		uint32_t offset = bytecode_read_u32(&line_reader);
+		bytecode_read_u32(&line_reader);
+		if (i == 0 ? offset != 0 : offset <= previous) { return false; }
+		if (offset >= count) { return false; }
+		previous = offset;
+	}
+	if (chunk == NULL) { return true; }
+
+	chunk->code = GROW_ARRAY(vm, chunk->code, 0, count);
+	chunk->capacity = count;
+	chunk->count = count;
+	memcpy(chunk->code, code, count);
+
+	chunk->lines = GROW_ARRAY(vm, chunk->lines, 0, line_count);
+	chunk->line_capacity = line_count;
+	chunk->line_count = line_count;
+	line_reader = (Bytecode_Reader){.bytes = lines, .end = lines + (size_t)line_count * 8};
+	for (uint32_t i = 0; i < line_count; i++) {
+		chunk->lines[i].offset = bytecode_read_u32(&line_reader);
+		chunk->lines[i].line = bytecode_read_u32(&line_reader);
+	}
+	return true;
+}
+
+static Obj_String * read_string(VM * vm, Bytecode_Reader * reader) {
+	uint32_t length = bytecode_read_u32(reader);
+	if (length == BYTECODE_NO_NAME) { return NULL; }
+	char const * chars = (char const *)bytecode_read_bytes(reader, length);
+	if (chars == NULL) { return NULL; }
+	return copy_string(vm, chars, length);
+}
+
+// leaves the function on the stack, for GC protection
+static bool read_function(VM * vm, Bytecode_Reader * reader, uint32_t depth) {
+	if (depth == BYTECODE_DEPTH_MAX) { return false; }
+
+	Obj_Function * function = new_function(vm);
+	vm_stack_push(vm, TO_OBJ(function));
+	function->arity = bytecode_read_u8(reader);
+	function->is_generator = bytecode_read_u8(reader) != 0;
+	function->upvalue_count = bytecode_read_u32(reader);
+	function->stack_max = bytecode_read_u32(reader);
+	function->name = read_string(vm, reader);
+
+	Chunk * chunk = &function->chunk;
+	if (!bytecode_read_code(vm, reader, chunk)) { return false; }
+
+	uint32_t constant_count = bytecode_read_u32(reader);
+	for (uint32_t i = 0; i < constant_count && !reader->had_error; i++) {
+		switch (bytecode_read_u8(reader)) {
+			case CONSTANT_NUMBER: {
+				uint64_t bits = bytecode_read_u64(reader);
+				double number;
+				memcpy(&number, &bits, sizeof(number));
+				chunk_add_constant(vm, chunk, TO_NUMBER(number));
+				break;
+			}
+			case CONSTANT_INT:
+				chunk_add_constant(vm, chunk, TO_INT((int32_t)bytecode_read_u32(reader)));
+				break;
+			case CONSTANT_STRING: {
+				Obj_String * string = read_string(vm, reader);
+				if (string == NULL) { return false; }
+				chunk_add_constant(vm, chunk, TO_OBJ(string));
+				break;
+			}
+			case CONSTANT_FUNCTION:
+				if (!read_function(vm, reader, depth + 1)) { return false; }
+				chunk_add_constant(vm, chunk, vm_stack_peek(vm, 0));
+				vm_stack_pop(vm);
+				break;
+			default:
+				return false;
+		}
+	}
+	return !reader->had_error;
+}
+
+bool bytecode_is(uint8_t const * bytes, size_t length) {
+	return length >= sizeof(BYTECODE_MAGIC) && memcmp(bytes, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) == 0;
+}
+
+Obj_Function * bytecode_read(VM * vm, uint8_t const * bytes, size_t length) {
+	if (!bytecode_is(bytes, length)) { return NULL; }
+
+	Bytecode_Reader reader = {.bytes = bytes + sizeof(BYTECODE_MAGIC), .end = bytes + length};
+	if (bytecode_read_u32(&reader) != BYTECODE_VERSION) { return NULL; }
+
+	// the natives must be the same, up to the ones the code was bound against
+	uint32_t native_count = bytecode_read_u32(&reader);
+	if (native_count > vm->native_count) { return NULL; }
+	for (uint32_t i = 0; i < native_count; i++) {
+		uint32_t name_length = bytecode_read_u32(&reader);
+		char const * name = (char const *)bytecode_read_bytes(&reader, name_length);
+		if (name == NULL) { return NULL; }
+
+		Obj_String * native_name = vm->natives[i]->name;
+		if (native_name->length != name_length || memcmp(native_name->chars, name, name_length) != 0) { return NULL; }
+	}
+
+	Value * stack_top = vm->stack_top;
+	bool is_ok = read_function(vm, &reader, 0) && reader.bytes == reader.end;
+	Obj_Function * function = is_ok ? AS_FUNCTION(vm_stack_peek(vm, 0)) : NULL;
+	vm->stack_top = stack_top;
+	return function;
+}
@@ -0,0 +1,53 @@
+#if !defined(LOX_BYTECODE)
+#define LOX_BYTECODE
+
+#include "common.h"
+
+// compiled scripts as files: a versioned header, the natives the code
+// was bound against, then the script function with its nested functions;
+// integers are little-endian
+
+// bump when the opcodes or the encoding change
+#define BYTECODE_VERSION 5
+
+struct VM;
+struct Obj_Function;
+struct Chunk;
+
+// `*length` receives the size, the caller frees the result
+uint8_t * bytecode_write(struct VM * vm, struct Obj_Function * function, size_t * length);
+
+bool bytecode_is(uint8_t const * bytes, size_t length);
+
+// NULL when the bytes are malformed or belong to another interpreter;
+// the code itself is trusted
+struct Obj_Function * bytecode_read(struct VM * vm, uint8_t const * bytes, size_t length);
+
+// the encoding, shared with `image.c`
+typedef struct Bytecode_Writer {
+	uint8_t * bytes;
+	size_t count, capacity;
+} Bytecode_Writer;
+
+void bytecode_write_bytes(Bytecode_Writer * writer, void const * bytes, size_t count);
+void bytecode_write_u8(Bytecode_Writer * writer, uint8_t value);
+void bytecode_write_u32(Bytecode_Writer * writer, uint32_t value);
+void bytecode_write_u64(Bytecode_Writer * writer, uint64_t value);
+
+// reading past the end sets `had_error` and yields zeroes
+typedef struct Bytecode_Reader {
+	uint8_t const * bytes;
+	uint8_t const * end;
+	bool had_error;
+} Bytecode_Reader;
+
+uint8_t const * bytecode_read_bytes(Bytecode_Reader * reader, size_t count);
+uint8_t bytecode_read_u8(Bytecode_Reader * reader);
+uint32_t bytecode_read_u32(Bytecode_Reader * reader);
+uint64_t bytecode_read_u64(Bytecode_Reader * reader);
+
+// the code of a chunk and its line runs, `chunk` is NULL to skip them
+void bytecode_write_code(Bytecode_Writer * writer, struct Chunk * chunk);
+bool bytecode_read_code(struct VM * vm, Bytecode_Reader * reader, struct Chunk * chunk);
+
+#endif
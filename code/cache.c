@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "bytecode.h"
+#include "source.h"
+#include "cache.h"
+
+typedef struct VM VM;
+typedef struct Obj_Function Obj_Function;
+typedef struct Cache_Entry Cache_Entry;
+
+#define CACHE_NAME_LENGTH 32 // hex digits of the key
+
+// two independent 64-bit lanes; a collision would run the wrong script
+static void hash_source(char const * source, size_t length, uint64_t key[2]) {
+	uint64_t a = 0x9e3779b97f4a7c15u ^ length;
+	uint64_t b = 0xc2b2ae3d27d4eb4fu ^ ((uint64_t)BYTECODE_VERSION << 32);
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		memcpy(&word, source + i, sizeof(word));
+		a = (a ^ word) * 0xff51afd7ed558ccdu;
+		a = (a << 31) | (a >> 33);
+		b = (b ^ word) * 0xc4ceb9fe1a85ec53u;
+		b = (b << 29) | (b >> 35);
+	}
+	uint64_t tail = 0;
+	for (uint32_t shift = 0; i < length; i++, shift += 8) {
+		tail |= (uint64_t)(uint8_t)source[i] << shift;
+	}
+	a = (a ^ tail) * 0xff51afd7ed558ccdu;
+	b = (b ^ tail) * 0xc4ceb9fe1a85ec53u;
+
+	// murmur finalizers
+	for (int lane = 0; lane < 2; lane++) {
+		uint64_t h = lane == 0 ? a + b : b ^ (a >> 17);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdu;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53u;
+		h ^= h >> 33;
+		key[lane] = h;
+	}
+}
+
+static bool make_directory(char const * path) {
+#if defined(_WIN32)
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	struct stat info;
+	if (stat(path, &info) == 0) { return S_ISDIR(info.st_mode); }
+	return mkdir(path, 0755) == 0;
+#endif
+}
+
+// `b` is optional
+static char * path_join(char const * a, char const * b) {
+	size_t a_length = strlen(a), b_length = b != NULL ? strlen(b) : 0;
+	char * path = malloc(a_length + b_length + 2);
+	if (path == NULL) { exit(1); }
+	memcpy(path, a, a_length + 1);
+	if (b != NULL) {
+		path[a_length] = '/';
+		memcpy(path + a_length + 1, b, b_length + 1);
+	}
+	return path;
+}
+
+// creates the directory on demand, NULL if it is disabled or unavailable
+static char * cache_directory(void) {
+	char const * directory = getenv("LOX_CACHE");
+	if (directory != NULL) {
+		if (directory[0] == '\0') { return NULL; }
+		if (!make_directory(directory)) { return NULL; }
+		return path_join(directory, NULL);
+	}
+
+#if defined(_WIN32)
+	char const * base = getenv("LOCALAPPDATA");
+	if (base == NULL) { return NULL; }
+	char * parent = path_join(base, NULL);
+#else
+	char const * base = getenv("XDG_CACHE_HOME");
+	char * parent;
+	if (base != NULL && base[0] != '\0') {
+		parent = path_join(base, NULL);
+	}
+	else {
+		base = getenv("HOME");
+		if (base == NULL) { return NULL; }
+		parent = path_join(base, ".cache");
+	}
+#endif
+
+	char * path = path_join(parent, "lox");
+	bool is_ready = make_directory(parent) && make_directory(path);
+	free(parent);
+	if (!is_ready) {
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
+bool cache_entry_init(Cache_Entry * entry, char const * source, size_t length) {
+	entry->path = NULL;
+	char * directory = cache_directory();
+	if (directory == NULL) { return false; }
+
+	uint64_t key[2];
+	hash_source(source, length, key);
+	char name[CACHE_NAME_LENGTH + sizeof(".loxc")];
+	snprintf(name, sizeof(name), "%016llx%016llx.loxc", (unsigned long long)key[0], (unsigned long long)key[1]);
+
+	entry->path = path_join(directory, name);
+	free(directory);
+	return true;
+}
+
+void cache_entry_free(Cache_Entry * entry) {
+	free(entry->path);
+	entry->path = NULL;
+}
+
+Obj_Function * cache_load(VM * vm, Cache_Entry * entry) {
+	Source source;
+	if (!source_open(&source, entry->path)) { return NULL; }
+	Obj_Function * function = bytecode_read(vm, (uint8_t const *)source.chars, source.length);
+	source_close(&source);
+	return function;
+}
+
+void cache_store(VM * vm, Cache_Entry * entry, Obj_Function * function) {
+	size_t length;
+	uint8_t * bytes = bytecode_write(vm, function, &length);
+	if (bytes == NULL) { return; }
+
+	// a private file, then a rename over the entry
+	size_t path_length = strlen(entry->path);
+	char * temp_path = malloc(path_length + 32);
+	if (temp_path == NULL) { exit(1); }
+#if defined(_WIN32)
+	snprintf(temp_path, path_length + 32, "%s.%lu.tmp", entry->path, (unsigned long)GetCurrentProcessId());
+#else
+	snprintf(temp_path, path_length + 32, "%s.%ld.tmp", entry->path, (long)getpid());
+#endif
+
+	FILE * file = fopen(temp_path, "wb");
+	bool is_written = file != NULL && fwrite(bytes, sizeof(uint8_t), length, file) == length;
+	if (file != NULL && fclose(file) != 0) { is_written = false; }
+
+#if defined(_WIN32)
+	bool is_stored = is_written && MoveFileExA(temp_path, entry->path, MOVEFILE_REPLACE_EXISTING);
+#else
+	bool is_stored = is_written && rename(temp_path, entry->path) == 0;
+#endif
+	if (!is_stored) { remove(temp_path); }
+
+	free(temp_path);
+	free(bytes);
+}
@@ -0,0 +1,28 @@
+#if !defined(LOX_CACHE)
+#define LOX_CACHE
+
+#include "common.h"
+
+// compiled scripts kept on disk as `.loxc` files, named by a hash
+// of the source and `BYTECODE_VERSION`; the directory is `$LOX_CACHE`,
+// `$XDG_CACHE_HOME/lox`, `~/.cache/lox` or `%LOCALAPPDATA%/lox`,
+// an empty `$LOX_CACHE` disables it
+
+struct VM;
+struct Obj_Function;
+
+typedef struct Cache_Entry {
+	char * path;
+} Cache_Entry;
+
+// false when there is no cache directory
+bool cache_entry_init(Cache_Entry * entry, char const * source, size_t length);
+void cache_entry_free(Cache_Entry * entry);
+
+// NULL on a miss
+struct Obj_Function * cache_load(struct VM * vm, Cache_Entry * entry);
+
+// the entry appears atomically, readers never see a partial file
+void cache_store(struct VM * vm, Cache_Entry * entry, struct Obj_Function * function);
+
+#endif
@@ -1,7 +1,10 @@
+#include <string.h>
+
 #include "chunk.h"
 #include "vm.h"
 #include "memory.h"
 
+typedef struct VM VM;
 typedef struct Chunk Chunk;
 
 void chunk_init(Chunk * chunk) {
@@ -9,33 +12,69 @@ void chunk_init(Chunk * chunk) {
 	chunk->capacity = 0;
 	chunk->code = NULL;
 	chunk->lines = NULL;
+	chunk->line_count = 0;
+	chunk->line_capacity = 0;
 	value_array_init(&chunk->constants);
 }
 
-void chunk_free(Chunk * chunk) {
-	FREE_ARRAY(chunk->code, chunk->capacity);
-	FREE_ARRAY(chunk->lines, chunk->capacity);
-	value_array_free(&chunk->constants);
+void chunk_free(VM * vm, Chunk * chunk) {
+	FREE_ARRAY(vm, chunk->code, chunk->capacity);
+	FREE_ARRAY(vm, chunk->lines, chunk->line_capacity);
+	value_array_free(vm, &chunk->constants);
 	chunk_init(chunk);
 }
 
-void chunk_write(Chunk * chunk, uint8_t byte, uint32_t line) {
+static void code_reserve(VM * vm, Chunk * chunk) {
 	if (chunk->capacity < chunk->count + 1) {
 		uint32_t old_capacity = chunk->capacity;
 		chunk->capacity = GROW_CAPACITY(old_capacity);
-		chunk->code = GROW_ARRAY(chunk->code, old_capacity, chunk->capacity);
-		chunk->lines = GROW_ARRAY(chunk->lines, old_capacity, chunk->capacity);
+		chunk->code = GROW_ARRAY(vm, chunk->code, old_capacity, chunk->capacity);
+	}
+}
+
+void chunk_write(VM * vm, Chunk * chunk, uint8_t byte, uint32_t line) {
+	code_reserve(vm, chunk);
+
+	if (chunk->line_count == 0 || chunk->lines[chunk->line_count - 1].line != line) {
+		if (chunk->line_capacity < chunk->line_count + 1) {
+			uint32_t old_capacity = chunk->line_capacity;
+			chunk->line_capacity = GROW_CAPACITY(old_capacity);
+			chunk->lines = GROW_ARRAY(vm, chunk->lines, old_capacity, chunk->line_capacity);
+		}
+		chunk->lines[chunk->line_count++] = (Line_Run){.offset = chunk->count, .line = line};
 	}
 
 	chunk->code[chunk->count] = byte;
-	chunk->lines[chunk->count] = line;
 	chunk->count++;
 }
 
-uint32_t chunk_add_constant(Chunk * chunk, Value value) {
+void chunk_prepend(VM * vm, Chunk * chunk, uint8_t byte) {
+	code_reserve(vm, chunk);
+	memmove(chunk->code + 1, chunk->code, sizeof(*chunk->code) * chunk->count);
+	chunk->code[0] = byte;
+	chunk->count++;
+
+	// the first run grows by the byte
+	for (uint32_t i = 1; i < chunk->line_count; i++) {
+		chunk->lines[i].offset++;
+	}
+}
+
+// only errors and the disassembler ask
+uint32_t chunk_get_line(Chunk * chunk, uint32_t offset) {
+	uint32_t low = 0, high = chunk->line_count;
+	while (high - low > 1) {
+		uint32_t middle = low + (high - low) / 2;
+		if (chunk->lines[middle].offset <= offset) { low = middle; }
+		else { high = middle; }
+	}
+	return chunk->line_count > 0 ? chunk->lines[low].line : 0;
+}
+
+uint32_t chunk_add_constant(VM * vm, Chunk * chunk, Value value) {
 	// GC protection
-	vm_stack_push(value);
-	value_array_write(&chunk->constants, value);
-	vm_stack_pop();
+	vm_stack_push(vm, value);
+	value_array_write(vm, &chunk->constants, value);
+	vm_stack_pop(vm);
 	return chunk->constants.count - 1;
 }
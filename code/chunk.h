@@ -16,6 +16,8 @@ typedef enum {
 	OP_GET_UPVALUE,
 	OP_SET_PROPERTY,
 	OP_GET_PROPERTY,
+	OP_SET_INDEX,
+	OP_GET_INDEX,
 	OP_DEFINE_GLOBAL,
 	OP_EQUAL,
 	OP_GREATER,
@@ -31,8 +33,11 @@ typedef enum {
 	OP_JUMP_IF_FALSE,
 	OP_LOOP,
 	OP_CALL,
+	OP_CALL_NATIVE,
+	OP_TAIL_CALL,
 	OP_CLOSURE,
 	OP_CLOSE_UPVALUE,
+	OP_LIST,
 	OP_CLASS,
 	OP_METHOD,
 	OP_INVOKE,
@@ -40,18 +45,39 @@ typedef enum {
 	OP_GET_SUPER,
 	OP_SUPER_INVOKE,
 	OP_RETURN,
+	OP_GENERATOR,
+	OP_YIELD,
+	OP_FOR_ITER,
+	OP_WIDE, // the high 16 bits of the next constant index or jump offset
+	OP_ADD_LOCAL,
+	OP_ADD_CONSTANT,
+	OP_SUBTRACT_LOCAL,
+	OP_SUBTRACT_CONSTANT,
+	OP_LESS_LOCAL,
+	OP_LESS_CONSTANT,
+	OP_GREATER_LOCAL,
+	OP_GREATER_CONSTANT,
 } Op_Code;
 
+// the line of every byte from `offset` up to the next run
+typedef struct {
+	uint32_t offset;
+	uint32_t line;
+} Line_Run;
+
 struct Chunk {
 	uint32_t capacity, count;
 	uint8_t * code;
-	uint32_t * lines;
+	Line_Run * lines; // a run per line change, see `chunk_get_line`
+	uint32_t line_capacity, line_count;
 	Value_Array constants;
 };
 
 void chunk_init(struct Chunk * chunk);
-void chunk_free(struct Chunk * chunk);
-void chunk_write(struct Chunk * chunk, uint8_t byte, uint32_t line);
-uint32_t chunk_add_constant(struct Chunk * chunk, Value value);
+void chunk_free(struct VM * vm, struct Chunk * chunk);
+void chunk_write(struct VM * vm, struct Chunk * chunk, uint8_t byte, uint32_t line);
+void chunk_prepend(struct VM * vm, struct Chunk * chunk, uint8_t byte); // on the line of the first byte
+uint32_t chunk_get_line(struct Chunk * chunk, uint32_t offset);
+uint32_t chunk_add_constant(struct VM * vm, struct Chunk * chunk, Value value);
 
 #endif
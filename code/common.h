@@ -10,16 +10,26 @@
 // #define DEBUG_TRACE_GC
 // #define DEBUG_TRACE_EXECUTION
 
+// the right operand of `+ - < >` is read in place when it is a local or
+// a constant, see `do_binary`; the VM runs either form
+#define REGISTER_OPERANDS
+
 #define NAN_BOXING
 #define NAN_MASK ((uint64_t)0x7ffc000000000000)
 #define NAN_SIGN ((uint64_t)0x8000000000000000)
 #define NAN_TAG_NIL   1
 #define NAN_TAG_FALSE 2
 #define NAN_TAG_TRUE  3
+#define NAN_TAG_INT   ((uint64_t)0x0001000000000000)
 
-#define FRAMES_MAX 64
+// the stack and the frames grow on demand, from the initial reservation
+// up to `vm->frames_limit`, which defaults to `FRAMES_MAX`
+#define FRAMES_INITIAL 8
+#define FRAMES_MAX (1 << 16)
 #define LOCALS_MAX (UINT8_MAX + 1)
-#define STACK_MAX (FRAMES_MAX * LOCALS_MAX)
+#define CONSTANTS_MAX (1 << 24) // an 8-bit index, widened by `OP_WIDE`
+#define STACK_INITIAL (LOCALS_MAX * 2)
+#define STACK_SLACK 8 // above a frame's `stack_max`, for natives and GC protection
 
 // -- flexible array member settings
 #if __STDC_VERSION__ >= 199901L
@@ -3,16 +3,31 @@
 #include <string.h>
 
 #include "object.h"
+#include "memory.h"
 #include "compiler.h"
+#include "optimizer.h"
 #include "scanner.h"
+#include "vm.h"
 
 #if defined(DEBUG_PRINT_BYTECODE)
 #include "debug.h"
 #endif // DEBUG_PRINT_BYTECODE
 
-typedef struct {
+typedef struct VM VM;
+typedef struct Compiler Compiler;
+typedef struct Class_Compiler Class_Compiler;
+
+typedef struct Parser {
+	VM * vm;
+	Scanner scanner;
+	Compiler * compiler;
+	Class_Compiler * class_compiler;
 	Token current;
 	Token previous;
+	uint32_t bound_native;
+	bool is_lazy; // function bodies are skimmed, see `skim_body`
+	bool is_wide; // forward jumps reserve an `OP_WIDE`, see `compile`
+	bool has_long_jump;
 	bool had_error;
 	bool panic_mode;
 } Parser;
@@ -31,7 +46,7 @@ typedef enum {
 	PREC_PRIMARY,    //
 } Precedence;
 
-typedef void Parse_Fn(bool can_assign);
+typedef void Parse_Fn(Parser * parser, bool can_assign);
 
 typedef struct {
 	Parse_Fn * prefix;
@@ -55,9 +70,11 @@ typedef enum {
 typedef struct {
 	uint8_t index;
 	bool is_local;
+	Token name; // kept for `compile_body`
 } Upvalue;
 
 typedef struct Obj_Function Obj_Function;
+typedef struct Lazy_Body Lazy_Body;
 
 typedef struct Compiler {
 	struct Compiler * enclosing;
@@ -67,6 +84,10 @@ typedef struct Compiler {
 	Upvalue upvalues[LOCALS_MAX];
 	uint32_t local_count;
 	uint32_t scope_depth;
+	uint32_t last_call; // offset of the latest `OP_CALL`
+	int32_t stack_depth; // slots in use where code is emitted, see `stack_effect`
+	Lazy_Body * lazy; // the upvalue names of a body compiled on its first call
+	Value_Table constants; // strings and numbers to their index, see `make_constant`
 } Compiler;
 
 typedef struct Class_Compiler {
@@ -75,21 +96,17 @@ typedef struct Class_Compiler {
 	bool has_superclass;
 } Class_Compiler;
 
-static Parser parser;
-static Compiler * current_compiler = NULL;
-static Class_Compiler * current_class = NULL;
-
 typedef struct Chunk Chunk;
 
-static Chunk * current_chunk(void) {
-	return &current_compiler->function->chunk;
+static Chunk * current_chunk(Parser * parser) {
+	return &parser->compiler->function->chunk;
 }
 
 // errors
-static void error_at(Token * token, char const * message) {
+static void error_at(Parser * parser, Token * token, char const * message) {
 	DEBUG_BREAK();
-	if (parser.panic_mode) { return; }
-	parser.panic_mode = true;
+	if (parser->panic_mode) { return; }
+	parser->panic_mode = true;
 
 	fprintf(stderr, "[line %d] error", token->line);
 
@@ -104,35 +121,35 @@ static void error_at(Token * token, char const * message) {
 	}
 
 	fprintf(stderr, ": %s\n", message);
-	parser.had_error = true;
+	parser->had_error = true;
 }
 
-static void error_at_current(char const * message) {
-	error_at(&parser.current, message);
+static void error_at_current(Parser * parser, char const * message) {
+	error_at(parser, &parser->current, message);
 }
 
-static void error(char const * message) {
-	error_at(&parser.previous, message);
+static void error(Parser * parser, char const * message) {
+	error_at(parser, &parser->previous, message);
 }
 
 // scanning
-static void compiler_advance(void) {
-	parser.previous = parser.current;
+static void compiler_advance(Parser * parser) {
+	parser->previous = parser->current;
 
 	for (;;) {
-		parser.current = scan_token();
-		if (parser.current.type != TOKEN_ERROR) { break; }
-		error_at_current(parser.current.start);
+		parser->current = scan_token(&parser->scanner);
+		if (parser->current.type != TOKEN_ERROR) { break; }
+		error_at_current(parser, parser->current.start);
 	}
 }
 
-static void syncronize(void) {
-	parser.panic_mode = false;
+static void syncronize(Parser * parser) {
+	parser->panic_mode = false;
 
-	while (parser.current.type != TOKEN_EOF) {
-		if (parser.previous.type == TOKEN_SEMICOLON) { return; }
+	while (parser->current.type != TOKEN_EOF) {
+		if (parser->previous.type == TOKEN_SEMICOLON) { return; }
 
-		switch (parser.current.type) {
+		switch (parser->current.type) {
 			case TOKEN_CLASS:
 			case TOKEN_FUN:
 			case TOKEN_VAR:
@@ -144,22 +161,22 @@ static void syncronize(void) {
 			default: break;
 		}
 
-		compiler_advance();
+		compiler_advance(parser);
 	}
 }
 
-static void consume(Token_Type type, char const * message) {
-	if (parser.current.type == type) {
-		compiler_advance();
+static void consume(Parser * parser, Token_Type type, char const * message) {
+	if (parser->current.type == type) {
+		compiler_advance(parser);
 		return;
 	}
 
-	error_at_current(message);
+	error_at_current(parser, message);
 }
 
-static bool compiler_match(Token_Type type) {
-	if (parser.current.type != type) { return false; }
-	compiler_advance();
+static bool compiler_match(Parser * parser, Token_Type type) {
+	if (parser->current.type != type) { return false; }
+	compiler_advance(parser);
 	return true;
 }
 
@@ -174,80 +191,141 @@ static bool identifier_is(Token * a, char const * chars, uint32_t length) {
 }
 
 // emitting
-static uint8_t make_constant(Value value) {
-	uint32_t constant = chunk_add_constant(current_chunk(), value);
-	if (constant == LOCALS_MAX) {
-		error("too many constant in one chunk");
+static uint32_t make_constant(Parser * parser, Value value) {
+	// strings are interned and numbers are normalized, so equal ones share a slot
+	Value_Table * constants = &parser->compiler->constants;
+	bool is_shared = IS_STRING(value) || IS_NUMBER(value);
+	Value index;
+	if (is_shared && value_table_get(constants, value, &index)) {
+		return (uint32_t)AS_INT(index);
+	}
+
+	uint32_t constant = chunk_add_constant(parser->vm, current_chunk(parser), value);
+	if (constant >= CONSTANTS_MAX) {
+		error(parser, "too many constant in one chunk");
 		return 0;
 	}
-	return (uint8_t)constant;
+	if (is_shared) {
+		value_table_set(parser->vm, constants, value, TO_INT((int32_t)constant));
+	}
+	return constant;
+}
+
+static void emit_byte(Parser * parser, uint8_t byte) {
+	chunk_write(parser->vm, current_chunk(parser), byte, parser->previous.line);
+}
+
+static void emit_bytes(Parser * parser, uint8_t byte1, uint8_t byte2) {
+	emit_byte(parser, byte1);
+	emit_byte(parser, byte2);
+}
+
+// the peak goes to `stack_max`, which `call` reserves for a frame;
+// code after a jump starts from the depth at the jump, see `do_if_statement`
+static void stack_effect(Parser * parser, int32_t effect) {
+	Compiler * compiler = parser->compiler;
+	compiler->stack_depth += effect;
+	if (compiler->stack_depth > (int32_t)compiler->function->stack_max) {
+		compiler->function->stack_max = (uint32_t)compiler->stack_depth;
+	}
 }
 
-static void emit_byte(uint8_t byte) {
-	chunk_write(current_chunk(), byte, parser.previous.line);
+static void emit_wide(Parser * parser, uint32_t high) {
+	emit_byte(parser, OP_WIDE);
+	emit_byte(parser, (high >> 8) & 0xff);
+	emit_byte(parser, high & 0xff);
 }
 
-static void emit_bytes(uint8_t byte1, uint8_t byte2) {
-	emit_byte(byte1);
-	emit_byte(byte2);
+// the short form unless the index needs `OP_WIDE`
+static void emit_constant_op(Parser * parser, Op_Code instruction, uint32_t constant) {
+	if (constant > UINT8_MAX) {
+		emit_wide(parser, constant >> 8);
+	}
+	emit_bytes(parser, (uint8_t)instruction, (uint8_t)(constant & 0xff));
 }
 
-static void emit_constant(Value value) {
-	emit_bytes(OP_CONSTANT, make_constant(value));
+static void emit_constant(Parser * parser, Value value) {
+	emit_constant_op(parser, OP_CONSTANT, make_constant(parser, value));
+	stack_effect(parser, 1);
 }
 
-static uint32_t emit_jump(Op_Code instruction) {
-	emit_byte((uint8_t)instruction);
-	emit_byte(0xff);
-	emit_byte(0xff);
-	return current_chunk()->count - 2;
+// returns the offset of the instruction for `patch_jump`
+static uint32_t emit_jump(Parser * parser, Op_Code instruction) {
+	if (parser->is_wide) {
+		emit_wide(parser, 0xffff);
+	}
+	uint32_t jump = current_chunk(parser)->count;
+	emit_byte(parser, (uint8_t)instruction);
+	emit_byte(parser, 0xff);
+	emit_byte(parser, 0xff);
+	return jump;
 }
 
-static void patch_jump(uint32_t target) {
-	uint32_t jump = current_chunk()->count - target - 2;
-	if (jump > UINT16_MAX) {
-		error("too much code to jump over");
+static void patch_jump(Parser * parser, uint32_t jump) {
+	Chunk * chunk = current_chunk(parser);
+	// the offset of `OP_FOR_ITER` follows its slot
+	uint32_t target = jump + (chunk->code[jump] == OP_FOR_ITER ? 2 : 1);
+	uint32_t offset = chunk->count - target - 2;
+	if (parser->is_wide) {
+		chunk->code[jump - 2] = (offset >> 24) & 0xff;
+		chunk->code[jump - 1] = (offset >> 16) & 0xff;
+	}
+	else if (offset > UINT16_MAX) {
+		// `compile` starts over
+		parser->has_long_jump = true;
 	}
-	current_chunk()->code[target] = (jump >> 8) & 0xff;
-	current_chunk()->code[target + 1] = jump & 0xff;
+	chunk->code[target] = (offset >> 8) & 0xff;
+	chunk->code[target + 1] = offset & 0xff;
 }
 
-static void emit_loop(uint32_t target) {
-	emit_byte(OP_LOOP);
-	uint32_t loop = current_chunk()->count - target + 2;
+// the target is known, so only long loops pay for `OP_WIDE`
+static void emit_loop(Parser * parser, uint32_t target) {
+	uint32_t loop = current_chunk(parser)->count - target + 3;
 	if (loop > UINT16_MAX) {
-		error("too much code to loop over");
+		loop += 3;
+		emit_wide(parser, loop >> 16);
 	}
-	emit_byte((loop >> 8) & 0xff);
-	emit_byte(loop & 0xff);
+	emit_byte(parser, OP_LOOP);
+	emit_byte(parser, (loop >> 8) & 0xff);
+	emit_byte(parser, loop & 0xff);
 }
 
-static void emit_default_return(void) {
-	if (current_compiler->type == TYPE_INITIALIZER) {
-		emit_bytes(OP_GET_LOCAL, 0); // this
+static void emit_default_return(Parser * parser) {
+	if (parser->compiler->type == TYPE_INITIALIZER) {
+		emit_bytes(parser, OP_GET_LOCAL, 0); // this
 	}
 	else {
-		emit_byte(OP_NIL);
+		emit_byte(parser, OP_NIL);
 	}
-	emit_byte(OP_RETURN);
+	emit_byte(parser, OP_RETURN);
+	stack_effect(parser, 1);
+	stack_effect(parser, -1);
 }
 
-static void compiler_init(Compiler * compiler, Function_Type type) {
-	compiler->enclosing = current_compiler;
+// `function` is NULL for a new one
+static void compiler_init(Parser * parser, Compiler * compiler, Function_Type type, Obj_Function * function) {
+	compiler->enclosing = parser->compiler;
 	compiler->type = type;
 	compiler->local_count = 0;
 	compiler->scope_depth = 0;
+	compiler->last_call = UINT32_MAX;
+	compiler->stack_depth = 0;
+	compiler->lazy = NULL;
+	value_table_init(&compiler->constants);
 
 	// GC protection
 	compiler->function = NULL;
-	compiler->function = new_function();
+	compiler->function = function != NULL ? function : new_function(parser->vm);
 
-	current_compiler = compiler;
+	parser->compiler = compiler;
 
-	if (type != TYPE_SCRIPT) {
-		compiler->function->name = copy_string(parser.previous.start, parser.previous.length);
+	if (function == NULL && type != TYPE_SCRIPT) {
+		compiler->function->name = copy_string(parser->vm, parser->previous.start, parser->previous.length);
 	}
 
+	// the callee, or `this`
+	compiler->function->stack_max = 0;
+	stack_effect(parser, 1);
 	Local * local = &compiler->locals[compiler->local_count++];
 	local->depth = 0;
 	local->is_captured = false;
@@ -261,59 +339,70 @@ static void compiler_init(Compiler * compiler, Function_Type type) {
 	}
 }
 
-static Obj_Function * compiler_end(void) {
-	emit_default_return();
+static Obj_Function * compiler_end(Parser * parser) {
+	emit_default_return(parser);
 
-	Obj_Function * function = current_compiler->function;
+	Obj_Function * function = parser->compiler->function;
+
+	// jumps are relative, so the prologue can be prepended
+	if (function->is_generator) {
+		chunk_prepend(parser->vm, current_chunk(parser), OP_GENERATOR);
+	}
+
+	// still a root while the compiler holds it
+	if (parser->vm->is_optimizing && !parser->had_error && !parser->has_long_jump) {
+		optimize_function(parser->vm, function);
+	}
 
 #if defined(DEBUG_PRINT_BYTECODE)
-	if (!parser.had_error) {
-		chunk_disassemble(current_chunk(), function->name != NULL ? function->name->chars : "<script>");
+	if (!parser->had_error) {
+		chunk_disassemble(current_chunk(parser), function->name != NULL ? function->name->chars : "<script>");
 		printf("\n");
 	}
 #endif // DEBUG_PRINT_BYTECODE
 
-	current_compiler = current_compiler->enclosing;
+	value_table_free(parser->vm, &parser->compiler->constants);
+	parser->compiler = parser->compiler->enclosing;
 	return function;
 }
 
 // parsing
 static Parse_Rule * get_rule(Token_Type type);
-static void parse_presedence(Precedence precedence) {
-	compiler_advance();
-	Parse_Fn * prefix_rule = get_rule(parser.previous.type)->prefix;
+static void parse_presedence(Parser * parser, Precedence precedence) {
+	compiler_advance(parser);
+	Parse_Fn * prefix_rule = get_rule(parser->previous.type)->prefix;
 	if (prefix_rule == NULL) {
-		error("expected an expression");
+		error(parser, "expected an expression");
 		return;
 	}
 
 	bool can_assign = precedence <= PREC_ASSIGNMENT;
-	prefix_rule(can_assign);
+	prefix_rule(parser, can_assign);
 
-	while (precedence <= get_rule(parser.current.type)->precedence) {
-		compiler_advance();
-		Parse_Fn * infix_rule = get_rule(parser.previous.type)->infix;
-		infix_rule(can_assign);
+	while (precedence <= get_rule(parser->current.type)->precedence) {
+		compiler_advance(parser);
+		Parse_Fn * infix_rule = get_rule(parser->previous.type)->infix;
+		infix_rule(parser, can_assign);
 	}
 
-	if (can_assign && compiler_match(TOKEN_EQUAL)) {
-		error("invalid assignment target");
+	if (can_assign && compiler_match(parser, TOKEN_EQUAL)) {
+		error(parser, "invalid assignment target");
 	}
 }
 
 typedef struct Obj_String Obj_String;
 
-static uint8_t identifier_constant(Token * name) {
-	Obj_String * obj_name = copy_string(name->start, name->length);
-	return make_constant(TO_OBJ(obj_name));
+static uint32_t identifier_constant(Parser * parser, Token * name) {
+	Obj_String * obj_name = copy_string(parser->vm, name->start, name->length);
+	return make_constant(parser, TO_OBJ(obj_name));
 }
 
-static uint32_t resolve_local(Compiler * compiler, Token * name) {
+static uint32_t resolve_local(Parser * parser, Compiler * compiler, Token * name) {
 	for (uint32_t i = compiler->local_count; i-- > 0;) {
 		Local * local = &compiler->locals[i];
 		if (identifiers_equal(name, &local->name)) {
 			if (local->depth == UINT32_MAX) {
-				error("can't read local variable in its own initializer");
+				error(parser, "can't read local variable in its own initializer");
 			}
 			return i;
 		}
@@ -321,7 +410,7 @@ static uint32_t resolve_local(Compiler * compiler, Token * name) {
 	return UINT32_MAX;
 }
 
-static uint32_t add_upvalue(Compiler * compiler, uint8_t index, bool is_local) {
+static uint32_t add_upvalue(Parser * parser, Compiler * compiler, uint8_t index, bool is_local, Token * name) {
 	uint32_t upvalue_count = compiler->function->upvalue_count;
 	for (uint32_t i = 0; i < upvalue_count; i++) {
 		Upvalue * upvalue = &compiler->upvalues[i];
@@ -330,229 +419,308 @@ static uint32_t add_upvalue(Compiler * compiler, uint8_t index, bool is_local) {
 		}
 	}
 	if (upvalue_count == LOCALS_MAX) {
-		error("too many closure variables");
+		error(parser, "too many closure variables");
 		return 0;
 	}
 	compiler->upvalues[upvalue_count].index = index;
 	compiler->upvalues[upvalue_count].is_local = is_local;
+	compiler->upvalues[upvalue_count].name = *name;
 	return compiler->function->upvalue_count++;
 }
 
-static uint32_t resolve_upvalue(Compiler * compiler, Token * name) {
-	if (compiler->enclosing == NULL) { return UINT32_MAX; }
+// a body compiled on its first call has its upvalues resolved by `skim_body`
+static uint32_t resolve_lazy_upvalue(Compiler * compiler, Token * name) {
+	Lazy_Body * lazy = compiler->lazy;
+	if (lazy == NULL) { return UINT32_MAX; }
 
-	uint32_t local = resolve_local(compiler->enclosing, name);
+	char const * names = lazy->chars + lazy->length;
+	for (uint32_t i = 0; i < compiler->function->upvalue_count; i++) {
+		size_t length = strlen(names);
+		if (length == name->length && memcmp(names, name->start, length) == 0) { return i; }
+		names += length + 1;
+	}
+	return UINT32_MAX;
+}
+
+static uint32_t resolve_upvalue(Parser * parser, Compiler * compiler, Token * name) {
+	if (compiler->enclosing == NULL) { return resolve_lazy_upvalue(compiler, name); }
+
+	uint32_t local = resolve_local(parser, compiler->enclosing, name);
 	if (local != UINT32_MAX) {
 		compiler->enclosing->locals[local].is_captured = true;
-		return add_upvalue(compiler, (uint8_t)local, true);
+		return add_upvalue(parser, compiler, (uint8_t)local, true, name);
 	}
 
-	uint32_t upvalue = resolve_upvalue(compiler->enclosing, name);
+	uint32_t upvalue = resolve_upvalue(parser, compiler->enclosing, name);
 	if (upvalue != UINT32_MAX) {
-		return add_upvalue(compiler, (uint8_t)upvalue, false);
+		return add_upvalue(parser, compiler, (uint8_t)upvalue, false, name);
 	}
 
 	return UINT32_MAX;
 }
 
-static void add_local(Token name) {
-	if (current_compiler->local_count == LOCALS_MAX) {
-		error("too many local variables");
+static void add_local(Parser * parser, Token name) {
+	if (parser->compiler->local_count == LOCALS_MAX) {
+		error(parser, "too many local variables");
 		return;
 	}
-	Local * local = &current_compiler->locals[current_compiler->local_count++];
+	Local * local = &parser->compiler->locals[parser->compiler->local_count++];
 	local->name = name;
 	local->depth = UINT32_MAX;
 	local->is_captured = false;
 }
 
-static void declare_variable(void) {
-	if (current_compiler->scope_depth == 0) { return; }
-	Token * name = &parser.previous;
-	for (uint32_t i = current_compiler->local_count; i-- > 0;) {
-		Local * local = &current_compiler->locals[i];
-		if (local->depth != UINT32_MAX && local->depth < current_compiler->scope_depth) {
+static void declare_variable(Parser * parser) {
+	if (parser->compiler->scope_depth == 0) { return; }
+	Token * name = &parser->previous;
+	for (uint32_t i = parser->compiler->local_count; i-- > 0;) {
+		Local * local = &parser->compiler->locals[i];
+		if (local->depth != UINT32_MAX && local->depth < parser->compiler->scope_depth) {
 			break;
 		}
 
 		if (identifiers_equal(name, &local->name)) {
-			error("a varaible redeclaration");
+			error(parser, "a varaible redeclaration");
 		}
 	}
-	add_local(*name);
+	add_local(parser, *name);
 }
 
-static uint8_t parse_variable(char const * error_message) {
-	consume(TOKEN_IDENTIFIER, error_message);
+static uint32_t parse_variable(Parser * parser, char const * error_message) {
+	consume(parser, TOKEN_IDENTIFIER, error_message);
 
-	declare_variable();
-	if (current_compiler->scope_depth > 0) { return 0; }
+	declare_variable(parser);
+	if (parser->compiler->scope_depth > 0) { return 0; }
 
-	return identifier_constant(&parser.previous);
+	return identifier_constant(parser, &parser->previous);
 }
 
-static void mark_initialized(void) {
-	if (current_compiler->scope_depth == 0) { return; }
-	current_compiler->locals[current_compiler->local_count - 1].depth = current_compiler->scope_depth;
+static void mark_initialized(Parser * parser) {
+	if (parser->compiler->scope_depth == 0) { return; }
+	parser->compiler->locals[parser->compiler->local_count - 1].depth = parser->compiler->scope_depth;
 }
 
-static void define_variable(uint8_t global) {
-	if (current_compiler->scope_depth > 0) {
-		mark_initialized();
+static void define_variable(Parser * parser, uint32_t global) {
+	if (parser->compiler->scope_depth > 0) {
+		mark_initialized(parser);
 		return;
 	}
-	emit_bytes(OP_DEFINE_GLOBAL, global);
+	emit_constant_op(parser, OP_DEFINE_GLOBAL, global);
+	stack_effect(parser, -1);
 }
 
-static void do_expression(void);
-static uint8_t argument_list(void) {
+static void do_expression(Parser * parser);
+static uint8_t argument_list(Parser * parser) {
 	uint8_t arg_count = 0;
-	if (parser.current.type != TOKEN_RIGHT_PAREN) {
+	if (parser->current.type != TOKEN_RIGHT_PAREN) {
 		do {
 			if (arg_count == UINT8_MAX) {
-				error("can't have more that 255 arguments");
+				error(parser, "can't have more that 255 arguments");
 			}
 			arg_count++;
-			do_expression();
-		} while (compiler_match(TOKEN_COMMA));
+			do_expression(parser);
+		} while (compiler_match(parser, TOKEN_COMMA));
 	}
-	consume(TOKEN_RIGHT_PAREN, "expected a ')'");
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')'");
 	return arg_count;
 }
 
-static void do_expression(void);
-static void named_variable(Token name, bool can_assign) {
+static void do_expression(Parser * parser);
+static void named_variable(Parser * parser, Token name, bool can_assign) {
 	Op_Code get_op, set_op;
 	uint32_t arg;
-	if ((arg = resolve_local(current_compiler, &name)) != UINT32_MAX) {
+	if ((arg = resolve_local(parser, parser->compiler, &name)) != UINT32_MAX) {
 		get_op = OP_GET_LOCAL;
 		set_op = OP_SET_LOCAL;
 	}
-	else if ((arg = resolve_upvalue(current_compiler, &name)) != UINT32_MAX) {
+	else if ((arg = resolve_upvalue(parser, parser->compiler, &name)) != UINT32_MAX) {
 		get_op = OP_GET_UPVALUE;
 		set_op = OP_SET_UPVALUE;
 	}
 	else {
-		arg = identifier_constant(&name);
+		arg = identifier_constant(parser, &name);
 		get_op = OP_GET_GLOBAL;
 		set_op = OP_SET_GLOBAL;
 	}
 
-	if (can_assign && compiler_match(TOKEN_EQUAL)) {
-		do_expression();
-		emit_bytes((uint8_t)set_op, (uint8_t)arg);
+	if (can_assign && compiler_match(parser, TOKEN_EQUAL)) {
+		do_expression(parser);
+		emit_constant_op(parser, set_op, arg);
 	}
 	else {
-		emit_bytes((uint8_t)get_op, (uint8_t)arg);
+		emit_constant_op(parser, get_op, arg);
+		stack_effect(parser, 1);
 	}
 }
 
-static void begin_scope(void) {
-	current_compiler->scope_depth++;
+static void begin_scope(Parser * parser) {
+	parser->compiler->scope_depth++;
 }
 
-static void end_scope(void) {
-	current_compiler->scope_depth--;
+static void end_scope(Parser * parser) {
+	parser->compiler->scope_depth--;
 
-	while (current_compiler->local_count > 0 && current_compiler->locals[current_compiler->local_count - 1].depth > current_compiler->scope_depth) {
-		if (current_compiler->locals[current_compiler->local_count - 1].is_captured) {
-			emit_byte(OP_CLOSE_UPVALUE);
+	while (parser->compiler->local_count > 0 && parser->compiler->locals[parser->compiler->local_count - 1].depth > parser->compiler->scope_depth) {
+		if (parser->compiler->locals[parser->compiler->local_count - 1].is_captured) {
+			emit_byte(parser, OP_CLOSE_UPVALUE);
 		}
 		else {
-			emit_byte(OP_POP);
+			emit_byte(parser, OP_POP);
 		}
-		current_compiler->local_count--;
+		stack_effect(parser, -1);
+		parser->compiler->local_count--;
 	}
 }
 
 // expressions
-static void do_expression(void) {
-	parse_presedence(PREC_ASSIGNMENT);
+static void do_expression(Parser * parser) {
+	parse_presedence(parser, PREC_ASSIGNMENT);
 }
 
-static void do_number(bool can_assign) {
+static void do_number(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	double number = strtod(parser.previous.start, NULL);
-	emit_constant(TO_NUMBER(number));
+	// the source might end right after the token, e.g. when mapped;
+	// long literals, e.g. of many fraction digits, are copied to the heap
+	char buffer[64];
+	Token token = parser->previous;
+	size_t size = (size_t)token.length + 1;
+	char * chars = size <= sizeof(buffer) ? buffer : reallocate(parser->vm, NULL, 0, size);
+	memcpy(chars, token.start, token.length);
+	chars[token.length] = '\0';
+
+	double number = strtod(chars, NULL);
+	if (chars != buffer) { reallocate(parser->vm, chars, size, 0); }
+	emit_constant(parser, double_to_value(number));
 }
 
-static void do_unary(bool can_assign) {
+static void do_unary(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	Token_Type operator_type = parser.previous.type;
+	Token_Type operator_type = parser->previous.type;
 	// compile the operand
-	parse_presedence(PREC_UNARY);
+	parse_presedence(parser, PREC_UNARY);
 	// emit the operator instruction
 	switch (operator_type) {
-		case TOKEN_BANG:  emit_byte(OP_NOT); break;
-		case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
+		case TOKEN_BANG:  emit_byte(parser, OP_NOT); break;
+		case TOKEN_MINUS: emit_byte(parser, OP_NEGATE); break;
 		default: return; // unreachable
 	}
 }
 
-static void do_and(bool can_assign) {
+static void do_and(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	uint32_t end_jump = emit_jump(OP_JUMP_IF_FALSE);
-	emit_byte(OP_POP);
-	parse_presedence(PREC_AND);
-	patch_jump(end_jump);
+	uint32_t end_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
+	parse_presedence(parser, PREC_AND);
+	patch_jump(parser, end_jump);
 }
 
-static void do_or(bool can_assign) {
+static void do_or(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	uint32_t else_jump = emit_jump(OP_JUMP_IF_FALSE);
-	uint32_t end_jump = emit_jump(OP_JUMP);
+	uint32_t else_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+	uint32_t end_jump = emit_jump(parser, OP_JUMP);
 
-	patch_jump(else_jump);
-	emit_byte(OP_POP);
+	patch_jump(parser, else_jump);
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
 
-	parse_presedence(PREC_OR);
-	patch_jump(end_jump);
+	parse_presedence(parser, PREC_OR);
+	patch_jump(parser, end_jump);
 }
 
-static void do_binary(bool can_assign) {
+#if defined(REGISTER_OPERANDS)
+// rewrites a right operand that is a single `OP_GET_LOCAL` or `OP_CONSTANT`
+// into the operator, which then reads it in place; `right` is where it starts
+static bool fuse_operand(Parser * parser, Op_Code instruction, uint32_t right) {
+	Chunk * chunk = current_chunk(parser);
+	uint32_t operand = chunk->count - 2;
+	if (operand != right && !(operand == right + 3 && chunk->code[right] == OP_WIDE)) { return false; }
+
+	bool is_local = chunk->code[operand] == OP_GET_LOCAL;
+	if (!is_local && chunk->code[operand] != OP_CONSTANT) { return false; }
+
+	switch (instruction) {
+		case OP_ADD:      chunk->code[operand] = is_local ? OP_ADD_LOCAL : OP_ADD_CONSTANT; break;
+		case OP_SUBTRACT: chunk->code[operand] = is_local ? OP_SUBTRACT_LOCAL : OP_SUBTRACT_CONSTANT; break;
+		case OP_LESS:     chunk->code[operand] = is_local ? OP_LESS_LOCAL : OP_LESS_CONSTANT; break;
+		case OP_GREATER:  chunk->code[operand] = is_local ? OP_GREATER_LOCAL : OP_GREATER_CONSTANT; break;
+		default: return false;
+	}
+	return true;
+}
+#endif // REGISTER_OPERANDS
+
+static void emit_operator(Parser * parser, Op_Code instruction, uint32_t right) {
+	stack_effect(parser, -1);
+#if defined(REGISTER_OPERANDS)
+	if (fuse_operand(parser, instruction, right)) { return; }
+#else
+	(void)right;
+#endif // REGISTER_OPERANDS
+	emit_byte(parser, (uint8_t)instruction);
+}
+
+static void do_binary(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	Token_Type operator_type = parser.previous.type;
+	Token_Type operator_type = parser->previous.type;
 	// compile the right operand
+	uint32_t right = current_chunk(parser)->count;
 	Parse_Rule * rule = get_rule(operator_type);
-	parse_presedence((Precedence)(rule->precedence + 1));
+	parse_presedence(parser, (Precedence)(rule->precedence + 1));
 	// emit the operator instruction
 	switch (operator_type) {
-		case TOKEN_BANG_EQUAL:    emit_bytes(OP_EQUAL, OP_NOT); break;
-		case TOKEN_EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
-		case TOKEN_GREATER:       emit_byte(OP_GREATER); break;
-		case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
-		case TOKEN_LESS:          emit_byte(OP_LESS); break;
-		case TOKEN_LESS_EQUAL:    emit_bytes(OP_GREATER, OP_NOT); break;
-
-		case TOKEN_PLUS:  emit_byte(OP_ADD); break;
-		case TOKEN_MINUS: emit_byte(OP_SUBTRACT); break;
-		case TOKEN_STAR:  emit_byte(OP_MULTIPLY); break;
-		case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
+		case TOKEN_BANG_EQUAL:    emit_bytes(parser, OP_EQUAL, OP_NOT); stack_effect(parser, -1); break;
+		case TOKEN_EQUAL_EQUAL:   emit_byte(parser, OP_EQUAL); stack_effect(parser, -1); break;
+		case TOKEN_GREATER:       emit_operator(parser, OP_GREATER, right); break;
+		case TOKEN_GREATER_EQUAL: emit_operator(parser, OP_LESS, right); emit_byte(parser, OP_NOT); break;
+		case TOKEN_LESS:          emit_operator(parser, OP_LESS, right); break;
+		case TOKEN_LESS_EQUAL:    emit_operator(parser, OP_GREATER, right); emit_byte(parser, OP_NOT); break;
+
+		case TOKEN_PLUS:  emit_operator(parser, OP_ADD, right); break;
+		case TOKEN_MINUS: emit_operator(parser, OP_SUBTRACT, right); break;
+		case TOKEN_STAR:  emit_byte(parser, OP_MULTIPLY); stack_effect(parser, -1); break;
+		case TOKEN_SLASH: emit_byte(parser, OP_DIVIDE); stack_effect(parser, -1); break;
 		default: return; // unreachable
 	}
 }
 
-static void do_literal(bool can_assign) {
+static void do_literal(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	Token_Type operator_type = parser.previous.type;
+	Token_Type operator_type = parser->previous.type;
 	switch (operator_type) {
-		case TOKEN_NIL:   emit_byte(OP_NIL); break;
-		case TOKEN_FALSE: emit_byte(OP_FALSE); break;
-		case TOKEN_TRUE:  emit_byte(OP_TRUE); break;
+		case TOKEN_NIL:   emit_byte(parser, OP_NIL); break;
+		case TOKEN_FALSE: emit_byte(parser, OP_FALSE); break;
+		case TOKEN_TRUE:  emit_byte(parser, OP_TRUE); break;
 		default: return; // unreachable
 	}
+	stack_effect(parser, 1);
 }
 
 typedef struct Obj Obj;
 
-static void do_string(bool can_assign) {
+static void do_string(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	Obj_String * string = copy_string(parser.previous.start + 1, parser.previous.length - 2);
-	emit_constant(TO_OBJ(string));
+	Obj_String * string = copy_string(parser->vm, parser->previous.start + 1, parser->previous.length - 2);
+	emit_constant(parser, TO_OBJ(string));
 }
 
-static void do_variable(bool can_assign) {
-	named_variable(parser.previous, can_assign);
+static bool bind_native(Parser * parser, Token name) {
+	if (resolve_local(parser, parser->compiler, &name) != UINT32_MAX) { return false; }
+	if (resolve_upvalue(parser, parser->compiler, &name) != UINT32_MAX) { return false; }
+
+	uint32_t native = vm_find_native(parser->vm, copy_string(parser->vm, name.start, name.length));
+	if (native == UINT32_MAX) { return false; }
+
+	// `OP_CALL_NATIVE` fills the callee slot with the result
+	emit_byte(parser, OP_NIL);
+	stack_effect(parser, 1);
+	parser->bound_native = native;
+	return true;
+}
+
+static void do_variable(Parser * parser, bool can_assign) {
+	if (parser->current.type == TOKEN_LEFT_PAREN && bind_native(parser, parser->previous)) { return; }
+	named_variable(parser, parser->previous, can_assign);
 }
 
 static Token synthetic_token(char const * text) {
@@ -562,380 +730,678 @@ static Token synthetic_token(char const * text) {
 	return token;
 }
 
-static void do_this(bool can_assign) {
+static void do_this(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	if (current_class == NULL) {
-		error("can't use 'this' outside of a class");
+	if (parser->class_compiler == NULL) {
+		error(parser, "can't use 'this' outside of a class");
 		return;
 	}
-	do_variable(false);
+	do_variable(parser, false);
 }
 
-static void do_super(bool can_assign) {
+static void do_super(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	if (current_compiler == NULL) {
-		error("can use 'super' only in methods");
+	if (parser->compiler == NULL) {
+		error(parser, "can use 'super' only in methods");
 	}
-	else if (!current_class->has_superclass) {
-		error("can use 'super' only on subclass methods");
+	else if (!parser->class_compiler->has_superclass) {
+		error(parser, "can use 'super' only on subclass methods");
 	}
 
-	consume(TOKEN_DOT, "expected a '.'");
-	consume(TOKEN_IDENTIFIER, "expected an identifier");
-	uint8_t name = identifier_constant(&parser.previous);
+	consume(parser, TOKEN_DOT, "expected a '.'");
+	consume(parser, TOKEN_IDENTIFIER, "expected an identifier");
+	uint32_t name = identifier_constant(parser, &parser->previous);
 
-	named_variable(synthetic_token("this"), false);
-	if (compiler_match(TOKEN_LEFT_PAREN)) {
-		uint8_t arg_count = argument_list();
-		named_variable(synthetic_token("super"), false);
-		emit_bytes(OP_SUPER_INVOKE, name);
-		emit_byte(arg_count);
+	named_variable(parser, synthetic_token("this"), false);
+	if (compiler_match(parser, TOKEN_LEFT_PAREN)) {
+		uint8_t arg_count = argument_list(parser);
+		named_variable(parser, synthetic_token("super"), false);
+		emit_constant_op(parser, OP_SUPER_INVOKE, name);
+		emit_byte(parser, arg_count);
+		stack_effect(parser, -(int32_t)arg_count - 1);
 
 	}
 	else {
-		named_variable(synthetic_token("super"), false);
-		emit_bytes(OP_GET_SUPER, name);
+		named_variable(parser, synthetic_token("super"), false);
+		emit_constant_op(parser, OP_GET_SUPER, name);
+		stack_effect(parser, -1);
 	}
 }
 
-static void do_grouping(bool can_assign) {
+static void do_yield(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	do_expression();
-	consume(TOKEN_RIGHT_PAREN, "expected a ')");
+	switch (parser->compiler->type) {
+		case TYPE_SCRIPT: error(parser, "can't yield from top-level code"); break;
+		case TYPE_INITIALIZER: error(parser, "can't yield from an initializer"); break;
+		default: break;
+	}
+	parser->compiler->function->is_generator = true;
+
+	switch (parser->current.type) {
+		case TOKEN_SEMICOLON:
+		case TOKEN_RIGHT_PAREN:
+		case TOKEN_RIGHT_BRACKET:
+		case TOKEN_COMMA:
+			emit_byte(parser, OP_NIL);
+			stack_effect(parser, 1);
+			break;
+		default:
+			do_expression(parser);
+			break;
+	}
+	emit_byte(parser, OP_YIELD);
 }
 
-static void do_call(bool can_assign) {
+static void do_grouping(Parser * parser, bool can_assign) {
 	(void)can_assign;
-	uint8_t arg_count = argument_list();
-	emit_bytes(OP_CALL, arg_count);
+	do_expression(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')");
 }
 
-static void do_dot(bool can_assign) {
-	consume(TOKEN_IDENTIFIER, "expected an identifier");
-	Token asd = parser.previous; (void)asd;
-	uint8_t name = identifier_constant(&parser.previous);
+static void do_call(Parser * parser, bool can_assign) {
+	(void)can_assign;
+	uint32_t native = parser->bound_native;
+	parser->bound_native = UINT32_MAX;
 
-	if (can_assign && compiler_match(TOKEN_EQUAL)) {
-		do_expression();
-		emit_bytes(OP_SET_PROPERTY, name);
+	uint8_t arg_count = argument_list(parser);
+	if (native != UINT32_MAX) {
+		emit_bytes(parser, OP_CALL_NATIVE, (uint8_t)native);
+		emit_byte(parser, arg_count);
 	}
-	else if (compiler_match(TOKEN_LEFT_PAREN)) {
-		uint8_t arg_count = argument_list();
-		emit_bytes(OP_INVOKE, name);
-		emit_byte(arg_count);
+	else {
+		parser->compiler->last_call = current_chunk(parser)->count;
+		emit_bytes(parser, OP_CALL, arg_count);
+	}
+	stack_effect(parser, -(int32_t)arg_count);
+}
+
+static void do_list(Parser * parser, bool can_assign) {
+	(void)can_assign;
+	uint8_t count = 0;
+	if (parser->current.type != TOKEN_RIGHT_BRACKET) {
+		do {
+			if (count == UINT8_MAX) {
+				error(parser, "can't have more that 255 list elements");
+			}
+			count++;
+			do_expression(parser);
+		} while (compiler_match(parser, TOKEN_COMMA));
+	}
+	consume(parser, TOKEN_RIGHT_BRACKET, "expected a ']'");
+	emit_bytes(parser, OP_LIST, count);
+	stack_effect(parser, 1 - (int32_t)count);
+}
+
+static void do_index(Parser * parser, bool can_assign) {
+	do_expression(parser);
+	consume(parser, TOKEN_RIGHT_BRACKET, "expected a ']'");
+
+	if (can_assign && compiler_match(parser, TOKEN_EQUAL)) {
+		do_expression(parser);
+		emit_byte(parser, OP_SET_INDEX);
+		stack_effect(parser, -2);
 	}
 	else {
-		emit_bytes(OP_GET_PROPERTY, name);
+		emit_byte(parser, OP_GET_INDEX);
+		stack_effect(parser, -1);
 	}
 }
 
-static void do_block(void);
-static void do_function(Function_Type type) {
-	Compiler compiler;
-	compiler_init(&compiler, type);
-	begin_scope();
+static void do_dot(Parser * parser, bool can_assign) {
+	consume(parser, TOKEN_IDENTIFIER, "expected an identifier");
+	Token asd = parser->previous; (void)asd;
+	uint32_t name = identifier_constant(parser, &parser->previous);
 
-	consume(TOKEN_LEFT_PAREN, "expected a '(");
-	if (parser.current.type != TOKEN_RIGHT_PAREN) {
+	if (can_assign && compiler_match(parser, TOKEN_EQUAL)) {
+		do_expression(parser);
+		emit_constant_op(parser, OP_SET_PROPERTY, name);
+		stack_effect(parser, -1);
+	}
+	else if (compiler_match(parser, TOKEN_LEFT_PAREN)) {
+		uint8_t arg_count = argument_list(parser);
+		emit_constant_op(parser, OP_INVOKE, name);
+		emit_byte(parser, arg_count);
+		stack_effect(parser, -(int32_t)arg_count);
+	}
+	else {
+		emit_constant_op(parser, OP_GET_PROPERTY, name);
+	}
+}
+
+static void do_parameters(Parser * parser) {
+	consume(parser, TOKEN_LEFT_PAREN, "expected a '(");
+	if (parser->current.type != TOKEN_RIGHT_PAREN) {
 		do {
-			if (current_compiler->function->arity == UINT8_MAX) {
-				error_at_current("can't have more that 255 parameters");
+			if (parser->compiler->function->arity == UINT8_MAX) {
+				error_at_current(parser, "can't have more that 255 parameters");
+			}
+			parser->compiler->function->arity++;
+			stack_effect(parser, 1);
+			uint32_t param_constant = parse_variable(parser, "expected a parameter name");
+			define_variable(parser, param_constant);
+		} while (compiler_match(parser, TOKEN_COMMA));
+	}
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')");
+}
+
+// finds the end of the body and captures whatever the body might use;
+// a name of an enclosing local is captured even if a local of the body
+// shadows it, the body is compiled by `compile_body`
+static void skim_body(Parser * parser) {
+	uint32_t depth = 1;
+	while (depth > 0) {
+		switch (parser->current.type) {
+			case TOKEN_EOF:
+				error_at_current(parser, "expected a '}'");
+				return;
+			case TOKEN_LEFT_BRACE: depth++; break;
+			case TOKEN_RIGHT_BRACE: depth--; break;
+			case TOKEN_IDENTIFIER:
+			case TOKEN_THIS:
+			case TOKEN_SUPER: {
+				if (parser->previous.type == TOKEN_DOT) { break; } // a property
+				Token name = parser->current;
+				if (resolve_local(parser, parser->compiler, &name) == UINT32_MAX) {
+					resolve_upvalue(parser, parser->compiler, &name);
+				}
+				break;
 			}
-			current_compiler->function->arity++;
-			uint8_t param_constant = parse_variable("expected a parameter name");
-			define_variable(param_constant);
-		} while (compiler_match(TOKEN_COMMA));
+			default: break;
+		}
+		compiler_advance(parser);
 	}
-	consume(TOKEN_RIGHT_PAREN, "expected a ')");
+}
 
-	consume(TOKEN_LEFT_BRACE, "expected a '{");
-	do_block();
+// keeps the source from `start` and the upvalue names
+static Obj_Function * skim_end(Parser * parser, Token * start) {
+	Compiler * compiler = parser->compiler;
+	Obj_Function * function = compiler->function;
 
-	// redundant: OP_RETURN does this implicitly
-	// end_scope();
+	uint32_t length = (uint32_t)(parser->previous.start + parser->previous.length - start->start);
+	uint32_t size = length;
+	for (uint32_t i = 0; i < function->upvalue_count; i++) {
+		size += compiler->upvalues[i].name.length + 1;
+	}
+
+	Lazy_Body * lazy = reallocate(parser->vm, NULL, 0, sizeof(Lazy_Body) + size);
+	lazy->length = length;
+	lazy->size = size;
+	lazy->line = start->line;
+	lazy->type = (uint8_t)compiler->type;
+	lazy->is_in_class = parser->class_compiler != NULL;
+	lazy->has_superclass = lazy->is_in_class && parser->class_compiler->has_superclass;
+	memcpy(lazy->chars, start->start, length);
 
-	Obj_Function * function = compiler_end();
+	char * names = lazy->chars + length;
+	for (uint32_t i = 0; i < function->upvalue_count; i++) {
+		Token * name = &compiler->upvalues[i].name;
+		memcpy(names, name->start, name->length);
+		names[name->length] = '\0';
+		names += name->length + 1;
+	}
+	function->lazy = lazy;
+
+	value_table_free(parser->vm, &compiler->constants);
+	parser->compiler = compiler->enclosing;
+	return function;
+}
+
+static void do_block(Parser * parser);
+static void do_function(Parser * parser, Function_Type type) {
+	Compiler compiler;
+	compiler_init(parser, &compiler, type, NULL);
+	begin_scope(parser);
+
+	Token start = parser->current;
+	do_parameters(parser);
+	consume(parser, TOKEN_LEFT_BRACE, "expected a '{");
+
+	Obj_Function * function;
+	if (parser->is_lazy) {
+		skim_body(parser);
+		function = skim_end(parser, &start);
+	}
+	else {
+		do_block(parser);
+
+		// redundant: OP_RETURN does this implicitly
+		// end_scope(parser);
+
+		function = compiler_end(parser);
+	}
 
-	uint8_t function_constant = make_constant(TO_OBJ(function));
+	uint32_t function_constant = make_constant(parser, TO_OBJ(function));
 	if (function->upvalue_count > 0) {
-		emit_bytes(OP_CLOSURE, function_constant);
+		emit_constant_op(parser, OP_CLOSURE, function_constant);
 		for (uint32_t i = 0; i < function->upvalue_count; i++) {
-			emit_bytes(
+			emit_bytes(parser, 
 				compiler.upvalues[i].index,
 				compiler.upvalues[i].is_local ? 1 : 0
 			);
 		}
 	}
 	else {
-		emit_bytes(OP_CONSTANT, function_constant);
+		emit_constant_op(parser, OP_CONSTANT, function_constant);
 	}
+	stack_effect(parser, 1);
 }
 
 // statements
-static void  do_expression_statement(void) {
-	do_expression();
-	consume(TOKEN_SEMICOLON, "expected a ';'");
-	emit_byte(OP_POP);
+static void  do_expression_statement(Parser * parser) {
+	do_expression(parser);
+	consume(parser, TOKEN_SEMICOLON, "expected a ';'");
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
 }
 
-static void do_var_declaration(void) {
-	uint8_t global = parse_variable("expected a variable name");
-
-	if (compiler_match(TOKEN_EQUAL)) {
-		do_expression();
+static void do_var_initializer(Parser * parser, uint32_t global) {
+	if (compiler_match(parser, TOKEN_EQUAL)) {
+		do_expression(parser);
 	}
 	else {
-		emit_byte(OP_NIL);
+		emit_byte(parser, OP_NIL);
+		stack_effect(parser, 1);
 	}
 
-	consume(TOKEN_SEMICOLON, "expected a ';");
+	consume(parser, TOKEN_SEMICOLON, "expected a ';");
+
+	define_variable(parser, global);
+}
 
-	define_variable(global);
+static void do_var_declaration(Parser * parser) {
+	uint32_t global = parse_variable(parser, "expected a variable name");
+	do_var_initializer(parser, global);
 }
 
-static void do_fun_declaration(void) {
-	uint8_t global = parse_variable("expected a function name");
-	mark_initialized();
-	do_function(TYPE_FUNCTION);
-	define_variable(global);
+static void do_fun_declaration(Parser * parser) {
+	uint32_t global = parse_variable(parser, "expected a function name");
+	mark_initialized(parser);
+	do_function(parser, TYPE_FUNCTION);
+	define_variable(parser, global);
 }
 
-static void do_method(void) {
-	consume(TOKEN_IDENTIFIER, "expected a method name");
-	uint8_t name_constant = identifier_constant(&parser.previous);
+static void do_method(Parser * parser) {
+	consume(parser, TOKEN_IDENTIFIER, "expected a method name");
+	uint32_t name_constant = identifier_constant(parser, &parser->previous);
 
 	Function_Type type = TYPE_METHOD;
-	if (identifier_is(&parser.previous, "init", 4)) {
+	if (identifier_is(&parser->previous, "init", 4)) {
 		type = TYPE_INITIALIZER;
 	}
-	do_function(type);
+	do_function(parser, type);
 
-	emit_bytes(OP_METHOD, name_constant);
+	emit_constant_op(parser, OP_METHOD, name_constant);
+	stack_effect(parser, -1);
 }
 
-static void do_class_declaration(void) {
-	consume(TOKEN_IDENTIFIER, "expected a class name");
-	Token class_name = parser.previous;
+static void do_class_declaration(Parser * parser) {
+	consume(parser, TOKEN_IDENTIFIER, "expected a class name");
+	Token class_name = parser->previous;
 
-	uint8_t name_constant = identifier_constant(&parser.previous);
-	declare_variable();
+	uint32_t name_constant = identifier_constant(parser, &parser->previous);
+	declare_variable(parser);
 
-	emit_bytes(OP_CLASS, name_constant);
-	define_variable(name_constant);
+	emit_constant_op(parser, OP_CLASS, name_constant);
+	stack_effect(parser, 1);
+	define_variable(parser, name_constant);
 
 	Class_Compiler class_compiler;
-	class_compiler.enclosing = current_class;
+	class_compiler.enclosing = parser->class_compiler;
 	class_compiler.name = class_name;
 	class_compiler.has_superclass = false;
-	current_class = &class_compiler;
+	parser->class_compiler = &class_compiler;
 
-	if (compiler_match(TOKEN_LESS)) {
-		consume(TOKEN_IDENTIFIER, "expected a superclass name");
-		do_variable(false);
-		if (identifiers_equal(&class_name, &parser.previous)) {
-			error("a class can't inherit from itself");
+	if (compiler_match(parser, TOKEN_LESS)) {
+		consume(parser, TOKEN_IDENTIFIER, "expected a superclass name");
+		do_variable(parser, false);
+		if (identifiers_equal(&class_name, &parser->previous)) {
+			error(parser, "a class can't inherit from itself");
 		}
 
-		begin_scope();
-		add_local(synthetic_token("super"));
-		define_variable(0);
+		begin_scope(parser);
+		add_local(parser, synthetic_token("super"));
+		define_variable(parser, 0);
 
-		named_variable(class_name, false);
-		emit_byte(OP_INHERIT);
+		named_variable(parser, class_name, false);
+		emit_byte(parser, OP_INHERIT);
+		stack_effect(parser, -1);
 
 		class_compiler.has_superclass = true;
 	}
 
-	named_variable(class_name, false);
+	named_variable(parser, class_name, false);
 
-	consume(TOKEN_LEFT_BRACE, "expected a '{'");
-	while (parser.current.type != TOKEN_RIGHT_BRACE && parser.current.type != TOKEN_EOF) {
-		do_method();
+	consume(parser, TOKEN_LEFT_BRACE, "expected a '{'");
+	while (parser->current.type != TOKEN_RIGHT_BRACE && parser->current.type != TOKEN_EOF) {
+		do_method(parser);
 	}
-	consume(TOKEN_RIGHT_BRACE, "expected a '}'");
+	consume(parser, TOKEN_RIGHT_BRACE, "expected a '}'");
 
-	emit_byte(OP_POP);
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
 
-	if (current_class->has_superclass) {
-		end_scope();
+	if (parser->class_compiler->has_superclass) {
+		end_scope(parser);
 	}
 
-	current_class = current_class->enclosing;
+	parser->class_compiler = parser->class_compiler->enclosing;
 }
 
-static void do_declaration(void);
-static void do_block(void) {
-	while (parser.current.type != TOKEN_RIGHT_BRACE && parser.current.type != TOKEN_EOF) {
-		do_declaration();
+static void do_declaration(Parser * parser);
+static void do_block(Parser * parser) {
+	while (parser->current.type != TOKEN_RIGHT_BRACE && parser->current.type != TOKEN_EOF) {
+		do_declaration(parser);
 	}
-	consume(TOKEN_RIGHT_BRACE, "expected a '}");
+	consume(parser, TOKEN_RIGHT_BRACE, "expected a '}");
 }
 
-static void do_statement(void);
-static void do_if_statement(void) {
-	consume(TOKEN_LEFT_PAREN, "expected a '('");
-	do_expression();
-	consume(TOKEN_RIGHT_PAREN, "expected a ')'");
+static void do_statement(Parser * parser);
+static void do_if_statement(Parser * parser) {
+	consume(parser, TOKEN_LEFT_PAREN, "expected a '('");
+	do_expression(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')'");
 
-	uint32_t then_jump = emit_jump(OP_JUMP_IF_FALSE);
-	emit_byte(OP_POP);
-	do_statement();
+	int32_t depth = parser->compiler->stack_depth;
+	uint32_t then_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
+	do_statement(parser);
 
-	uint32_t else_jump = emit_jump(OP_JUMP);
-	patch_jump(then_jump);
+	uint32_t else_jump = emit_jump(parser, OP_JUMP);
+	patch_jump(parser, then_jump);
 
-	emit_byte(OP_POP);
-	if (compiler_match(TOKEN_ELSE)) { do_statement(); }
-	patch_jump(else_jump);
+	parser->compiler->stack_depth = depth;
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
+	if (compiler_match(parser, TOKEN_ELSE)) { do_statement(parser); }
+	patch_jump(parser, else_jump);
 }
 
-static void do_while_statement(void) {
-	consume(TOKEN_LEFT_PAREN, "expected a '('");
+static void do_while_statement(Parser * parser) {
+	consume(parser, TOKEN_LEFT_PAREN, "expected a '('");
 
-	uint32_t loop_start = current_chunk()->count;
-	do_expression();
+	uint32_t loop_start = current_chunk(parser)->count;
+	do_expression(parser);
 
-	consume(TOKEN_RIGHT_PAREN, "expected a ')'");
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')'");
 
-	uint32_t exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-	emit_byte(OP_POP);
+	int32_t depth = parser->compiler->stack_depth;
+	uint32_t exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
 
-	do_statement();
-	emit_loop(loop_start);
+	do_statement(parser);
+	emit_loop(parser, loop_start);
 
-	patch_jump(exit_jump);
-	emit_byte(OP_POP);
+	patch_jump(parser, exit_jump);
+	parser->compiler->stack_depth = depth;
+	emit_byte(parser, OP_POP);
+	stack_effect(parser, -1);
 }
 
-static void do_for_statement(void) {
-	begin_scope();
+// `for (var name in iterable)`, see `OP_FOR_ITER`
+static void do_for_in_statement(Parser * parser, Token name) {
+	compiler_advance(parser);
+	do_expression(parser);
+	add_local(parser, synthetic_token("(iterable)"));
+	mark_initialized(parser);
+	emit_constant(parser, TO_INT(0));
+	add_local(parser, synthetic_token("(state)"));
+	mark_initialized(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "expected a ')'");
 
-	consume(TOKEN_LEFT_PAREN, "expected a '('");
+	uint32_t loop_start = current_chunk(parser)->count;
+	if (parser->is_wide) {
+		emit_wide(parser, 0xffff);
+	}
+	uint32_t exit_jump = current_chunk(parser)->count;
+	emit_bytes(parser, OP_FOR_ITER, (uint8_t)(parser->compiler->local_count - 2));
+	emit_bytes(parser, 0xff, 0xff);
+
+	// each iteration gets a fresh variable
+	begin_scope(parser);
+	stack_effect(parser, 1);
+	add_local(parser, name);
+	mark_initialized(parser);
+	do_statement(parser);
+	end_scope(parser);
+
+	emit_loop(parser, loop_start);
+	patch_jump(parser, exit_jump);
+}
 
-	if (compiler_match(TOKEN_SEMICOLON)) {
+static void do_for_statement(Parser * parser) {
+	begin_scope(parser);
+
+	consume(parser, TOKEN_LEFT_PAREN, "expected a '('");
+
+	if (compiler_match(parser, TOKEN_SEMICOLON)) {
 		// no initializer
 	}
-	else if (compiler_match(TOKEN_VAR)) {
-		do_var_declaration();
+	else if (compiler_match(parser, TOKEN_VAR)) {
+		consume(parser, TOKEN_IDENTIFIER, "expected a variable name");
+		if (parser->current.type == TOKEN_IDENTIFIER && identifier_is(&parser->current, "in", 2)) {
+			do_for_in_statement(parser, parser->previous);
+			end_scope(parser);
+			return;
+		}
+		declare_variable(parser);
+		do_var_initializer(parser, 0);
 	}
 	else {
-		do_expression_statement();
+		do_expression_statement(parser);
 	}
 
-	uint32_t loop_start = current_chunk()->count;
+	uint32_t loop_start = current_chunk(parser)->count;
 
 	uint32_t exit_jump = UINT32_MAX;
-	if (!compiler_match(TOKEN_SEMICOLON)) {
-		do_expression();
-		consume(TOKEN_SEMICOLON, "expected a ';'");
+	int32_t exit_depth = 0;
+	if (!compiler_match(parser, TOKEN_SEMICOLON)) {
+		do_expression(parser);
+		consume(parser, TOKEN_SEMICOLON, "expected a ';'");
 
-		exit_jump = emit_jump(OP_JUMP_IF_FALSE);
-		emit_byte(OP_POP);
+		exit_depth = parser->compiler->stack_depth;
+		exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+		emit_byte(parser, OP_POP);
+		stack_effect(parser, -1);
 	}
 
-	if (!compiler_match(TOKEN_RIGHT_PAREN)) {
-		uint32_t body_jump = emit_jump(OP_JUMP);
-		uint32_t per_loop_start = current_chunk()->count;
+	if (!compiler_match(parser, TOKEN_RIGHT_PAREN)) {
+		uint32_t body_jump = emit_jump(parser, OP_JUMP);
+		uint32_t per_loop_start = current_chunk(parser)->count;
 
-		do_expression();
-		emit_byte(OP_POP);
-		consume(TOKEN_RIGHT_PAREN, "expected a ')'");
+		do_expression(parser);
+		emit_byte(parser, OP_POP);
+		stack_effect(parser, -1);
+		consume(parser, TOKEN_RIGHT_PAREN, "expected a ')'");
 
-		emit_loop(loop_start);
+		emit_loop(parser, loop_start);
 		loop_start = per_loop_start;
-		patch_jump(body_jump);
+		patch_jump(parser, body_jump);
 	}
 
-	do_statement();
-	emit_loop(loop_start);
+	do_statement(parser);
+	emit_loop(parser, loop_start);
 
 	if (exit_jump != UINT32_MAX) {
-		patch_jump(exit_jump);
-		emit_byte(OP_POP);
+		patch_jump(parser, exit_jump);
+		parser->compiler->stack_depth = exit_depth;
+		emit_byte(parser, OP_POP);
+		stack_effect(parser, -1);
 	}
 
-	end_scope();
+	end_scope(parser);
 }
 
-static void do_return_statement(void) {
-	if (current_compiler->type == TYPE_SCRIPT) {
-		error("can't return from top-level code");
+static void do_return_statement(Parser * parser) {
+	if (parser->compiler->type == TYPE_SCRIPT) {
+		error(parser, "can't return from top-level code");
 	}
 
-	if (compiler_match(TOKEN_SEMICOLON)) {
-		emit_default_return();
+	if (compiler_match(parser, TOKEN_SEMICOLON)) {
+		emit_default_return(parser);
 	}
 	else {
-		if (current_compiler->type == TYPE_INITIALIZER) {
-			error("can't return values from an initializer");
+		if (parser->compiler->type == TYPE_INITIALIZER) {
+			error(parser, "can't return values from an initializer");
 		}
-		do_expression();
-		consume(TOKEN_SEMICOLON, "expected a ';'");
-		emit_byte(OP_RETURN);
+		do_expression(parser);
+		consume(parser, TOKEN_SEMICOLON, "expected a ';'");
+
+		// `return f(...)` reuses the frame; `OP_RETURN` is still needed
+		// for non-Lox callees and for jumps over the call
+		uint32_t count = current_chunk(parser)->count;
+		if (count >= 2 && parser->compiler->last_call == count - 2) {
+			current_chunk(parser)->code[parser->compiler->last_call] = OP_TAIL_CALL;
+		}
+		emit_byte(parser, OP_RETURN);
+		stack_effect(parser, -1);
 	}
 }
 
-static void do_statement(void) {
-	if (compiler_match(TOKEN_IF)) {
-		do_if_statement();
+static void do_statement(Parser * parser) {
+	if (compiler_match(parser, TOKEN_IF)) {
+		do_if_statement(parser);
 	}
-	else if (compiler_match(TOKEN_WHILE)) {
-		do_while_statement();
+	else if (compiler_match(parser, TOKEN_WHILE)) {
+		do_while_statement(parser);
 	}
-	else if (compiler_match(TOKEN_FOR)) {
-		do_for_statement();
+	else if (compiler_match(parser, TOKEN_FOR)) {
+		do_for_statement(parser);
 	}
-	else if (compiler_match(TOKEN_RETURN)) {
-		do_return_statement();
+	else if (compiler_match(parser, TOKEN_RETURN)) {
+		do_return_statement(parser);
 	}
-	else if (compiler_match(TOKEN_LEFT_BRACE)) {
-		begin_scope();
-		do_block();
-		end_scope();
+	else if (compiler_match(parser, TOKEN_LEFT_BRACE)) {
+		begin_scope(parser);
+		do_block(parser);
+		end_scope(parser);
 	}
 	else {
-		do_expression_statement();
+		do_expression_statement(parser);
 	}
 }
 
-static void do_declaration(void) {
-	if (compiler_match(TOKEN_VAR)) {
-		do_var_declaration();
+static void do_declaration(Parser * parser) {
+	if (compiler_match(parser, TOKEN_VAR)) {
+		do_var_declaration(parser);
 	}
-	else if (compiler_match(TOKEN_FUN)) {
-		do_fun_declaration();
+	else if (compiler_match(parser, TOKEN_FUN)) {
+		do_fun_declaration(parser);
 	}
-	else if (compiler_match(TOKEN_CLASS)) {
-		do_class_declaration();
+	else if (compiler_match(parser, TOKEN_CLASS)) {
+		do_class_declaration(parser);
 	}
 	else {
-		do_statement();
+		do_statement(parser);
 	}
 
-	if (parser.panic_mode) { syncronize(); }
+	if (parser->panic_mode) { syncronize(parser); }
 }
 
 //
-Obj_Function * compile(char const * source) {
-	scanner_init(source);
+static Obj_Function * compile_script(VM * vm, char const * source, size_t length, bool is_wide, bool * has_long_jump) {
+	Parser state = {
+		.vm = vm,
+		.bound_native = UINT32_MAX,
+		.is_lazy = vm->is_lazy,
+		.is_wide = is_wide,
+	};
+	Parser * parser = &state;
+	scanner_init(&parser->scanner, source, length);
+
+	// the collector walks `vm->parser` to find functions under construction
+	vm->parser = parser;
 
 	Compiler compiler;
-	compiler_init(&compiler, TYPE_SCRIPT);
+	compiler_init(parser, &compiler, TYPE_SCRIPT, NULL);
+
+	compiler_advance(parser);
+	while (!compiler_match(parser, TOKEN_EOF)) {
+		do_declaration(parser);
+	}
+	Obj_Function * function = compiler_end(parser);
 
-	parser.had_error = false;
-	parser.panic_mode = false;
+	vm->parser = NULL;
+	*has_long_jump = parser->has_long_jump;
+	return parser->had_error ? NULL : function;
+}
 
-	compiler_advance();
-	while (!compiler_match(TOKEN_EOF)) {
-		do_declaration();
+// forward jumps are emitted before their target is known, so they are short
+// until one of them doesn't fit; then it all starts over with `OP_WIDE` on each
+Obj_Function * compile(VM * vm, char const * source, size_t length) {
+	bool has_long_jump;
+	Obj_Function * function = compile_script(vm, source, length, false, &has_long_jump);
+	if (function != NULL && has_long_jump) {
+		function = compile_script(vm, source, length, true, &has_long_jump);
+	}
+	return function;
+}
+
+static bool compile_lazy(VM * vm, Obj_Function * function, bool is_wide, bool * has_long_jump) {
+	Lazy_Body * lazy = function->lazy;
+	Parser state = {
+		.vm = vm,
+		.bound_native = UINT32_MAX,
+		.is_lazy = true,
+		.is_wide = is_wide,
+	};
+	Parser * parser = &state;
+	scanner_init(&parser->scanner, lazy->chars, lazy->length);
+	parser->scanner.line = lazy->line;
+
+	// only `this` and `super` need the class
+	Class_Compiler class_compiler = {
+		.enclosing = NULL,
+		.name = synthetic_token(""),
+		.has_superclass = lazy->has_superclass,
+	};
+	if (lazy->is_in_class) { parser->class_compiler = &class_compiler; }
+
+	vm->parser = parser;
+
+	Compiler compiler;
+	compiler_init(parser, &compiler, (Function_Type)lazy->type, function);
+	compiler.lazy = lazy;
+	begin_scope(parser);
+
+	compiler_advance(parser);
+	function->arity = 0;
+	do_parameters(parser);
+	consume(parser, TOKEN_LEFT_BRACE, "expected a '{");
+	do_block(parser);
+	consume(parser, TOKEN_EOF, "expected the end of the function");
+	compiler_end(parser);
+
+	vm->parser = NULL;
+	*has_long_jump = parser->has_long_jump && !parser->had_error;
+	if (parser->had_error || parser->has_long_jump) {
+		chunk_free(vm, &function->chunk);
+		function->is_generator = false;
+		return false;
 	}
-	Obj_Function * function = compiler_end();
-	return parser.had_error ? NULL : function;
+	return true;
+}
+
+// see `compile`
+bool compile_body(VM * vm, Obj_Function * function) {
+	bool has_long_jump;
+	bool is_compiled = compile_lazy(vm, function, false, &has_long_jump);
+	if (!is_compiled && has_long_jump) {
+		is_compiled = compile_lazy(vm, function, true, &has_long_jump);
+	}
+	if (!is_compiled) { return false; }
+
+	Lazy_Body * lazy = function->lazy;
+	function->lazy = NULL;
+	reallocate(vm, lazy, sizeof(Lazy_Body) + lazy->size, 0);
+	return true;
 }
 
-void gc_mark_compiler_roots_grey(void) {
-	for (Compiler * compiler = current_compiler; compiler != NULL; compiler = compiler->enclosing) {
-		gc_mark_object_grey((Obj *)compiler->function);
+void gc_mark_compiler_roots_grey(VM * vm) {
+	if (vm->parser == NULL) { return; }
+	for (Compiler * compiler = vm->parser->compiler; compiler != NULL; compiler = compiler->enclosing) {
+		gc_mark_object_grey(vm, (Obj *)compiler->function);
 	}
 }
 
@@ -945,6 +1411,8 @@ static Parse_Rule rules[] = {
 	// [TOKEN_RIGHT_PAREN]   = {NULL,        NULL,      PREC_NONE},
 	// [TOKEN_LEFT_BRACE]    = {NULL,        NULL,      PREC_NONE},
 	// [TOKEN_RIGHT_BRACE]   = {NULL,        NULL,      PREC_NONE},
+	[TOKEN_LEFT_BRACKET]  = {do_list,     do_index,  PREC_CALL},
+	// [TOKEN_RIGHT_BRACKET] = {NULL,        NULL,      PREC_NONE},
 	// [TOKEN_COMMA]         = {NULL,        NULL,      PREC_NONE},
 	[TOKEN_DOT]           = {NULL,        do_dot,    PREC_CALL},
 	[TOKEN_MINUS]         = {do_unary,    do_binary, PREC_TERM},
@@ -979,6 +1447,7 @@ static Parse_Rule rules[] = {
 	[TOKEN_TRUE]          = {do_literal,  NULL,      PREC_NONE},
 	// [TOKEN_VAR]           = {NULL,        NULL,      PREC_NONE},
 	// [TOKEN_WHILE]         = {NULL,        NULL,      PREC_NONE},
+	[TOKEN_YIELD]         = {do_yield,    NULL,      PREC_NONE},
 	// [TOKEN_ERROR]         = {NULL,        NULL,      PREC_NONE},
 	[TOKEN_EOF]           = {NULL,        NULL,      PREC_NONE},
 };
@@ -1,9 +1,15 @@
 #if !defined(LOX_COMPILER)
 #define LOX_COMPILER
 
+#include "common.h"
+
+struct VM;
 struct Obj_Function;
-struct Obj_Function * compile(char const * source);
+struct Obj_Function * compile(struct VM * vm, char const * source, size_t length);
+
+// compiles a body left by `vm->is_lazy`, reports errors like `compile`
+bool compile_body(struct VM * vm, struct Obj_Function * function);
 
-void gc_mark_compiler_roots_grey(void);
+void gc_mark_compiler_roots_grey(struct VM * vm);
 
 #endif
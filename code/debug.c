@@ -13,16 +13,16 @@ void chunk_disassemble(Chunk * chunk, char const * name) {
 	}
 }
 
-static uint32_t constant_instruction(char const * name, Chunk * chunk, uint32_t offset) {
-	uint8_t constant = chunk->code[offset + 1];
+static uint32_t constant_instruction(char const * name, Chunk * chunk, uint32_t offset, uint32_t wide) {
+	uint32_t constant = wide << 8 | chunk->code[offset + 1];
 	printf("%-16s %4d '", name, constant);
 	value_print(chunk->constants.values[constant]);
 	printf("'\n");
 	return offset + 2;
 }
 
-static uint32_t invoke_instruction(char const * name, Chunk * chunk, uint32_t offset) {
-	uint8_t constant = chunk->code[offset + 1];
+static uint32_t invoke_instruction(char const * name, Chunk * chunk, uint32_t offset, uint32_t wide) {
+	uint32_t constant = wide << 8 | chunk->code[offset + 1];
 	uint8_t arg_count = chunk->code[offset + 2];
 	printf("%-16s (%d args) %4d '", name, arg_count, constant);
 	value_print(chunk->constants.values[constant]);
@@ -36,8 +36,8 @@ static uint32_t byte_instruction(char const * name, Chunk * chunk, uint32_t offs
 	return offset + 2;
 }
 
-static uint32_t jump_instruction(char const * name, int32_t sign, Chunk * chunk, uint32_t offset) {
-	uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8) | (uint16_t)(chunk->code[offset + 2]);
+static uint32_t jump_instruction(char const * name, int32_t sign, Chunk * chunk, uint32_t offset, uint32_t wide) {
+	uint32_t jump = wide << 16 | (uint32_t)(chunk->code[offset + 1] << 8) | (uint32_t)(chunk->code[offset + 2]);
 	printf("%-16s %4d -> %d\n", name, offset, (int32_t)(offset + 3) + sign * (int32_t)jump);
 	return offset + 3;
 }
@@ -51,28 +51,39 @@ typedef struct Obj_Function Obj_Function;
 
 uint32_t chunk_disassemble_instruction(Chunk * chunk, uint32_t offset) {
 	printf("%04d ", offset);
-	if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+	uint32_t line = chunk_get_line(chunk, offset);
+	if (offset > 0 && line == chunk_get_line(chunk, offset - 1)) {
 		printf("   | ");
 	}
 	else {
-		printf("%04d ", chunk->lines[offset]);
+		printf("%04d ", line);
 	}
 
+	// the prefix is shown as a part of the instruction it widens
 	Op_Code instruction = chunk->code[offset];
+	uint32_t wide = 0;
+	if (instruction == OP_WIDE) {
+		wide = (uint32_t)(chunk->code[offset + 1] << 8) | (uint32_t)chunk->code[offset + 2];
+		offset += 3;
+		instruction = chunk->code[offset];
+	}
+
 	switch (instruction) {
 		case OP_POP:           return simple_instruction("OP_POP", offset);
-		case OP_CONSTANT:      return constant_instruction("OP_CONSTANT", chunk, offset);
-		case OP_DEFINE_GLOBAL: return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+		case OP_CONSTANT:      return constant_instruction("OP_CONSTANT", chunk, offset, wide);
+		case OP_DEFINE_GLOBAL: return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset, wide);
 		case OP_CLOSE_UPVALUE: return simple_instruction("OP_CLOSE_UPVALUE", offset);
 
 		case OP_SET_LOCAL:    return byte_instruction("OP_SET_LOCAL", chunk, offset);
 		case OP_GET_LOCAL:    return byte_instruction("OP_GET_LOCAL", chunk, offset);
-		case OP_SET_GLOBAL:   return constant_instruction("OP_SET_GLOBAL", chunk, offset);
-		case OP_GET_GLOBAL:   return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+		case OP_SET_GLOBAL:   return constant_instruction("OP_SET_GLOBAL", chunk, offset, wide);
+		case OP_GET_GLOBAL:   return constant_instruction("OP_GET_GLOBAL", chunk, offset, wide);
 		case OP_SET_UPVALUE:  return byte_instruction("OP_SET_UPVALUE", chunk, offset);
 		case OP_GET_UPVALUE:  return byte_instruction("OP_GET_UPVALUE", chunk, offset);
-		case OP_SET_PROPERTY: return constant_instruction("OP_SET_PROPERTY", chunk, offset);
-		case OP_GET_PROPERTY: return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+		case OP_SET_PROPERTY: return constant_instruction("OP_SET_PROPERTY", chunk, offset, wide);
+		case OP_GET_PROPERTY: return constant_instruction("OP_GET_PROPERTY", chunk, offset, wide);
+		case OP_SET_INDEX:    return simple_instruction("OP_SET_INDEX", offset);
+		case OP_GET_INDEX:    return simple_instruction("OP_GET_INDEX", offset);
 
 		case OP_NIL:   return simple_instruction("OP_NIL", offset);
 		case OP_FALSE: return simple_instruction("OP_FALSE", offset);
@@ -87,15 +98,24 @@ uint32_t chunk_disassemble_instruction(Chunk * chunk, uint32_t offset) {
 		case OP_MULTIPLY: return simple_instruction("OP_MULTIPLY", offset);
 		case OP_DIVIDE:   return simple_instruction("OP_DIVIDE", offset);
 
+		case OP_ADD_LOCAL:         return byte_instruction("OP_ADD_LOCAL", chunk, offset);
+		case OP_ADD_CONSTANT:      return constant_instruction("OP_ADD_CONSTANT", chunk, offset, wide);
+		case OP_SUBTRACT_LOCAL:    return byte_instruction("OP_SUBTRACT_LOCAL", chunk, offset);
+		case OP_SUBTRACT_CONSTANT: return constant_instruction("OP_SUBTRACT_CONSTANT", chunk, offset, wide);
+		case OP_LESS_LOCAL:        return byte_instruction("OP_LESS_LOCAL", chunk, offset);
+		case OP_LESS_CONSTANT:     return constant_instruction("OP_LESS_CONSTANT", chunk, offset, wide);
+		case OP_GREATER_LOCAL:     return byte_instruction("OP_GREATER_LOCAL", chunk, offset);
+		case OP_GREATER_CONSTANT:  return constant_instruction("OP_GREATER_CONSTANT", chunk, offset, wide);
+
 		case OP_NOT:    return simple_instruction("OP_NOT", offset);
 		case OP_NEGATE: return simple_instruction("OP_NEGATE", offset);
 
-		case OP_LOOP:          return jump_instruction("OP_LOOP", -1, chunk, offset);
-		case OP_JUMP:          return jump_instruction("OP_JUMP", 1, chunk, offset);
-		case OP_JUMP_IF_FALSE: return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+		case OP_LOOP:          return jump_instruction("OP_LOOP", -1, chunk, offset, wide);
+		case OP_JUMP:          return jump_instruction("OP_JUMP", 1, chunk, offset, wide);
+		case OP_JUMP_IF_FALSE: return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset, wide);
 
 		case OP_CLOSURE: {
-			uint8_t constant = chunk->code[offset + 1];
+			uint32_t constant = wide << 8 | chunk->code[offset + 1];
 			printf("%-16s %4d '", "OP_CLOSURE", constant);
 			value_print(chunk->constants.values[constant]);
 			printf("'\n");
@@ -112,16 +132,34 @@ uint32_t chunk_disassemble_instruction(Chunk * chunk, uint32_t offset) {
 
 			return offset + 2 + function->upvalue_count * 2;
 		}
-		case OP_CLASS: return constant_instruction("OP_CLASS", chunk, offset);
-		case OP_METHOD: return constant_instruction("OP_METHOD", chunk, offset);
-		case OP_INVOKE: return invoke_instruction("OP_INVOKE", chunk, offset);
+		case OP_LIST: return byte_instruction("OP_LIST", chunk, offset);
+		case OP_CLASS: return constant_instruction("OP_CLASS", chunk, offset, wide);
+		case OP_METHOD: return constant_instruction("OP_METHOD", chunk, offset, wide);
+		case OP_INVOKE: return invoke_instruction("OP_INVOKE", chunk, offset, wide);
 
 		case OP_INHERIT: return simple_instruction("OP_INHERIT", offset);
-		case OP_GET_SUPER: return constant_instruction("OP_GET_SUPER", chunk, offset);
-		case OP_SUPER_INVOKE: return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+		case OP_GET_SUPER: return constant_instruction("OP_GET_SUPER", chunk, offset, wide);
+		case OP_SUPER_INVOKE: return invoke_instruction("OP_SUPER_INVOKE", chunk, offset, wide);
 
 		case OP_CALL: return byte_instruction("OP_CALL", chunk, offset);
+		case OP_TAIL_CALL: return byte_instruction("OP_TAIL_CALL", chunk, offset);
+		case OP_CALL_NATIVE: {
+			uint8_t index = chunk->code[offset + 1];
+			uint8_t arg_count = chunk->code[offset + 2];
+			printf("%-16s (%d args) %4d\n", "OP_CALL_NATIVE", arg_count, index);
+			return offset + 3;
+		}
 		case OP_RETURN: return simple_instruction("OP_RETURN", offset);
+
+		case OP_GENERATOR: return simple_instruction("OP_GENERATOR", offset);
+		case OP_YIELD: return simple_instruction("OP_YIELD", offset);
+		case OP_FOR_ITER: {
+			uint8_t slot = chunk->code[offset + 1];
+			uint32_t jump = wide << 16 | (uint32_t)(chunk->code[offset + 2] << 8) | (uint32_t)(chunk->code[offset + 3]);
+			printf("%-16s %4d %4d -> %d\n", "OP_FOR_ITER", slot, offset, offset + 4 + jump);
+			return offset + 4;
+		}
+		case OP_WIDE: return simple_instruction("OP_WIDE", offset);
 	}
 
 	printf("unknown opcode %d\n", instruction);
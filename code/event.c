@@ -0,0 +1,456 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <fcntl.h>
+	#include <io.h>
+	#include <sys/stat.h>
+#else
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+	#if defined(__linux__)
+		#include <sys/epoll.h>
+	#endif
+#endif
+
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+#include "event.h"
+
+#define EVENT_READ_SIZE 16384
+
+typedef struct VM VM;
+typedef struct Obj Obj;
+typedef struct Obj_Fiber Obj_Fiber;
+typedef struct Obj_String Obj_String;
+typedef struct Obj_List Obj_List;
+typedef struct Obj_Handle Obj_Handle;
+
+typedef enum {
+	IO_READ,
+	IO_WRITE,
+} Io_Kind;
+
+typedef struct {
+	int fd;
+	Io_Kind kind;
+	Obj_Handle * handle; // can't be collected and closed meanwhile
+	Obj_Fiber * fiber;
+	Obj_String * data; // what is left to write starts at `written`
+	uint32_t written;
+} Io_Wait;
+
+typedef struct Event_Loop Event_Loop;
+struct Event_Loop {
+#if defined(__linux__)
+	int epoll_fd;
+#endif
+	Io_Wait * waits;
+	uint32_t count, capacity;
+};
+
+static Io_Wait * find_wait(Event_Loop * loop, int fd) {
+	if (loop == NULL) { return NULL; }
+	for (uint32_t i = 0; i < loop->count; i++) {
+		if (loop->waits[i].fd == fd) { return &loop->waits[i]; }
+	}
+	return NULL;
+}
+
+// -- platform
+#if defined(_WIN32)
+#define STDOUT_FILENO 1
+#define STDERR_FILENO 2
+#define EVENT_PIPE_SIZE 65536
+
+#define OPEN_READ   (_O_RDONLY | _O_BINARY)
+#define OPEN_WRITE  (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY)
+#define OPEN_APPEND (_O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY)
+
+static int fd_open(char const * path, int flags) { return _open(path, flags, _S_IREAD | _S_IWRITE); }
+static int fd_close(int fd) { return _close(fd); }
+static int64_t fd_read(int fd, char * buffer, uint32_t size) { return _read(fd, buffer, size); }
+static int64_t fd_write(int fd, char const * buffer, uint32_t size) { return _write(fd, buffer, size); }
+static bool fd_pipe(int fds[2]) { return _pipe(fds, EVENT_PIPE_SIZE, _O_BINARY) == 0; }
+
+// only reads from a pipe can be not ready; writes and other reads block
+static bool is_ready(int fd, Io_Kind kind, bool block) {
+	if (kind == IO_WRITE || block) { return true; }
+
+	intptr_t os_handle = _get_osfhandle(fd);
+	HANDLE handle = (HANDLE)os_handle;
+	if (handle == INVALID_HANDLE_VALUE || GetFileType(handle) != FILE_TYPE_PIPE) { return true; }
+
+	DWORD available;
+	if (!PeekNamedPipe(handle, NULL, 0, NULL, &available, NULL)) { return true; } // let the read report it
+	return available > 0;
+}
+
+static bool loop_init(Event_Loop * loop) { (void)loop; return true; }
+static void loop_free(Event_Loop * loop) { (void)loop; }
+static bool loop_add(Event_Loop * loop, Io_Wait const * wait) { (void)loop; (void)wait; return true; }
+static void loop_remove(Event_Loop * loop, Io_Wait const * wait) { (void)loop; (void)wait; }
+
+static Io_Wait * loop_next(Event_Loop * loop) {
+	for (;;) {
+		for (uint32_t i = 0; i < loop->count; i++) {
+			if (is_ready(loop->waits[i].fd, loop->waits[i].kind, false)) { return &loop->waits[i]; }
+		}
+		// anonymous pipes can't be waited for together, so check them again shortly
+		Sleep(1);
+	}
+}
+#else
+#define OPEN_READ   O_RDONLY
+#define OPEN_WRITE  (O_WRONLY | O_CREAT | O_TRUNC)
+#define OPEN_APPEND (O_WRONLY | O_CREAT | O_APPEND)
+
+static int fd_open(char const * path, int flags) { return open(path, flags, 0644); }
+static int fd_close(int fd) { return close(fd); }
+static int64_t fd_read(int fd, char * buffer, uint32_t size) { return read(fd, buffer, size); }
+static int64_t fd_write(int fd, char const * buffer, uint32_t size) { return write(fd, buffer, size); }
+
+static bool fd_pipe(int fds[2]) {
+	if (pipe(fds) < 0) { return false; }
+	// writes into a full pipe suspend instead of blocking
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+	}
+	return true;
+}
+
+// regular files are always ready
+static bool is_ready(int fd, Io_Kind kind, bool block) {
+	struct pollfd entry = {.fd = fd, .events = kind == IO_READ ? POLLIN : POLLOUT};
+	while (poll(&entry, 1, block ? -1 : 0) < 0) {
+		if (errno != EINTR) { return true; } // let the following call report it
+	}
+	return entry.revents != 0;
+}
+
+#if defined(__linux__)
+static bool loop_init(Event_Loop * loop) {
+	loop->epoll_fd = epoll_create1(0);
+	return loop->epoll_fd >= 0;
+}
+
+static void loop_free(Event_Loop * loop) { close(loop->epoll_fd); }
+
+static bool loop_add(Event_Loop * loop, Io_Wait const * wait) {
+	struct epoll_event event = {
+		.events = wait->kind == IO_READ ? EPOLLIN : EPOLLOUT,
+		.data.fd = wait->fd,
+	};
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, wait->fd, &event) == 0;
+}
+
+static void loop_remove(Event_Loop * loop, Io_Wait const * wait) {
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, wait->fd, NULL);
+}
+
+static Io_Wait * loop_next(Event_Loop * loop) {
+	for (;;) {
+		struct epoll_event event;
+		int count = epoll_wait(loop->epoll_fd, &event, 1, -1);
+		if (count < 0 && errno != EINTR) { return NULL; }
+		if (count > 0) { return find_wait(loop, event.data.fd); }
+	}
+}
+#else
+static bool loop_init(Event_Loop * loop) { (void)loop; return true; }
+static void loop_free(Event_Loop * loop) { (void)loop; }
+static bool loop_add(Event_Loop * loop, Io_Wait const * wait) { (void)loop; (void)wait; return true; }
+static void loop_remove(Event_Loop * loop, Io_Wait const * wait) { (void)loop; (void)wait; }
+
+// waits come and go between calls, so the set is built anew
+static Io_Wait * loop_next(Event_Loop * loop) {
+	struct pollfd * entries = malloc(sizeof(struct pollfd) * loop->count);
+	if (entries == NULL) { exit(1); }
+	for (uint32_t i = 0; i < loop->count; i++) {
+		entries[i] = (struct pollfd){
+			.fd = loop->waits[i].fd,
+			.events = loop->waits[i].kind == IO_READ ? POLLIN : POLLOUT,
+		};
+	}
+
+	int count;
+	do {
+		count = poll(entries, (nfds_t)loop->count, -1);
+	} while (count < 0 && errno == EINTR);
+
+	Io_Wait * ready = NULL;
+	for (uint32_t i = 0; count > 0 && i < loop->count; i++) {
+		if (entries[i].revents != 0) { ready = &loop->waits[i]; break; }
+	}
+
+	int error = errno;
+	free(entries);
+	errno = error;
+	return ready;
+}
+#endif
+#endif
+
+// -- loop
+static Event_Loop * event_loop_get(VM * vm) {
+	if (vm->events != NULL) { return vm->events; }
+
+	Event_Loop * loop = malloc(sizeof(Event_Loop));
+	if (loop == NULL) { exit(1); }
+	if (!loop_init(loop)) {
+		free(loop);
+		return NULL;
+	}
+	loop->waits = NULL;
+	loop->count = 0;
+	loop->capacity = 0;
+	vm->events = loop;
+	return loop;
+}
+
+void event_loop_free(Event_Loop * loop) {
+	loop_free(loop);
+	free(loop->waits);
+	free(loop);
+}
+
+void gc_mark_event_loop_grey(VM * vm) {
+	Event_Loop * loop = vm->events;
+	if (loop == NULL) { return; }
+
+	// waiting fibers might be unreachable from the script
+	for (uint32_t i = 0; i < loop->count; i++) {
+		gc_mark_object_grey(vm, (Obj *)loop->waits[i].handle);
+		gc_mark_object_grey(vm, (Obj *)loop->waits[i].fiber);
+		gc_mark_object_grey(vm, (Obj *)loop->waits[i].data);
+	}
+}
+
+void event_handle_free(Obj_Handle * handle) {
+	if (handle->fd >= 0 && !handle->is_standard) { fd_close(handle->fd); }
+}
+
+static Obj_Handle * get_handle(VM * vm, Value value) {
+	if (!IS_HANDLE(value)) {
+		runtime_error(vm, "expected a handle");
+		return NULL;
+	}
+	Obj_Handle * handle = AS_HANDLE(value);
+	if (handle->fd < 0) {
+		runtime_error(vm, "the handle is closed");
+		return NULL;
+	}
+	return handle;
+}
+
+static bool is_waited_for(VM * vm, Obj_Handle * handle) {
+	if (find_wait(vm->events, handle->fd) == NULL) { return false; }
+	runtime_error(vm, "a fiber is waiting for the handle");
+	return true;
+}
+
+static bool io_error(VM * vm, char const * action) {
+	runtime_error(vm, "couldn't %s: %s", action, strerror(errno));
+	return false;
+}
+
+// a single read of whatever is available, `nil` at the end
+static bool read_chunk(VM * vm, int fd, Value * result) {
+	char buffer[EVENT_READ_SIZE];
+	int64_t count;
+	do {
+		count = fd_read(fd, buffer, sizeof(buffer));
+	} while (count < 0 && errno == EINTR);
+
+	if (count < 0) { return io_error(vm, "read"); }
+	*result = count == 0 ? TO_NIL() : TO_OBJ(copy_string(vm, buffer, (uint32_t)count));
+	return true;
+}
+
+// as much as the descriptor takes without blocking
+static bool write_chunk(VM * vm, int fd, Obj_String * data, uint32_t * written) {
+	while (*written < data->length) {
+		int64_t count = fd_write(fd, data->chars + *written, data->length - *written);
+		if (count < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno == EAGAIN || errno == EWOULDBLOCK) { return true; }
+			return io_error(vm, "write");
+		}
+		*written += (uint32_t)count;
+	}
+	return true;
+}
+
+static bool wait_start(VM * vm, Io_Wait wait) {
+	Event_Loop * loop = event_loop_get(vm);
+	if (loop == NULL) { return io_error(vm, "create an event loop"); }
+	if (!loop_add(loop, &wait)) { return io_error(vm, "wait for the handle"); }
+
+	if (loop->count + 1 > loop->capacity) {
+		loop->capacity = GROW_CAPACITY(loop->capacity);
+		loop->waits = realloc(loop->waits, sizeof(Io_Wait) * loop->capacity);
+		if (loop->waits == NULL) { exit(1); }
+	}
+	wait.fiber = vm->fiber;
+	loop->waits[loop->count++] = wait;
+	vm_fiber_wait(vm);
+	return true;
+}
+
+static void wait_finish(Event_Loop * loop, Io_Wait * wait) {
+	loop_remove(loop, wait);
+	*wait = loop->waits[--loop->count];
+}
+
+// -- natives
+bool event_open(VM * vm, Value path, Value mode, Value * result) {
+	if (!IS_STRING(path) || !IS_STRING(mode)) {
+		runtime_error(vm, "expected a path and a mode");
+		return false;
+	}
+
+	int flags;
+	char const * chars = AS_STRING(mode)->chars;
+	if (strcmp(chars, "r") == 0) { flags = OPEN_READ; }
+	else if (strcmp(chars, "w") == 0) { flags = OPEN_WRITE; }
+	else if (strcmp(chars, "a") == 0) { flags = OPEN_APPEND; }
+	else {
+		runtime_error(vm, "expected a mode of \"r\", \"w\" or \"a\"");
+		return false;
+	}
+
+	int fd = fd_open(AS_STRING(path)->chars, flags);
+	if (fd < 0) { return io_error(vm, "open the file"); }
+	*result = TO_OBJ(new_handle(vm, fd, false));
+	return true;
+}
+
+bool event_delete(VM * vm, Value path) {
+	if (!IS_STRING(path)) {
+		runtime_error(vm, "expected a path");
+		return false;
+	}
+	if (remove(AS_STRING(path)->chars) != 0) { return io_error(vm, "delete the file"); }
+	return true;
+}
+
+bool event_standard(VM * vm, int fd, Value * result) {
+	*result = TO_OBJ(new_handle(vm, fd, true));
+	return true;
+}
+
+bool event_close(VM * vm, Value value) {
+	Obj_Handle * handle = get_handle(vm, value);
+	if (handle == NULL || is_waited_for(vm, handle)) { return false; }
+	if (handle->is_standard) {
+		runtime_error(vm, "can't close a standard handle");
+		return false;
+	}
+
+	int fd = handle->fd;
+	handle->fd = -1;
+	if (fd_close(fd) < 0) { return io_error(vm, "close the handle"); }
+	return true;
+}
+
+bool event_pipe(VM * vm, Value * result) {
+	int fds[2];
+	if (!fd_pipe(fds)) { return io_error(vm, "create a pipe"); }
+
+	Obj_List * list = new_list(vm);
+	*result = TO_OBJ(list);
+	for (int i = 0; i < 2; i++) {
+		// GC protection, the list might grow
+		vm_stack_push(vm, TO_OBJ(new_handle(vm, fds[i], false)));
+		value_array_write(vm, &list->values, vm_stack_peek(vm, 0));
+		vm_stack_pop(vm);
+	}
+	return true;
+}
+
+bool event_read(VM * vm, Value value, Value * result) {
+	Obj_Handle * handle = get_handle(vm, value);
+	if (handle == NULL || is_waited_for(vm, handle)) { return false; }
+	int fd = handle->fd;
+
+	// the main fiber might block, e.g. on a prompt it has just printed
+	bool in_fiber = vm->fiber != NULL;
+	if (!in_fiber) { output_flush(&vm->output); }
+	if (is_ready(fd, IO_READ, !in_fiber)) {
+		return read_chunk(vm, fd, result);
+	}
+
+	*result = TO_NIL();
+	return wait_start(vm, (Io_Wait){.fd = fd, .kind = IO_READ, .handle = handle});
+}
+
+bool event_write(VM * vm, Value value, Value data, Value * result) {
+	Obj_Handle * handle = get_handle(vm, value);
+	if (handle == NULL) { return false; }
+	if (!IS_STRING(data)) {
+		runtime_error(vm, "expected a string");
+		return false;
+	}
+	if (is_waited_for(vm, handle)) { return false; }
+	int fd = handle->fd;
+
+	// keep the order with `print`
+	if (fd == STDOUT_FILENO || fd == STDERR_FILENO) { output_flush(&vm->output); }
+
+	Obj_String * string = AS_STRING(data);
+	uint32_t written = 0;
+	for (;;) {
+		if (!write_chunk(vm, fd, string, &written)) { return false; }
+		if (written == string->length) {
+			*result = TO_INT((int32_t)written);
+			return true;
+		}
+		if (vm->fiber != NULL) { break; }
+		output_flush(&vm->output);
+		is_ready(fd, IO_WRITE, true);
+	}
+
+	*result = TO_NIL();
+	return wait_start(vm, (Io_Wait){.fd = fd, .kind = IO_WRITE, .handle = handle, .data = string, .written = written});
+}
+
+uint32_t event_pending(VM * vm) {
+	return vm->events != NULL ? vm->events->count : 0;
+}
+
+bool event_wait(VM * vm, Value * result) {
+	Event_Loop * loop = vm->events;
+	if (event_pending(vm) == 0) {
+		runtime_error(vm, "no I/O is pending");
+		return false;
+	}
+
+	output_flush(&vm->output);
+	for (;;) {
+		Io_Wait * wait = loop_next(loop);
+		if (wait == NULL) { return io_error(vm, "wait for I/O"); }
+
+		Value value = TO_NIL();
+		if (wait->kind == IO_READ) {
+			// the result slot roots the string, the fiber is still in the loop
+			if (!read_chunk(vm, wait->fd, result)) { return false; }
+			value = *result;
+		}
+		else {
+			if (!write_chunk(vm, wait->fd, wait->data, &wait->written)) { return false; }
+			if (wait->written < wait->data->length) { continue; }
+			value = TO_INT((int32_t)wait->written);
+		}
+
+		Obj_Fiber * fiber = wait->fiber;
+		wait_finish(loop, wait);
+		fiber->state = FIBER_SUSPENDED;
+		return vm_fiber_resume(vm, TO_OBJ(fiber), value, result);
+	}
+}
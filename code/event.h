@@ -0,0 +1,32 @@
+#if !defined(LOX_EVENT)
+#define LOX_EVENT
+
+#include "value.h"
+
+// handles are objects around a file descriptor: `open` and `pipe` make them
+// and they are closed when collected; `stdin`, `stdout` and `stderr` never are;
+// inside a fiber, `read` and `write` suspend it until the descriptor is ready
+// and `io_wait` resumes it; the main fiber blocks instead
+// - Linux waits with epoll, other POSIX systems with poll
+// - Windows has no common wait for pipes, so `io_wait` checks them in turns;
+//   only reads from a pipe suspend there, other reads and writes block
+
+struct VM;
+struct Event_Loop;
+struct Obj_Handle;
+
+void event_loop_free(struct Event_Loop * loop);
+void gc_mark_event_loop_grey(struct VM * vm);
+void event_handle_free(struct Obj_Handle * handle);
+
+bool event_open(struct VM * vm, Value path, Value mode, Value * result);
+bool event_delete(struct VM * vm, Value path);
+bool event_standard(struct VM * vm, int fd, Value * result);
+bool event_close(struct VM * vm, Value handle);
+bool event_pipe(struct VM * vm, Value * result);
+bool event_read(struct VM * vm, Value handle, Value * result);
+bool event_write(struct VM * vm, Value handle, Value data, Value * result);
+uint32_t event_pending(struct VM * vm);
+bool event_wait(struct VM * vm, Value * result);
+
+#endif
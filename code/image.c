@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+#include "bytecode.h"
+#include "image.h"
+
+// differs from `BYTECODE_MAGIC` in the last byte
+static uint8_t const IMAGE_MAGIC[4] = {0x1b, 'L', 'o', 'i'};
+
+#define IMAGE_NONE UINT32_MAX
+
+typedef enum {
+	IMAGE_NIL,
+	IMAGE_FALSE,
+	IMAGE_TRUE,
+	IMAGE_INT,
+	IMAGE_NUMBER,
+	IMAGE_OBJECT,
+} Image_Tag;
+
+typedef struct VM VM;
+typedef struct Obj Obj;
+typedef struct Obj_String Obj_String;
+typedef struct Obj_Native Obj_Native;
+typedef struct Obj_Function Obj_Function;
+typedef struct Obj_Closure Obj_Closure;
+typedef struct Obj_Upvalue Obj_Upvalue;
+typedef struct Obj_Class Obj_Class;
+typedef struct Obj_Instance Obj_Instance;
+typedef struct Obj_Bound_Method Obj_Bound_Method;
+typedef struct Obj_List Obj_List;
+typedef struct Obj_Map Obj_Map;
+typedef struct Obj_Float_Array Obj_Float_Array;
+typedef struct Chunk Chunk;
+
+// -- writing
+typedef struct {
+	VM * vm;
+	Value_Table indices; // of the objects found so far
+	Obj ** objects; // in the order of the records
+	uint32_t count, capacity;
+} Image_Writer;
+
+static uint32_t object_index(Image_Writer * image, Obj * object) {
+	if (object == NULL) { return IMAGE_NONE; }
+
+	Value index;
+	if (value_table_get(&image->indices, TO_OBJ(object), &index)) { return (uint32_t)AS_INT(index); }
+
+	// the loader allocates objects in order, these must exist by then
+	switch (object->type) {
+		case OBJ_FUNCTION: object_index(image, (Obj *)((Obj_Function *)object)->name); break;
+		case OBJ_CLOSURE: object_index(image, (Obj *)((Obj_Closure *)object)->function); break;
+		case OBJ_CLASS: object_index(image, (Obj *)((Obj_Class *)object)->name); break;
+		case OBJ_INSTANCE: object_index(image, (Obj *)((Obj_Instance *)object)->lox_class); break;
+		case OBJ_BOUND_METHOD: object_index(image, (Obj *)((Obj_Bound_Method *)object)->method); break;
+		default: break;
+	}
+
+	if (image->count == image->capacity) {
+		image->capacity = GROW_CAPACITY(image->capacity);
+		image->objects = realloc(image->objects, sizeof(Obj *) * image->capacity);
+		if (image->objects == NULL) { exit(1); }
+	}
+	uint32_t result = image->count++;
+	image->objects[result] = object;
+	value_table_set(image->vm, &image->indices, TO_OBJ(object), TO_INT((int32_t)result));
+	return result;
+}
+
+static void write_value(Image_Writer * image, Bytecode_Writer * writer, Value value) {
+	if (IS_NIL(value)) {
+		bytecode_write_u8(writer, IMAGE_NIL);
+	}
+	else if (IS_BOOL(value)) {
+		bytecode_write_u8(writer, AS_BOOL(value) ? IMAGE_TRUE : IMAGE_FALSE);
+	}
+	else if (IS_INT(value)) {
+		bytecode_write_u8(writer, IMAGE_INT);
+		bytecode_write_u32(writer, (uint32_t)AS_INT(value));
+	}
+	else if (IS_OBJ(value)) {
+		bytecode_write_u8(writer, IMAGE_OBJECT);
+		bytecode_write_u32(writer, object_index(image, AS_OBJ(value)));
+	}
+	else {
+		double number = AS_NUMBER(value);
+		uint64_t bits;
+		memcpy(&bits, &number, sizeof(bits));
+		bytecode_write_u8(writer, IMAGE_NUMBER);
+		bytecode_write_u64(writer, bits);
+	}
+}
+
+static void write_table(Image_Writer * image, Bytecode_Writer * writer, Table * table) {
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < table->capacity; i++) {
+		if (table->entries[i].key != NULL) { count++; }
+	}
+
+	bytecode_write_u32(writer, count);
+	for (uint32_t i = 0; i < table->capacity; i++) {
+		Entry * entry = &table->entries[i];
+		if (entry->key == NULL) { continue; }
+		bytecode_write_u32(writer, object_index(image, (Obj *)entry->key));
+		write_value(image, writer, entry->value);
+	}
+}
+
+static bool write_object(Image_Writer * image, Bytecode_Writer * writer, Obj * object) {
+	bytecode_write_u8(writer, (uint8_t)object->type);
+	switch (object->type) {
+		case OBJ_STRING: {
+			Obj_String * string = (Obj_String *)object;
+			bytecode_write_u32(writer, string->length);
+			bytecode_write_bytes(writer, string->chars, string->length);
+			return true;
+		}
+
+		case OBJ_NATIVE: {
+			uint32_t index = 0;
+			while (image->vm->natives[index] != (Obj_Native *)object) { index++; }
+			bytecode_write_u32(writer, index);
+			return true;
+		}
+
+		case OBJ_FUNCTION: {
+			Obj_Function * function = (Obj_Function *)object;
+			if (function->lazy != NULL) {
+				fprintf(stderr, "can't save '%s' before its first call\n", function->name->chars);
+				return false;
+			}
+			bytecode_write_u32(writer, object_index(image, (Obj *)function->name));
+			bytecode_write_u8(writer, function->arity);
+			bytecode_write_u8(writer, function->is_generator);
+			bytecode_write_u32(writer, function->upvalue_count);
+			bytecode_write_u32(writer, function->stack_max);
+
+			Chunk * chunk = &function->chunk;
+			bytecode_write_code(writer, chunk);
+
+			bytecode_write_u32(writer, chunk->constants.count);
+			for (uint32_t i = 0; i < chunk->constants.count; i++) {
+				write_value(image, writer, chunk->constants.values[i]);
+			}
+			return true;
+		}
+
+		case OBJ_CLOSURE: {
+			Obj_Closure * closure = (Obj_Closure *)object;
+			bytecode_write_u32(writer, object_index(image, (Obj *)closure->function));
+			bytecode_write_u32(writer, closure->upvalue_count);
+			for (uint32_t i = 0; i < closure->upvalue_count; i++) {
+				bytecode_write_u32(writer, object_index(image, (Obj *)closure->upvalues[i]));
+			}
+			return true;
+		}
+
+		case OBJ_UPVALUE: {
+			// only a suspended fiber keeps one open once the script is done
+			Obj_Upvalue * upvalue = (Obj_Upvalue *)object;
+			if (upvalue->location != &upvalue->closed) {
+				fprintf(stderr, "can't save a variable captured from a running function\n");
+				return false;
+			}
+			write_value(image, writer, upvalue->closed);
+			return true;
+		}
+
+		case OBJ_CLASS: {
+			Obj_Class * lox_class = (Obj_Class *)object;
+			bytecode_write_u32(writer, object_index(image, (Obj *)lox_class->name));
+			write_table(image, writer, &lox_class->methods);
+			return true;
+		}
+
+		case OBJ_INSTANCE: {
+			Obj_Instance * instance = (Obj_Instance *)object;
+			bytecode_write_u32(writer, object_index(image, (Obj *)instance->lox_class));
+			write_table(image, writer, &instance->table);
+			return true;
+		}
+
+		case OBJ_BOUND_METHOD: {
+			Obj_Bound_Method * bound = (Obj_Bound_Method *)object;
+			bytecode_write_u32(writer, object_index(image, (Obj *)bound->method));
+			write_value(image, writer, bound->receiver);
+			return true;
+		}
+
+		case OBJ_LIST: {
+			Obj_List * list = (Obj_List *)object;
+			bytecode_write_u32(writer, list->values.count);
+			for (uint32_t i = 0; i < list->values.count; i++) {
+				write_value(image, writer, list->values.values[i]);
+			}
+			return true;
+		}
+
+		case OBJ_MAP: {
+			Value_Table * table = &((Obj_Map *)object)->table;
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < table->capacity; i++) {
+				if (!IS_NIL(table->entries[i].key)) { count++; }
+			}
+
+			bytecode_write_u32(writer, count);
+			for (uint32_t i = 0; i < table->capacity; i++) {
+				Value_Entry * entry = &table->entries[i];
+				if (IS_NIL(entry->key)) { continue; }
+				write_value(image, writer, entry->key);
+				write_value(image, writer, entry->value);
+			}
+			return true;
+		}
+
+		case OBJ_FLOAT_ARRAY: {
+			Obj_Float_Array * array = (Obj_Float_Array *)object;
+			bytecode_write_u32(writer, array->count);
+			for (uint32_t i = 0; i < array->count; i++) {
+				uint64_t bits;
+				memcpy(&bits, &array->values[i], sizeof(bits));
+				bytecode_write_u64(writer, bits);
+			}
+			return true;
+		}
+
+		case OBJ_FIBER:
+			fprintf(stderr, "can't save a fiber\n");
+			return false;
+
+		case OBJ_CHANNEL:
+			fprintf(stderr, "can't save a channel\n");
+			return false;
+
+		case OBJ_HANDLE:
+			fprintf(stderr, "can't save a handle\n");
+			return false;
+	}
+	return false;
+}
+
+uint8_t * image_write(VM * vm, size_t * length) {
+	Bytecode_Writer writer = {.bytes = NULL, .count = 0, .capacity = 0};
+	bytecode_write_bytes(&writer, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	bytecode_write_u32(&writer, IMAGE_VERSION);
+	bytecode_write_u32(&writer, BYTECODE_VERSION);
+
+	// the code is bound against these, see `bytecode_write`
+	bytecode_write_u32(&writer, vm->native_count);
+	for (uint32_t i = 0; i < vm->native_count; i++) {
+		Obj_Native * native = vm->natives[i];
+		bytecode_write_u32(&writer, native->name->length);
+		bytecode_write_bytes(&writer, native->name->chars, native->name->length);
+		bytecode_write_u8(&writer, native->is_shadowed);
+	}
+
+	// the globals are the roots, the objects they reach are found on the way
+	Image_Writer image = {.vm = vm, .objects = NULL, .count = 0, .capacity = 0};
+	value_table_init(&image.indices);
+
+	Bytecode_Writer globals = {.bytes = NULL, .count = 0, .capacity = 0};
+	write_table(&image, &globals, &vm->globals);
+
+	Bytecode_Writer records = {.bytes = NULL, .count = 0, .capacity = 0};
+	bool is_ok = true;
+	for (uint32_t i = 0; i < image.count && is_ok; i++) {
+		is_ok = write_object(&image, &records, image.objects[i]);
+	}
+
+	bytecode_write_u32(&writer, image.count);
+	bytecode_write_bytes(&writer, records.bytes, records.count);
+	bytecode_write_bytes(&writer, globals.bytes, globals.count);
+
+	free(records.bytes);
+	free(globals.bytes);
+	free(image.objects);
+	value_table_free(vm, &image.indices);
+
+	if (!is_ok) {
+		free(writer.bytes);
+		return NULL;
+	}
+	*length = writer.count;
+	return writer.bytes;
+}
+
+// -- reading
+typedef struct {
+	VM * vm;
+	Bytecode_Reader reader;
+	Obj_List * objects; // a slot per record, rooted on the stack
+	uint32_t index; // of the current record
+	bool is_linking;
+} Image_Reader;
+
+// NULL for `IMAGE_NONE` and for objects that are not allocated yet;
+// dependencies precede the current record, see `object_index`
+static Obj * read_reference(Image_Reader * image, Obj_Type type, bool is_dependency) {
+	uint32_t index = bytecode_read_u32(&image->reader);
+	if (index == IMAGE_NONE) { return NULL; }
+
+	uint32_t limit = is_dependency ? image->index : image->objects->values.count;
+	if (index >= limit) {
+		image->reader.had_error = true;
+		return NULL;
+	}
+
+	Value slot = image->objects->values.values[index];
+	if (!IS_OBJ(slot)) { return NULL; }
+	if (AS_OBJ(slot)->type != type) {
+		image->reader.had_error = true;
+		return NULL;
+	}
+	return AS_OBJ(slot);
+}
+
+// objects are `nil` until allocated
+static Value read_value(Image_Reader * image) {
+	Bytecode_Reader * reader = &image->reader;
+	switch (bytecode_read_u8(reader)) {
+		case IMAGE_NIL: return TO_NIL();
+		case IMAGE_FALSE: return TO_BOOL(false);
+		case IMAGE_TRUE: return TO_BOOL(true);
+		case IMAGE_INT: return TO_INT((int32_t)bytecode_read_u32(reader));
+		case IMAGE_NUMBER: {
+			uint64_t bits = bytecode_read_u64(reader);
+			double number;
+			memcpy(&number, &bits, sizeof(number));
+			return TO_NUMBER(number);
+		}
+		case IMAGE_OBJECT: {
+			uint32_t index = bytecode_read_u32(reader);
+			if (index < image->objects->values.count) { return image->objects->values.values[index]; }
+			break;
+		}
+		default: break;
+	}
+	reader->had_error = true;
+	return TO_NIL();
+}
+
+static bool read_table(Image_Reader * image, Table * table) {
+	uint32_t count = bytecode_read_u32(&image->reader);
+	for (uint32_t i = 0; i < count && !image->reader.had_error; i++) {
+		Obj_String * key = (Obj_String *)read_reference(image, OBJ_STRING, false);
+		Value value = read_value(image);
+		if (!image->is_linking) { continue; }
+		if (key == NULL) { return false; }
+		table_set(image->vm, table, key, value);
+	}
+	return !image->reader.had_error;
+}
+
+static void set_object(Image_Reader * image, Obj * object) {
+	image->objects->values.values[image->index] = TO_OBJ(object);
+}
+
+// the first pass allocates the objects, the second one links them
+static bool read_object(Image_Reader * image) {
+	VM * vm = image->vm;
+	Bytecode_Reader * reader = &image->reader;
+	bool is_linking = image->is_linking;
+	Obj * object = is_linking ? AS_OBJ(image->objects->values.values[image->index]) : NULL;
+
+	uint8_t type = bytecode_read_u8(reader);
+	if (is_linking && object->type != type) { return false; }
+
+	switch (type) {
+		case OBJ_STRING: {
+			uint32_t length = bytecode_read_u32(reader);
+			char const * chars = (char const *)bytecode_read_bytes(reader, length);
+			if (chars == NULL) { return false; }
+			if (!is_linking) { set_object(image, (Obj *)copy_string(vm, chars, length)); }
+			return true;
+		}
+
+		case OBJ_NATIVE: {
+			uint32_t index = bytecode_read_u32(reader);
+			if (index >= vm->native_count) { return false; }
+			if (!is_linking) { set_object(image, (Obj *)vm->natives[index]); }
+			return true;
+		}
+
+		case OBJ_FUNCTION: {
+			Obj_String * name = (Obj_String *)read_reference(image, OBJ_STRING, true);
+			uint8_t arity = bytecode_read_u8(reader);
+			bool is_generator = bytecode_read_u8(reader) != 0;
+			uint32_t upvalue_count = bytecode_read_u32(reader);
+			uint32_t stack_max = bytecode_read_u32(reader);
+
+			Obj_Function * function = NULL;
+			if (!is_linking) {
+				function = new_function(vm);
+				set_object(image, (Obj *)function);
+				function->name = name;
+				function->arity = arity;
+				function->is_generator = is_generator;
+				function->upvalue_count = upvalue_count;
+				function->stack_max = stack_max;
+			}
+			if (!bytecode_read_code(vm, reader, function != NULL ? &function->chunk : NULL)) { return false; }
+
+			uint32_t constant_count = bytecode_read_u32(reader);
+			for (uint32_t i = 0; i < constant_count && !reader->had_error; i++) {
+				Value constant = read_value(image);
+				if (is_linking) { chunk_add_constant(vm, &((Obj_Function *)object)->chunk, constant); }
+			}
+			return !reader->had_error;
+		}
+
+		case OBJ_CLOSURE: {
+			Obj_Function * function = (Obj_Function *)read_reference(image, OBJ_FUNCTION, true);
+			uint32_t count = bytecode_read_u32(reader);
+			if (function == NULL || count != function->upvalue_count) { return false; }
+			if (!is_linking) { set_object(image, (Obj *)new_closure(vm, function)); }
+
+			for (uint32_t i = 0; i < count && !reader->had_error; i++) {
+				Obj_Upvalue * upvalue = (Obj_Upvalue *)read_reference(image, OBJ_UPVALUE, false);
+				if (!is_linking) { continue; }
+				if (upvalue == NULL) { return false; }
+				((Obj_Closure *)object)->upvalues[i] = upvalue;
+			}
+			return !reader->had_error;
+		}
+
+		case OBJ_UPVALUE: {
+			Value closed = read_value(image);
+			if (!is_linking) {
+				Obj_Upvalue * upvalue = new_upvalue(vm, NULL);
+				upvalue->location = &upvalue->closed;
+				set_object(image, (Obj *)upvalue);
+			}
+			else {
+				((Obj_Upvalue *)object)->closed = closed;
+			}
+			return !reader->had_error;
+		}
+
+		case OBJ_CLASS: {
+			Obj_String * name = (Obj_String *)read_reference(image, OBJ_STRING, true);
+			if (name == NULL) { return false; }
+			if (!is_linking) {
+				object = (Obj *)new_class(vm, name);
+				set_object(image, object);
+			}
+			return read_table(image, &((Obj_Class *)object)->methods);
+		}
+
+		case OBJ_INSTANCE: {
+			Obj_Class * lox_class = (Obj_Class *)read_reference(image, OBJ_CLASS, true);
+			if (lox_class == NULL) { return false; }
+			if (!is_linking) {
+				object = (Obj *)new_instance(vm, lox_class);
+				set_object(image, object);
+			}
+			return read_table(image, &((Obj_Instance *)object)->table);
+		}
+
+		case OBJ_BOUND_METHOD: {
+			Obj_Function * method = (Obj_Function *)read_reference(image, OBJ_FUNCTION, true);
+			Value receiver = read_value(image);
+			if (method == NULL) { return false; }
+			if (!is_linking) { set_object(image, (Obj *)new_bound_method(vm, TO_NIL(), method)); }
+			else { ((Obj_Bound_Method *)object)->receiver = receiver; }
+			return !reader->had_error;
+		}
+
+		case OBJ_LIST: {
+			if (!is_linking) { set_object(image, (Obj *)new_list(vm)); }
+			uint32_t count = bytecode_read_u32(reader);
+			for (uint32_t i = 0; i < count && !reader->had_error; i++) {
+				Value value = read_value(image);
+				if (is_linking) { value_array_write(vm, &((Obj_List *)object)->values, value); }
+			}
+			return !reader->had_error;
+		}
+
+		case OBJ_MAP: {
+			if (!is_linking) { set_object(image, (Obj *)new_map(vm)); }
+			uint32_t count = bytecode_read_u32(reader);
+			for (uint32_t i = 0; i < count && !reader->had_error; i++) {
+				Value key = read_value(image);
+				Value value = read_value(image);
+				if (!is_linking) { continue; }
+				if (IS_NIL(key)) { return false; }
+				value_table_set(vm, &((Obj_Map *)object)->table, key, value);
+			}
+			return !reader->had_error;
+		}
+
+		case OBJ_FLOAT_ARRAY: {
+			uint32_t count = bytecode_read_u32(reader);
+			uint8_t const * values = bytecode_read_bytes(reader, (size_t)count * 8);
+			if (values == NULL) { return false; }
+			if (!is_linking) {
+				Obj_Float_Array * array = new_float_array(vm, count);
+				set_object(image, (Obj *)array);
+				Bytecode_Reader value_reader = {.bytes = values, .end = values + (size_t)count * 8};
+				for (uint32_t i = 0; i < count; i++) {
+					uint64_t bits = bytecode_read_u64(&value_reader);
+					memcpy(&array->values[i], &bits, sizeof(bits));
+				}
+			}
+			return true;
+		}
+
+		default:
+			return false;
+	}
+}
+
+static bool read_globals(Image_Reader * image) {
+	Table * globals = &image->vm->globals;
+	uint32_t count = bytecode_read_u32(&image->reader);
+	for (uint32_t i = 0; i < count && !image->reader.had_error; i++) {
+		Obj_String * name = (Obj_String *)read_reference(image, OBJ_STRING, false);
+		Value value = read_value(image);
+		if (name == NULL) { return false; }
+		if (image->is_linking) { table_set(image->vm, globals, name, value); }
+	}
+	return !image->reader.had_error && image->reader.bytes == image->reader.end;
+}
+
+bool image_is(uint8_t const * bytes, size_t length) {
+	return length >= sizeof(IMAGE_MAGIC) && memcmp(bytes, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0;
+}
+
+bool image_read(VM * vm, uint8_t const * bytes, size_t length) {
+	if (!image_is(bytes, length)) { return false; }
+
+	Bytecode_Reader reader = {.bytes = bytes + sizeof(IMAGE_MAGIC), .end = bytes + length};
+	if (bytecode_read_u32(&reader) != IMAGE_VERSION) { return false; }
+	if (bytecode_read_u32(&reader) != BYTECODE_VERSION) { return false; }
+
+	// the natives must be the same, up to the ones the image was made with
+	bool is_shadowed[UINT8_MAX + 1];
+	uint32_t native_count = bytecode_read_u32(&reader);
+	if (native_count > vm->native_count) { return false; }
+	for (uint32_t i = 0; i < native_count; i++) {
+		uint32_t name_length = bytecode_read_u32(&reader);
+		char const * name = (char const *)bytecode_read_bytes(&reader, name_length);
+		is_shadowed[i] = bytecode_read_u8(&reader) != 0;
+		if (name == NULL) { return false; }
+
+		Obj_String * native_name = vm->natives[i]->name;
+		if (native_name->length != name_length || memcmp(native_name->chars, name, name_length) != 0) { return false; }
+	}
+
+	// every record takes a byte at least
+	uint32_t count = bytecode_read_u32(&reader);
+	if (reader.had_error || count > (size_t)(reader.end - reader.bytes)) { return false; }
+
+	Value * stack_top = vm->stack_top;
+	Obj_List * objects = new_list(vm);
+	vm_stack_push(vm, TO_OBJ(objects));
+	Value_Array * slots = &objects->values;
+	slots->values = GROW_ARRAY(vm, slots->values, 0, count);
+	slots->capacity = count;
+	for (uint32_t i = 0; i < count; i++) {
+		slots->values[i] = TO_NIL();
+	}
+	slots->count = count;
+
+	// references may point forward, hence the two passes over the records;
+	// the globals are validated before any is set
+	Image_Reader image = {.vm = vm, .reader = reader, .objects = objects, .is_linking = false};
+	bool is_ok = true;
+	for (int pass = 0; pass < 2 && is_ok; pass++) {
+		image.reader = reader;
+		image.is_linking = pass == 1;
+		for (image.index = 0; image.index < count && is_ok; image.index++) {
+			is_ok = read_object(&image);
+		}
+		is_ok = is_ok && read_globals(&image);
+	}
+
+	if (is_ok) {
+		for (uint32_t i = 0; i < native_count; i++) {
+			vm->natives[i]->is_shadowed = is_shadowed[i];
+		}
+	}
+	vm->stack_top = stack_top;
+	return is_ok;
+}
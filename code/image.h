@@ -0,0 +1,28 @@
+#if !defined(LOX_IMAGE)
+#define LOX_IMAGE
+
+#include "common.h"
+
+// a heap image: the globals of an initialized VM and every object they reach,
+// loaded into a fresh VM instead of running the script that built them;
+// objects refer to each other by their index in the image; loading decodes
+// it into fresh heap objects in two passes, the first allocates them and
+// the second links them, so nothing points into the image afterwards;
+// fibers and channels can't be saved, natives are saved by their index
+
+// bump when the encoding changes, the code inside follows `BYTECODE_VERSION`
+#define IMAGE_VERSION 2
+
+struct VM;
+
+// `*length` receives the size, the caller frees the result;
+// NULL when the heap holds something that can't be saved
+uint8_t * image_write(struct VM * vm, size_t * length);
+
+bool image_is(uint8_t const * bytes, size_t length);
+
+// false when the bytes are malformed or belong to another interpreter,
+// the VM is left untouched then; the code itself is trusted
+bool image_read(struct VM * vm, uint8_t const * bytes, size_t length);
+
+#endif
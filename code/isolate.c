@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+#include "isolate.h"
+
+typedef struct VM VM;
+typedef struct Isolate_Pool Isolate_Pool;
+
+static void worker_run(Isolate_Pool * pool);
+
+// -- platform
+#if defined(_WIN32)
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+static void mutex_init(Mutex * mutex) { InitializeCriticalSection(mutex); }
+static void mutex_free(Mutex * mutex) { DeleteCriticalSection(mutex); }
+static void mutex_lock(Mutex * mutex) { EnterCriticalSection(mutex); }
+static void mutex_unlock(Mutex * mutex) { LeaveCriticalSection(mutex); }
+
+static void condition_init(Condition * condition) { InitializeConditionVariable(condition); }
+static void condition_free(Condition * condition) { (void)condition; }
+static void condition_wait(Condition * condition, Mutex * mutex) { SleepConditionVariableCS(condition, mutex, INFINITE); }
+static void condition_signal(Condition * condition) { WakeConditionVariable(condition); }
+static void condition_broadcast(Condition * condition) { WakeAllConditionVariable(condition); }
+
+static DWORD WINAPI thread_main(void * data) {
+	worker_run((Isolate_Pool *)data);
+	return 0;
+}
+
+static bool thread_start(Thread * thread, Isolate_Pool * pool) {
+	*thread = CreateThread(NULL, 0, thread_main, pool, 0, NULL);
+	return *thread != NULL;
+}
+
+static void thread_join(Thread thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static uint32_t processor_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (uint32_t)info.dwNumberOfProcessors;
+}
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+static void mutex_init(Mutex * mutex) { pthread_mutex_init(mutex, NULL); }
+static void mutex_free(Mutex * mutex) { pthread_mutex_destroy(mutex); }
+static void mutex_lock(Mutex * mutex) { pthread_mutex_lock(mutex); }
+static void mutex_unlock(Mutex * mutex) { pthread_mutex_unlock(mutex); }
+
+static void condition_init(Condition * condition) { pthread_cond_init(condition, NULL); }
+static void condition_free(Condition * condition) { pthread_cond_destroy(condition); }
+static void condition_wait(Condition * condition, Mutex * mutex) { pthread_cond_wait(condition, mutex); }
+static void condition_signal(Condition * condition) { pthread_cond_signal(condition); }
+static void condition_broadcast(Condition * condition) { pthread_cond_broadcast(condition); }
+
+static void * thread_main(void * data) {
+	worker_run((Isolate_Pool *)data);
+	return NULL;
+}
+
+static bool thread_start(Thread * thread, Isolate_Pool * pool) {
+	return pthread_create(thread, NULL, thread_main, pool) == 0;
+}
+
+static void thread_join(Thread thread) {
+	pthread_join(thread, NULL);
+}
+
+static uint32_t processor_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+}
+#endif
+
+// -- messages
+// a serialized value, owned by no VM
+
+typedef enum {
+	MESSAGE_VALUE,
+	MESSAGE_STRING,
+	MESSAGE_LIST,
+	MESSAGE_MAP,
+	MESSAGE_FLOAT_ARRAY,
+	MESSAGE_CHANNEL, // shared by the isolates, so sent as they are
+} Message_Tag;
+
+// also stops at cycles
+#define MESSAGE_DEPTH_MAX 64
+
+typedef struct Channel Channel;
+
+typedef struct Message {
+	struct Message * next;
+	uint8_t * bytes;
+	uint32_t count, capacity;
+	uint32_t object_count;
+	Channel ** channels; // referenced once queued, see `message_retain`
+	uint32_t channel_count, channel_capacity;
+} Message;
+
+static void message_free(Message * message) {
+	free(message->channels);
+	free(message->bytes);
+	free(message);
+}
+
+static void message_write(Message * message, void const * bytes, uint32_t count) {
+	if (message->capacity - message->count < count) {
+		uint32_t capacity = GROW_CAPACITY(message->capacity);
+		while (capacity - message->count < count) { capacity *= GROWTH_FACTOR; }
+		uint8_t * new_bytes = realloc(message->bytes, capacity);
+		if (new_bytes == NULL) { exit(1); }
+		message->bytes = new_bytes;
+		message->capacity = capacity;
+	}
+	memcpy(message->bytes + message->count, bytes, count);
+	message->count += count;
+}
+
+static void message_write_tag(Message * message, Message_Tag tag, uint32_t count) {
+	uint8_t byte = (uint8_t)tag;
+	message_write(message, &byte, sizeof(byte));
+	message_write(message, &count, sizeof(count));
+	message->object_count++;
+}
+
+typedef struct Obj_String Obj_String;
+typedef struct Obj_List Obj_List;
+typedef struct Obj_Map Obj_Map;
+typedef struct Obj_Float_Array Obj_Float_Array;
+
+static bool message_write_value(VM * vm, Message * message, Value value, uint32_t depth) {
+	if (depth == MESSAGE_DEPTH_MAX) {
+		runtime_error(vm, "can't send values nested deeper than %d", MESSAGE_DEPTH_MAX);
+		return false;
+	}
+
+	if (!IS_OBJ(value)) {
+		uint8_t byte = MESSAGE_VALUE;
+		message_write(message, &byte, sizeof(byte));
+		message_write(message, &value, sizeof(value));
+		return true;
+	}
+
+	switch (OBJ_TYPE(value)) {
+		case OBJ_STRING: {
+			Obj_String * string = AS_STRING(value);
+			message_write_tag(message, MESSAGE_STRING, string->length);
+			message_write(message, string->chars, string->length);
+			return true;
+		}
+		case OBJ_LIST: {
+			Obj_List * list = AS_LIST(value);
+			message_write_tag(message, MESSAGE_LIST, list->values.count);
+			for (uint32_t i = 0; i < list->values.count; i++) {
+				if (!message_write_value(vm, message, list->values.values[i], depth + 1)) { return false; }
+			}
+			return true;
+		}
+		case OBJ_MAP: {
+			Value_Table * table = &AS_MAP(value)->table;
+			message_write_tag(message, MESSAGE_MAP, table->count);
+			for (uint32_t i = 0; i < table->capacity; i++) {
+				Value_Entry * entry = &table->entries[i];
+				if (IS_NIL(entry->key)) { continue; }
+				if (!message_write_value(vm, message, entry->key, depth + 1)) { return false; }
+				if (!message_write_value(vm, message, entry->value, depth + 1)) { return false; }
+			}
+			return true;
+		}
+		case OBJ_FLOAT_ARRAY: {
+			Obj_Float_Array * array = AS_FLOAT_ARRAY(value);
+			message_write_tag(message, MESSAGE_FLOAT_ARRAY, array->count);
+			message_write(message, array->values, (uint32_t)sizeof(*array->values) * array->count);
+			return true;
+		}
+		case OBJ_CHANNEL: {
+			Channel * channel = AS_CHANNEL(value)->channel;
+			message_write_tag(message, MESSAGE_CHANNEL, 0);
+			message_write(message, &channel, sizeof(channel));
+			if (message->channel_count == message->channel_capacity) {
+				message->channel_capacity = GROW_CAPACITY(message->channel_capacity);
+				Channel ** channels = realloc(message->channels, sizeof(*message->channels) * message->channel_capacity);
+				if (channels == NULL) { exit(1); }
+				message->channels = channels;
+			}
+			message->channels[message->channel_count++] = channel;
+			return true;
+		}
+		default: break;
+	}
+
+	runtime_error(vm, "can only send nil, booleans, numbers, strings, lists, maps, float arrays and channels");
+	return false;
+}
+
+static Message * message_new(void) {
+	Message * message = calloc(1, sizeof(Message));
+	if (message == NULL) { exit(1); }
+	return message;
+}
+
+typedef struct {
+	uint8_t const * bytes;
+	Obj_List * roots;
+	uint32_t root_count;
+} Message_Reader;
+
+static uint32_t message_read_count(Message_Reader * reader) {
+	uint32_t count;
+	memcpy(&count, reader->bytes, sizeof(count));
+	reader->bytes += sizeof(count);
+	return count;
+}
+
+static void message_root(Message_Reader * reader, Value value) {
+	reader->roots->values.values[reader->root_count++] = value;
+}
+
+static Value message_read_value(VM * vm, Message_Reader * reader) {
+	Message_Tag tag = (Message_Tag)*(reader->bytes++);
+	if (tag == MESSAGE_VALUE) {
+		Value value;
+		memcpy(&value, reader->bytes, sizeof(value));
+		reader->bytes += sizeof(value);
+		return value;
+	}
+
+	// every object is rooted right after its allocation
+	uint32_t count = message_read_count(reader);
+	switch (tag) {
+		case MESSAGE_STRING: {
+			Value string = TO_OBJ(copy_string(vm, (char const *)reader->bytes, count));
+			message_root(reader, string);
+			reader->bytes += count;
+			return string;
+		}
+		case MESSAGE_LIST: {
+			Obj_List * list = new_list(vm);
+			message_root(reader, TO_OBJ(list));
+			for (uint32_t i = 0; i < count; i++) {
+				value_array_write(vm, &list->values, message_read_value(vm, reader));
+			}
+			return TO_OBJ(list);
+		}
+		case MESSAGE_MAP: {
+			Obj_Map * map = new_map(vm);
+			message_root(reader, TO_OBJ(map));
+			for (uint32_t i = 0; i < count; i++) {
+				Value key = message_read_value(vm, reader);
+				Value value = message_read_value(vm, reader);
+				value_table_set(vm, &map->table, key, value);
+			}
+			return TO_OBJ(map);
+		}
+		case MESSAGE_FLOAT_ARRAY: {
+			Obj_Float_Array * array = new_float_array(vm, count);
+			message_root(reader, TO_OBJ(array));
+			memcpy(array->values, reader->bytes, sizeof(*array->values) * count);
+			reader->bytes += sizeof(*array->values) * count;
+			return TO_OBJ(array);
+		}
+		case MESSAGE_CHANNEL: {
+			Channel * channel;
+			memcpy(&channel, reader->bytes, sizeof(channel));
+			reader->bytes += sizeof(channel);
+			Value object = TO_OBJ(new_channel(vm, channel));
+			message_root(reader, object);
+			return object;
+		}
+		default: break;
+	}
+	return TO_NIL();
+}
+
+// `slot` should be visible to the GC
+static void message_read(VM * vm, Message const * message, Value * slot) {
+	Obj_List * roots = new_list(vm);
+	*slot = TO_OBJ(roots);
+	for (uint32_t i = 0; i < message->object_count; i++) {
+		value_array_write(vm, &roots->values, TO_NIL());
+	}
+
+	Message_Reader reader = {
+		.bytes = message->bytes,
+		.roots = roots,
+	};
+	*slot = message_read_value(vm, &reader);
+}
+
+// -- channels
+// unbounded queues of messages, listed by the pool and counted by reference;
+// a receive only waits while some isolate can still send, see `pool_deactivate`
+
+struct Channel {
+	Message * first, * last;
+	uint32_t waiting; // receivers without a message
+	uint32_t wakeups; // messages sent to them, each one lets a receiver go
+	uint32_t ref_count; // of channel objects and queued messages
+	uint32_t index; // in the list of the pool
+};
+
+typedef struct Isolate_Job {
+	struct Isolate_Job * next;
+	char * source;
+	uint32_t source_length;
+	Message * arguments;
+} Isolate_Job;
+
+// channels share the mutex of the pool, which counts the running isolates
+struct Isolate_Pool {
+	Isolate_Setup * setup;
+
+	Mutex mutex;
+	Condition has_jobs;
+	Isolate_Job * first_job, * last_job;
+	bool is_stopping;
+
+	// workers are started on demand, more than `worker_limit` while some wait
+	Thread * workers;
+	uint32_t worker_count, worker_capacity, worker_limit, idle_count;
+
+	Condition has_messages;
+	uint32_t active_count; // isolates not waiting for a message, the main one included
+	bool is_deadlocked; // none is left to send, so receives fail
+
+	Channel ** channels;
+	uint32_t channel_count, channel_capacity;
+};
+
+Isolate_Pool * isolate_pool_new(Isolate_Setup * setup) {
+	Isolate_Pool * pool = calloc(1, sizeof(Isolate_Pool));
+	if (pool == NULL) { exit(1); }
+	pool->setup = setup;
+	pool->worker_limit = processor_count();
+	pool->active_count = 1;
+	mutex_init(&pool->mutex);
+	condition_init(&pool->has_jobs);
+	condition_init(&pool->has_messages);
+	return pool;
+}
+
+// expects the pool to be locked; the channels can't be freed before
+static void message_retain(Message * message) {
+	for (uint32_t i = 0; i < message->channel_count; i++) {
+		message->channels[i]->ref_count++;
+	}
+}
+
+static void message_release(Isolate_Pool * pool, Message * message);
+
+// expects the pool to be locked; a channel queued on itself, directly or
+// not, is only freed with the pool
+static void channel_release(Isolate_Pool * pool, Channel * channel) {
+	if (--channel->ref_count > 0) { return; }
+
+	Channel * last = pool->channels[--pool->channel_count];
+	pool->channels[channel->index] = last;
+	last->index = channel->index;
+
+	// no one can receive these any more
+	while (channel->first != NULL) {
+		Message * message = channel->first;
+		channel->first = message->next;
+		message_release(pool, message);
+	}
+	free(channel);
+}
+
+// expects the pool to be locked
+static void message_release(Isolate_Pool * pool, Message * message) {
+	for (uint32_t i = 0; i < message->channel_count; i++) {
+		channel_release(pool, message->channels[i]);
+	}
+	message_free(message);
+}
+
+// once it has been read
+static void message_discard(Isolate_Pool * pool, Message * message) {
+	if (message->channel_count == 0) {
+		message_free(message);
+		return;
+	}
+	mutex_lock(&pool->mutex);
+	message_release(pool, message);
+	mutex_unlock(&pool->mutex);
+}
+
+// expects the pool to be locked
+static void pool_deactivate(Isolate_Pool * pool) {
+	pool->active_count--;
+	if (pool->active_count == 0 && pool->first_job == NULL) {
+		pool->is_deadlocked = true;
+		condition_broadcast(&pool->has_messages);
+	}
+}
+
+// expects the pool to be locked
+static bool worker_start(Isolate_Pool * pool) {
+	if (pool->worker_count == pool->worker_capacity) {
+		pool->worker_capacity = GROW_CAPACITY(pool->worker_capacity);
+		Thread * workers = realloc(pool->workers, sizeof(*pool->workers) * pool->worker_capacity);
+		if (workers == NULL) { exit(1); }
+		pool->workers = workers;
+	}
+	if (!thread_start(&pool->workers[pool->worker_count], pool)) { return false; }
+	pool->worker_count++;
+	return true;
+}
+
+void isolate_pool_free(Isolate_Pool * pool) {
+	mutex_lock(&pool->mutex);
+	pool->is_stopping = true;
+	condition_broadcast(&pool->has_jobs);
+	pool_deactivate(pool);
+	mutex_unlock(&pool->mutex);
+
+	// a waiting worker might still start another one
+	for (uint32_t joined = 0;; joined++) {
+		mutex_lock(&pool->mutex);
+		if (joined == pool->worker_count) {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		Thread worker = pool->workers[joined];
+		mutex_unlock(&pool->mutex);
+		thread_join(worker);
+	}
+
+	// only channels queued on themselves are left, see `channel_release`
+	for (uint32_t i = 0; i < pool->channel_count; i++) {
+		Channel * channel = pool->channels[i];
+		while (channel->first != NULL) {
+			Message * next = channel->first->next;
+			message_free(channel->first);
+			channel->first = next;
+		}
+		free(channel);
+	}
+
+	condition_free(&pool->has_messages);
+	condition_free(&pool->has_jobs);
+	mutex_free(&pool->mutex);
+	free(pool->channels);
+	free(pool->workers);
+	free(pool);
+}
+
+static void worker_execute(Isolate_Pool * pool, Isolate_Job * job) {
+	VM instance;
+	VM * vm = &instance;
+	vm_init(vm);
+	vm->isolates = pool;
+	pool->setup(vm);
+
+	// GC protection
+	vm_stack_push(vm, TO_NIL());
+	message_read(vm, job->arguments, vm->stack_top - 1);
+	vm_stack_push(vm, TO_OBJ(copy_string(vm, "arguments", 9)));
+	table_set(vm, &vm->globals, AS_STRING(vm_stack_peek(vm, 0)), vm_stack_peek(vm, 1));
+	vm_stack_pop(vm);
+	vm_stack_pop(vm);
+
+	vm_interpret(vm, job->source, job->source_length);
+	vm_free(vm);
+}
+
+static void worker_run(Isolate_Pool * pool) {
+	mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->first_job == NULL && !pool->is_stopping) {
+			pool->idle_count++;
+			condition_wait(&pool->has_jobs, &pool->mutex);
+			pool->idle_count--;
+		}
+
+		// drain the queue before stopping
+		Isolate_Job * job = pool->first_job;
+		if (job == NULL) { break; }
+		pool->first_job = job->next;
+		if (pool->first_job == NULL) { pool->last_job = NULL; }
+		pool->active_count++;
+		mutex_unlock(&pool->mutex);
+
+		worker_execute(pool, job);
+		message_discard(pool, job->arguments);
+		free(job->source);
+		free(job);
+
+		mutex_lock(&pool->mutex);
+		pool_deactivate(pool);
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+static Isolate_Pool * get_pool(VM * vm) {
+	if (vm->isolates == NULL) {
+		runtime_error(vm, "isolates are not available");
+	}
+	return vm->isolates;
+}
+
+bool isolate_spawn(VM * vm, Obj_String * source, uint8_t arg_count, Value * args) {
+	Isolate_Pool * pool = get_pool(vm);
+	if (pool == NULL) { return false; }
+
+	Message * arguments = message_new();
+	message_write_tag(arguments, MESSAGE_LIST, arg_count);
+	for (uint8_t i = 0; i < arg_count; i++) {
+		if (!message_write_value(vm, arguments, args[i], 1)) {
+			message_free(arguments);
+			return false;
+		}
+	}
+
+	Isolate_Job * job = malloc(sizeof(Isolate_Job));
+	char * job_source = malloc(source->length + 1);
+	if (job == NULL || job_source == NULL) { exit(1); }
+	memcpy(job_source, source->chars, source->length);
+	*job = (Isolate_Job){
+		.source = job_source,
+		.source_length = source->length,
+		.arguments = arguments,
+	};
+
+	mutex_lock(&pool->mutex);
+	if (pool->last_job != NULL) {
+		pool->last_job->next = job;
+	}
+	else {
+		pool->first_job = job;
+	}
+	pool->last_job = job;
+	message_retain(arguments);
+
+	if (pool->idle_count == 0 && pool->worker_count < pool->worker_limit) {
+		worker_start(pool);
+	}
+	bool has_workers = pool->worker_count > 0;
+	condition_signal(&pool->has_jobs);
+	mutex_unlock(&pool->mutex);
+
+	if (!has_workers) {
+		runtime_error(vm, "can't start an isolate thread");
+		return false;
+	}
+	return true;
+}
+
+bool isolate_channel_new(VM * vm, Value * result) {
+	Isolate_Pool * pool = get_pool(vm);
+	if (pool == NULL) { return false; }
+
+	// the channel object takes the first reference
+	Channel * channel = calloc(1, sizeof(Channel));
+	if (channel == NULL) { exit(1); }
+
+	mutex_lock(&pool->mutex);
+	if (pool->channel_count == pool->channel_capacity) {
+		pool->channel_capacity = GROW_CAPACITY(pool->channel_capacity);
+		Channel ** channels = realloc(pool->channels, sizeof(*pool->channels) * pool->channel_capacity);
+		if (channels == NULL) { exit(1); }
+		pool->channels = channels;
+	}
+	channel->index = pool->channel_count;
+	pool->channels[pool->channel_count++] = channel;
+	mutex_unlock(&pool->mutex);
+
+	*result = TO_OBJ(new_channel(vm, channel));
+	return true;
+}
+
+static Channel * get_channel(VM * vm, Value value) {
+	if (get_pool(vm) == NULL) { return NULL; }
+	if (!IS_CHANNEL(value)) {
+		runtime_error(vm, "expected a channel");
+		return NULL;
+	}
+	return AS_CHANNEL(value)->channel;
+}
+
+bool isolate_channel_send(VM * vm, Value channel_value, Value value) {
+	Channel * channel = get_channel(vm, channel_value);
+	if (channel == NULL) { return false; }
+
+	Message * message = message_new();
+	if (!message_write_value(vm, message, value, 0)) {
+		message_free(message);
+		return false;
+	}
+
+	Isolate_Pool * pool = vm->isolates;
+	mutex_lock(&pool->mutex);
+	message_retain(message);
+	if (channel->last != NULL) {
+		channel->last->next = message;
+	}
+	else {
+		channel->first = message;
+	}
+	channel->last = message;
+
+	// the receiver runs again from now on, as far as `pool_deactivate` is concerned
+	if (channel->waiting > 0) {
+		channel->waiting--;
+		channel->wakeups++;
+		pool->active_count++;
+		condition_broadcast(&pool->has_messages);
+	}
+	mutex_unlock(&pool->mutex);
+	return true;
+}
+
+bool isolate_channel_receive(VM * vm, Value channel_value, Value * result) {
+	Channel * channel = get_channel(vm, channel_value);
+	if (channel == NULL) { return false; }
+
+	Isolate_Pool * pool = vm->isolates;
+	mutex_lock(&pool->mutex);
+	while (channel->first == NULL && !pool->is_deadlocked) {
+		// what the script has printed shows while it waits
+		if (vm->output.count > 0) {
+			mutex_unlock(&pool->mutex);
+			output_flush(&vm->output);
+			mutex_lock(&pool->mutex);
+			continue;
+		}
+
+		channel->waiting++;
+		pool_deactivate(pool);
+
+		// a queued job might be the sender, it can't wait for the busy workers
+		if (pool->first_job != NULL && pool->idle_count == 0 && pool->active_count < pool->worker_limit) {
+			worker_start(pool);
+		}
+		while (channel->wakeups == 0 && !pool->is_deadlocked) {
+			condition_wait(&pool->has_messages, &pool->mutex);
+		}
+
+		// another receiver might have taken the message meanwhile
+		if (channel->wakeups > 0) {
+			channel->wakeups--;
+		}
+		else {
+			channel->waiting--;
+			pool->active_count++;
+		}
+	}
+
+	Message * message = channel->first;
+	if (message != NULL) {
+		channel->first = message->next;
+		if (channel->first == NULL) { channel->last = NULL; }
+	}
+	mutex_unlock(&pool->mutex);
+
+	if (message == NULL) {
+		runtime_error(vm, "no isolate is left to send to the channel");
+		return false;
+	}
+	message_read(vm, message, result);
+	message_discard(pool, message);
+	return true;
+}
+
+void isolate_channel_retain(VM * vm, Channel * channel) {
+	Isolate_Pool * pool = vm->isolates;
+	mutex_lock(&pool->mutex);
+	channel->ref_count++;
+	mutex_unlock(&pool->mutex);
+}
+
+void isolate_channel_release(VM * vm, Channel * channel) {
+	Isolate_Pool * pool = vm->isolates;
+	mutex_lock(&pool->mutex);
+	channel_release(pool, channel);
+	mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,31 @@
+#if !defined(LOX_ISOLATE)
+#define LOX_ISOLATE
+
+#include "value.h"
+
+// isolates are VMs running on a pool of worker threads;
+// they share nothing but channels, which carry deep copies of
+// nil, booleans, numbers, strings, lists, maps and float arrays,
+// and channels themselves; a receive fails once no isolate is left to send
+
+struct VM;
+struct Obj_String;
+struct Isolate_Pool;
+
+// prepares a fresh isolate, e.g. defines natives
+typedef void Isolate_Setup(struct VM * vm);
+
+struct Isolate_Pool * isolate_pool_new(Isolate_Setup * setup);
+void isolate_pool_free(struct Isolate_Pool * pool); // waits for the spawned scripts, free the VM first
+
+bool isolate_spawn(struct VM * vm, struct Obj_String * source, uint8_t arg_count, Value * args);
+bool isolate_channel_new(struct VM * vm, Value * result);
+bool isolate_channel_send(struct VM * vm, Value channel, Value value);
+bool isolate_channel_receive(struct VM * vm, Value channel, Value * result);
+
+// channel objects hold a reference each, see `new_channel`
+struct Channel;
+void isolate_channel_retain(struct VM * vm, struct Channel * channel);
+void isolate_channel_release(struct VM * vm, struct Channel * channel);
+
+#endif
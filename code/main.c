@@ -4,60 +4,508 @@
 #include <time.h>
 
 #include "common.h"
-#include "chunk.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "compiler.h"
+#include "object.h"
+#include "numeric.h"
+#include "event.h"
+#include "image.h"
+#include "isolate.h"
+#include "source.h"
 #include "vm.h"
 
-static Value native_clock(uint8_t arg_count, Value * args) {
+typedef struct VM VM;
+
+static bool native_clock(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)vm; (void)arg_count; (void)args;
+	*result = TO_NUMBER((double)(clock()) / CLOCKS_PER_SEC);
+	return true;
+}
+
+static bool native_print(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	for (uint8_t i = 0; i < arg_count; i++) {
+		if (i > 0) { output_char(&vm->output, ' '); }
+		value_write(&vm->output, args[i]);
+	}
+	output_char(&vm->output, '\n');
+	*result = TO_NIL();
+	return true;
+}
+
+typedef struct Obj_List Obj_List;
+
+static bool native_push(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!IS_LIST(args[0])) {
+		runtime_error(vm, "expected a list");
+		return false;
+	}
+	Obj_List * list = AS_LIST(args[0]);
+	value_array_write(vm, &list->values, args[1]);
+	*result = TO_INT((int32_t)list->values.count);
+	return true;
+}
+
+static bool native_pop(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!IS_LIST(args[0])) {
+		runtime_error(vm, "expected a list");
+		return false;
+	}
+	Obj_List * list = AS_LIST(args[0]);
+	if (list->values.count == 0) {
+		runtime_error(vm, "can't pop from an empty list");
+		return false;
+	}
+	list->values.count--;
+	*result = list->values.values[list->values.count];
+	return true;
+}
+
+static bool native_length(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (IS_LIST(args[0])) {
+		*result = TO_INT((int32_t)AS_LIST(args[0])->values.count);
+		return true;
+	}
+	if (IS_MAP(args[0])) {
+		*result = TO_INT((int32_t)AS_MAP(args[0])->table.count);
+		return true;
+	}
+	if (IS_FLOAT_ARRAY(args[0])) {
+		*result = TO_INT((int32_t)AS_FLOAT_ARRAY(args[0])->count);
+		return true;
+	}
+	runtime_error(vm, "expected a list, a map or a float array");
+	return false;
+}
+
+typedef struct Obj_Map Obj_Map;
+
+static bool native_map(VM * vm, uint8_t arg_count, Value * args, Value * result) {
 	(void)arg_count; (void)args;
-	return TO_NUMBER((double)(clock()) / CLOCKS_PER_SEC);
+	*result = TO_OBJ(new_map(vm));
+	return true;
 }
 
-static Value native_print(uint8_t arg_count, Value * args) {
+static bool native_has(VM * vm, uint8_t arg_count, Value * args, Value * result) {
 	(void)arg_count;
-	value_print(args[0]);
-	printf("\n");
-	return TO_NIL();
+	if (!IS_MAP(args[0])) {
+		runtime_error(vm, "expected a map");
+		return false;
+	}
+	Value value;
+	*result = TO_BOOL(value_table_get(&AS_MAP(args[0])->table, args[1], &value));
+	return true;
 }
 
-static char * read_file(char const * path) {
-	FILE * file = fopen(path, "rb");
-	if (file == NULL) {
-		fprintf(stderr, "couldn't open file \"%s\"\n", path);
-		exit(4);
+static bool native_remove(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!IS_MAP(args[0])) {
+		runtime_error(vm, "expected a map");
+		return false;
+	}
+	*result = TO_BOOL(value_table_delete(&AS_MAP(args[0])->table, args[1]));
+	return true;
+}
+
+static bool native_keys(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!IS_MAP(args[0])) {
+		runtime_error(vm, "expected a map");
+		return false;
 	}
+	// GC protection: the result slot is on the stack
+	Obj_List * list = new_list(vm);
+	*result = TO_OBJ(list);
+	Value_Table * table = &AS_MAP(args[0])->table;
+	for (uint32_t i = 0; i < table->capacity; i++) {
+		Value_Entry * entry = &table->entries[i];
+		if (IS_NIL(entry->key)) { continue; }
+		value_array_write(vm, &list->values, entry->key);
+	}
+	return true;
+}
 
-	fseek(file, 0L, SEEK_END);
-	size_t file_size = (size_t)ftell(file);
-	rewind(file);
+typedef struct Obj_Float_Array Obj_Float_Array;
 
-	char * buffer = (char *)malloc(file_size + 1);
-	if (buffer == NULL) {
-		fprintf(stderr, "not enough memory to read \"%s\"\n", path);
-		exit(5);
+static bool native_float_array(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (IS_LIST(args[0])) {
+		Obj_List * list = AS_LIST(args[0]);
+		Obj_Float_Array * array = new_float_array(vm, list->values.count);
+		for (uint32_t i = 0; i < list->values.count; i++) {
+			Value value = list->values.values[i];
+			if (!IS_NUMBER(value)) {
+				runtime_error(vm, "float arrays can only store numbers");
+				return false;
+			}
+			array->values[i] = AS_NUMBER(value);
+		}
+		*result = TO_OBJ(array);
+		return true;
+	}
+	if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0 || AS_NUMBER(args[0]) > UINT32_MAX) {
+		runtime_error(vm, "expected a list or a count");
+		return false;
 	}
+	*result = TO_OBJ(new_float_array(vm, (uint32_t)AS_NUMBER(args[0])));
+	return true;
+}
 
-	size_t bytes_read = (size_t)fread(buffer, sizeof(char), file_size, file);
-	if (bytes_read < file_size) {
-		fprintf(stderr, "couldn't read file \"%s\"\n", path);
-		exit(6);
+static Obj_Float_Array * get_float_array(VM * vm, Value value) {
+	if (!IS_FLOAT_ARRAY(value)) {
+		runtime_error(vm, "expected a float array");
+		return NULL;
 	}
+	return AS_FLOAT_ARRAY(value);
+}
 
-	buffer[bytes_read] = '\0';
+static bool native_array_sum(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * array = get_float_array(vm, args[0]);
+	if (array == NULL) { return false; }
+	*result = TO_NUMBER(numeric_sum(array->values, array->count));
+	return true;
+}
 
-	fclose(file);
-	return buffer;
+static bool native_array_dot(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * a = get_float_array(vm, args[0]);
+	if (a == NULL) { return false; }
+	Obj_Float_Array * b = get_float_array(vm, args[1]);
+	if (b == NULL) { return false; }
+	if (a->count != b->count) {
+		runtime_error(vm, "float arrays lengths differ: %u and %u", a->count, b->count);
+		return false;
+	}
+	*result = TO_NUMBER(numeric_dot(a->values, b->values, a->count));
+	return true;
+}
+
+static bool native_array_min(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * array = get_float_array(vm, args[0]);
+	if (array == NULL) { return false; }
+	if (array->count == 0) {
+		*result = TO_NIL();
+		return true;
+	}
+	*result = TO_NUMBER(numeric_min(array->values, array->count));
+	return true;
+}
+
+static bool native_array_max(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * array = get_float_array(vm, args[0]);
+	if (array == NULL) { return false; }
+	if (array->count == 0) {
+		*result = TO_NIL();
+		return true;
+	}
+	*result = TO_NUMBER(numeric_max(array->values, array->count));
+	return true;
 }
 
-static void run_file(char const * path) {
-	char * source = read_file(path);
-	Interpret_Result result = vm_interpret(source);
-	free(source);
+static bool native_array_scale(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * array = get_float_array(vm, args[0]);
+	if (array == NULL) { return false; }
+	if (!IS_NUMBER(args[1])) {
+		runtime_error(vm, "expected a number");
+		return false;
+	}
+	numeric_scale(array->values, array->count, AS_NUMBER(args[1]));
+	*result = args[0];
+	return true;
+}
+
+static bool native_array_add(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * target = get_float_array(vm, args[0]);
+	if (target == NULL) { return false; }
+	Obj_Float_Array * values = get_float_array(vm, args[1]);
+	if (values == NULL) { return false; }
+	if (target->count != values->count) {
+		runtime_error(vm, "float arrays lengths differ: %u and %u", target->count, values->count);
+		return false;
+	}
+	numeric_add(target->values, values->values, target->count);
+	*result = args[0];
+	return true;
+}
+
+static bool native_array_sort(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Float_Array * array = get_float_array(vm, args[0]);
+	if (array == NULL) { return false; }
+	numeric_sort(array->values, array->count);
+	*result = args[0];
+	return true;
+}
+
+typedef struct Obj_String Obj_String;
+
+static bool native_spawn(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	if (!IS_STRING(args[0])) {
+		runtime_error(vm, "expected a source string");
+		return false;
+	}
+	if (!isolate_spawn(vm, AS_STRING(args[0]), arg_count - 1, args + 1)) { return false; }
+	*result = TO_NIL();
+	return true;
+}
+
+static bool native_channel(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return isolate_channel_new(vm, result);
+}
+
+static bool native_send(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!isolate_channel_send(vm, args[0], args[1])) { return false; }
+	*result = TO_NIL();
+	return true;
+}
+
+static bool native_receive(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	return isolate_channel_receive(vm, args[0], result);
+}
+
+typedef struct Obj_Function Obj_Function;
+
+static bool native_fiber(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	Obj_Function * function = NULL;
+	if (IS_CLOSURE(args[0])) { function = AS_CLOSURE(args[0])->function; }
+	if (IS_FUNCTION(args[0])) { function = AS_FUNCTION(args[0]); }
+	if (function == NULL || function->arity > 1) {
+		runtime_error(vm, "expected a function of at most one parameter");
+		return false;
+	}
+	*result = TO_OBJ(new_fiber(vm, AS_OBJ(args[0]), args + 1, 0));
+	return true;
+}
+
+static bool native_resume(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	if (arg_count > 2) {
+		runtime_error(vm, "expected at most %d arguments, but got %d", 2, arg_count);
+		return false;
+	}
+	return vm_fiber_resume(vm, args[0], arg_count == 2 ? args[1] : TO_NIL(), result);
+}
+
+static bool native_is_done(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!IS_FIBER(args[0])) {
+		runtime_error(vm, "expected a fiber");
+		return false;
+	}
+	*result = TO_BOOL(AS_FIBER(args[0])->state == FIBER_DONE);
+	return true;
+}
+
+static bool native_open(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	return event_open(vm, args[0], args[1], result);
+}
+
+static bool native_close(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!event_close(vm, args[0])) { return false; }
+	*result = TO_NIL();
+	return true;
+}
+
+static bool native_delete_file(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	if (!event_delete(vm, args[0])) { return false; }
+	*result = TO_NIL();
+	return true;
+}
+
+static bool native_stdin(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return event_standard(vm, 0, result);
+}
+
+static bool native_stdout(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return event_standard(vm, 1, result);
+}
+
+static bool native_stderr(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return event_standard(vm, 2, result);
+}
+
+static bool native_pipe(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return event_pipe(vm, result);
+}
+
+static bool native_read(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	return event_read(vm, args[0], result);
+}
+
+static bool native_write(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count;
+	return event_write(vm, args[0], args[1], result);
+}
+
+static bool native_io_pending(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	*result = TO_INT((int32_t)event_pending(vm));
+	return true;
+}
+
+static bool native_io_wait(VM * vm, uint8_t arg_count, Value * args, Value * result) {
+	(void)arg_count; (void)args;
+	return event_wait(vm, result);
+}
+
+static void define_natives(VM * vm) {
+	vm_define_native(vm, "clock", native_clock, 0, false);
+	vm_define_native(vm, "print", native_print, 0, true);
+	vm_define_native(vm, "push", native_push, 2, false);
+	vm_define_native(vm, "pop", native_pop, 1, false);
+	vm_define_native(vm, "length", native_length, 1, false);
+	vm_define_native(vm, "map", native_map, 0, false);
+	vm_define_native(vm, "has", native_has, 2, false);
+	vm_define_native(vm, "remove", native_remove, 2, false);
+	vm_define_native(vm, "keys", native_keys, 1, false);
+	vm_define_native(vm, "float_array", native_float_array, 1, false);
+	vm_define_native(vm, "array_sum", native_array_sum, 1, false);
+	vm_define_native(vm, "array_dot", native_array_dot, 2, false);
+	vm_define_native(vm, "array_min", native_array_min, 1, false);
+	vm_define_native(vm, "array_max", native_array_max, 1, false);
+	vm_define_native(vm, "array_scale", native_array_scale, 2, false);
+	vm_define_native(vm, "array_add", native_array_add, 2, false);
+	vm_define_native(vm, "array_sort", native_array_sort, 1, false);
+	vm_define_native(vm, "spawn", native_spawn, 1, true);
+	vm_define_native(vm, "channel", native_channel, 0, false);
+	vm_define_native(vm, "send", native_send, 2, false);
+	vm_define_native(vm, "receive", native_receive, 1, false);
+	vm_define_native(vm, "fiber", native_fiber, 1, false);
+	vm_define_native(vm, "resume", native_resume, 1, true);
+	vm_define_native(vm, "is_done", native_is_done, 1, false);
+	vm_define_native(vm, "open", native_open, 2, false);
+	vm_define_native(vm, "close", native_close, 1, false);
+	vm_define_native(vm, "pipe", native_pipe, 0, false);
+	vm_define_native(vm, "read", native_read, 1, false);
+	vm_define_native(vm, "write", native_write, 2, false);
+	vm_define_native(vm, "io_pending", native_io_pending, 0, false);
+	vm_define_native(vm, "io_wait", native_io_wait, 0, false);
+	vm_define_native(vm, "delete_file", native_delete_file, 1, false);
+	vm_define_native(vm, "stdin", native_stdin, 0, false);
+	vm_define_native(vm, "stdout", native_stdout, 0, false);
+	vm_define_native(vm, "stderr", native_stderr, 0, false);
+}
+
+static void run_file(VM * vm, char const * path) {
+	Source source;
+	if (!source_open(&source, path)) {
+		fprintf(stderr, "couldn't read file \"%s\"\n", path);
+		exit(4);
+	}
+
+	Interpret_Result result;
+	uint8_t const * bytes = (uint8_t const *)source.chars;
+	if (bytecode_is(bytes, source.length)) {
+		Obj_Function * function = bytecode_read(vm, bytes, source.length);
+		if (function == NULL) {
+			fprintf(stderr, "couldn't load bytecode \"%s\"\n", path);
+			exit(2);
+		}
+		result = vm_execute(vm, function);
+	}
+	else {
+		// lazily compiled functions can't be saved, optimized ones aren't
+		Cache_Entry entry = {.path = NULL};
+		bool is_cached = !vm->is_lazy && !vm->is_optimizing && cache_entry_init(&entry, source.chars, source.length);
+		Obj_Function * function = is_cached ? cache_load(vm, &entry) : NULL;
+		if (function == NULL) {
+			function = compile(vm, source.chars, source.length);
+			if (function != NULL && is_cached) { cache_store(vm, &entry, function); }
+		}
+		cache_entry_free(&entry);
+		result = function != NULL ? vm_execute(vm, function) : INTERPRET_COMPILE_ERROR;
+	}
+	source_close(&source);
 
 	if (result == INTERPRET_COMPILE_ERROR) { exit(2); }
 	if (result == INTERPRET_RUNTIME_ERROR) { exit(3); }
 }
 
-static void repl(void) {
+static void write_file(char const * path, uint8_t const * bytes, size_t length) {
+	FILE * file = fopen(path, "wb");
+	bool is_written = file != NULL && fwrite(bytes, sizeof(uint8_t), length, file) == length;
+	if (file != NULL && fclose(file) != 0) { is_written = false; }
+	if (!is_written) {
+		fprintf(stderr, "couldn't write file \"%s\"\n", path);
+		exit(4);
+	}
+}
+
+// `script.lox` becomes `script.loxc` by default
+static void compile_file(VM * vm, char const * path, char const * output_path) {
+	Source source;
+	if (!source_open(&source, path)) {
+		fprintf(stderr, "couldn't read file \"%s\"\n", path);
+		exit(4);
+	}
+	Obj_Function * function = compile(vm, source.chars, source.length);
+	source_close(&source);
+	if (function == NULL) { exit(2); }
+
+	size_t length;
+	uint8_t * bytes = bytecode_write(vm, function, &length);
+	if (bytes == NULL) { exit(2); }
+
+	char * default_path = NULL;
+	if (output_path == NULL) {
+		size_t path_length = strlen(path);
+		default_path = malloc(path_length + 2);
+		if (default_path == NULL) { exit(1); }
+		memcpy(default_path, path, path_length);
+		default_path[path_length] = 'c';
+		default_path[path_length + 1] = '\0';
+		output_path = default_path;
+	}
+
+	write_file(output_path, bytes, length);
+	free(default_path);
+	free(bytes);
+}
+
+// runs the script, then saves the heap it built
+static void snapshot_file(VM * vm, char const * path, char const * image_path) {
+	run_file(vm, path);
+
+	size_t length;
+	uint8_t * bytes = image_write(vm, &length);
+	if (bytes == NULL) { exit(2); }
+	write_file(image_path, bytes, length);
+	free(bytes);
+}
+
+static void load_image(VM * vm, char const * path) {
+	Source source;
+	if (!source_open(&source, path)) {
+		fprintf(stderr, "couldn't read file \"%s\"\n", path);
+		exit(4);
+	}
+	if (!image_read(vm, (uint8_t const *)source.chars, source.length)) {
+		fprintf(stderr, "couldn't load image \"%s\"\n", path);
+		exit(2);
+	}
+	source_close(&source);
+}
+
+static void repl(VM * vm) {
 	char line[1024];
 	for (;;) {
 		printf("> ");
@@ -66,25 +514,55 @@ static void repl(void) {
 			break;
 		}
 
-		vm_interpret(line);
+		vm_interpret(vm, line, strlen(line));
 	}
 }
 
 int main (int argc, char * argv[]) {
-	vm_init();
-	vm_define_native("clock", native_clock, 0);
-	vm_define_native("print", native_print, 1);
+	VM instance;
+	VM * vm = &instance;
+	vm_init(vm);
+	vm->isolates = isolate_pool_new(define_natives);
+	define_natives(vm);
 
 	if (argc == 1) {
-		repl();
+		repl(vm);
 	}
 	else if (argc == 2) {
-		run_file(argv[1]);
+		run_file(vm, argv[1]);
+	}
+	else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-c") == 0) {
+		compile_file(vm, argv[2], argc == 4 ? argv[3] : NULL);
+	}
+	else if (argc == 3 && strcmp(argv[1], "-l") == 0) {
+		vm->is_lazy = true;
+		run_file(vm, argv[2]);
+	}
+	else if (argc == 3 && strcmp(argv[1], "-O") == 0) {
+		vm->is_optimizing = true;
+		run_file(vm, argv[2]);
+	}
+	else if (argc == 4 && strcmp(argv[1], "-s") == 0) {
+		snapshot_file(vm, argv[2], argv[3]);
+	}
+	else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-i") == 0) {
+		load_image(vm, argv[2]);
+		if (argc == 4) { run_file(vm, argv[3]); }
+		else { repl(vm); }
 	}
 	else {
 		fprintf(stderr, "usage: interpreter [path]\n");
+		fprintf(stderr, "       interpreter -l path\n");
+		fprintf(stderr, "       interpreter -O path\n");
+		fprintf(stderr, "       interpreter -c path [output]\n");
+		fprintf(stderr, "       interpreter -s path image\n");
+		fprintf(stderr, "       interpreter -i image [path]\n");
 	}
 
-	vm_free();
+	// spawned scripts might run for a while yet, so the output is flushed first;
+	// the channel objects of the VM release their channels into the pool
+	struct Isolate_Pool * isolates = vm->isolates;
+	vm_free(vm);
+	isolate_pool_free(isolates);
 	return 0;
 }
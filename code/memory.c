@@ -3,6 +3,7 @@
 #include "memory.h"
 #include "object.h"
 #include "compiler.h"
+#include "event.h"
 #include "vm.h"
 
 #if defined(DEBUG_TRACE_GC)
@@ -11,18 +12,20 @@
 
 #define GC_HEAP_GROW_FACTOR 2
 
+typedef struct VM VM;
 typedef struct Obj Obj;
 
-void * reallocate(void * pointer, size_t old_size, size_t new_size) {
-	vm.bytes_allocated += new_size - old_size;
+void * reallocate(VM * vm, void * pointer, size_t old_size, size_t new_size) {
+	vm->bytes_allocated += new_size - old_size;
 
 #ifdef DEBUG_GC_STRESS
 	if (new_size > old_size) {
-		gc_run();
+		gc_run(vm);
 	}
 #else
-	if (vm.bytes_allocated > vm.next_gc) {
-		gc_run();
+	// shrinking never collects: `gc_sweep_white` frees through here
+	if (new_size > old_size && vm->bytes_allocated > vm->next_gc) {
+		gc_run(vm);
 	}
 #endif // DEBUG_GC_STRESS
 
@@ -38,34 +41,63 @@ void * reallocate(void * pointer, size_t old_size, size_t new_size) {
 
 typedef struct Obj_Upvalue Obj_Upvalue;
 
-static void gc_mark_roots_grey(void) {
-	for (Value * slot = vm.stack; slot < vm.stack_top; slot++) {
-		gc_mark_value_grey(*slot);
+static void gc_mark_roots_grey(VM * vm) {
+	for (Value * slot = vm->stack; slot < vm->stack_top; slot++) {
+		gc_mark_value_grey(vm, *slot);
 	}
 
-	for (uint32_t i = 0; i < vm.frame_count; i++) {
-		gc_mark_object_grey(vm.frames[i].function);
+	for (uint32_t i = 0; i < vm->frame_count; i++) {
+		gc_mark_object_grey(vm, vm->frames[i].function);
 	}
 
-	for (Obj_Upvalue * upvalue = vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
-		gc_mark_object_grey((Obj *)upvalue);
+	for (uint32_t i = 0; i < vm->native_count; i++) {
+		gc_mark_object_grey(vm, (Obj *)vm->natives[i]);
 	}
 
-	// `vm.strings` is a weak-references root
-	gc_mark_table_grey(&vm.globals);
-	gc_mark_object_grey((Obj *)vm.init_string);
+	for (Obj_Upvalue * upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+		gc_mark_object_grey(vm, (Obj *)upvalue);
+	}
+
+	// the running fiber holds its callers' states
+	gc_mark_object_grey(vm, (Obj *)vm->fiber);
+	gc_mark_event_loop_grey(vm);
+
+	// `vm->strings` is a weak-references root
+	gc_mark_table_grey(vm, &vm->globals);
+	gc_mark_object_grey(vm, (Obj *)vm->init_string);
 }
 
-static void gc_grey_to_black(void) {
-	while (vm.greyCount > 0) {
-		Obj * object = vm.greyStack[--vm.greyCount];
-		gc_mark_object_black(object);
+static void gc_grey_to_black(VM * vm) {
+	while (vm->greyCount > 0) {
+		Obj * object = vm->greyStack[--vm->greyCount];
+		gc_mark_object_black(vm, object);
+	}
+}
+
+typedef struct Obj_Fiber Obj_Fiber;
+
+// `vm->fibers` is a weak list; live closures might still
+// capture variables on the stacks of dead fibers
+static void gc_fibers_remove_white(VM * vm) {
+	Obj_Fiber ** link = &vm->fibers;
+	while (*link != NULL) {
+		Obj_Fiber * fiber = *link;
+		if (fiber->obj.is_marked) {
+			link = &fiber->next_fiber;
+			continue;
+		}
+
+		for (Obj_Upvalue * upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+			upvalue->closed = *upvalue->location;
+			upvalue->location = &upvalue->closed;
+		}
+		*link = fiber->next_fiber;
 	}
 }
 
-static void gc_sweep_white(void) {
+static void gc_sweep_white(VM * vm) {
 	Obj * previous = NULL;
-	Obj * object = vm.objects;
+	Obj * object = vm->objects;
 
 	while (object != NULL) {
 		if (object->is_marked) {
@@ -78,35 +110,36 @@ static void gc_sweep_white(void) {
 
 			object = object->next;
 			if (previous == NULL) {
-				vm.objects = object;
+				vm->objects = object;
 			}
 			else {
 				previous->next = object;
 			}
 
-			gc_free_object(unreached);
+			gc_free_object(vm, unreached);
 		}
 	}
 
-	vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+	vm->next_gc = vm->bytes_allocated * GC_HEAP_GROW_FACTOR;
 }
 
-void gc_run(void) {
+void gc_run(VM * vm) {
 #if defined(DEBUG_TRACE_GC)
-	size_t bytes_before = vm.bytes_allocated;
+	size_t bytes_before = vm->bytes_allocated;
 	printf("-- gc begin\n");
 #endif // DEBUG_TRACE_GC
 
-	gc_mark_roots_grey();
-	gc_mark_compiler_roots_grey();
-	gc_grey_to_black();
-	gc_table_remove_white_keys(&vm.strings);
-	gc_sweep_white();
+	gc_mark_roots_grey(vm);
+	gc_mark_compiler_roots_grey(vm);
+	gc_grey_to_black(vm);
+	gc_table_remove_white_keys(&vm->strings);
+	gc_fibers_remove_white(vm);
+	gc_sweep_white(vm);
 
 #if defined(DEBUG_TRACE_GC)
 	printf("-- gc end\n");
-	if (bytes_before > vm.bytes_allocated) {
-		printf("   collected %zu bytes (from %zu to %zu); next at: %zu\n", bytes_before - vm.bytes_allocated, bytes_before, vm.bytes_allocated, vm.next_gc);
+	if (bytes_before > vm->bytes_allocated) {
+		printf("   collected %zu bytes (from %zu to %zu); next at: %zu\n", bytes_before - vm->bytes_allocated, bytes_before, vm->bytes_allocated, vm->next_gc);
 	}
 #endif // DEBUG_TRACE_GC
 }
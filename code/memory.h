@@ -3,19 +3,21 @@
 
 #include "common.h"
 
+struct VM;
+
 #define GROWTH_FACTOR 2
 
 #define GROW_CAPACITY(capacity) \
 	((capacity) < 8 ? 8 : (capacity) * GROWTH_FACTOR)
 
-#define GROW_ARRAY(pointer, old_count, new_count) \
-	reallocate(pointer, sizeof(*pointer) * (old_count), sizeof(*pointer) * (new_count))
+#define GROW_ARRAY(vm, pointer, old_count, new_count) \
+	reallocate(vm, pointer, sizeof(*pointer) * (old_count), sizeof(*pointer) * (new_count))
 
-#define FREE_ARRAY(pointer, old_count) \
-	reallocate(pointer, sizeof(*pointer) * (old_count), 0)
+#define FREE_ARRAY(vm, pointer, old_count) \
+	reallocate(vm, pointer, sizeof(*pointer) * (old_count), 0)
 
-void * reallocate(void * pointer, size_t old_size, size_t new_size);
+void * reallocate(struct VM * vm, void * pointer, size_t old_size, size_t new_size);
 
-void gc_run(void);
+void gc_run(struct VM * vm);
 
 #endif
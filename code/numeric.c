@@ -0,0 +1,187 @@
+#include <stdlib.h>
+
+#include "numeric.h"
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define NUMERIC_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define NUMERIC_SSE2
+#endif
+
+// @note: vector lanes accumulate independently,
+//        so sums might differ from a sequential loop in the last bits
+
+double numeric_sum(double const * values, uint32_t count) {
+	uint32_t i = 0;
+	double result = 0;
+#if defined(NUMERIC_AVX)
+	__m256d acc_a = _mm256_setzero_pd();
+	__m256d acc_b = _mm256_setzero_pd();
+	for (; i + 8 <= count; i += 8) {
+		acc_a = _mm256_add_pd(acc_a, _mm256_loadu_pd(values + i));
+		acc_b = _mm256_add_pd(acc_b, _mm256_loadu_pd(values + i + 4));
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc_a, acc_b));
+	result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(NUMERIC_SSE2)
+	__m128d acc_a = _mm_setzero_pd();
+	__m128d acc_b = _mm_setzero_pd();
+	for (; i + 4 <= count; i += 4) {
+		acc_a = _mm_add_pd(acc_a, _mm_loadu_pd(values + i));
+		acc_b = _mm_add_pd(acc_b, _mm_loadu_pd(values + i + 2));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc_a, acc_b));
+	result = lanes[0] + lanes[1];
+#endif
+	for (; i < count; i++) {
+		result += values[i];
+	}
+	return result;
+}
+
+double numeric_dot(double const * a, double const * b, uint32_t count) {
+	uint32_t i = 0;
+	double result = 0;
+#if defined(NUMERIC_AVX)
+	__m256d acc = _mm256_setzero_pd();
+	for (; i + 4 <= count; i += 4) {
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(NUMERIC_SSE2)
+	__m128d acc = _mm_setzero_pd();
+	for (; i + 2 <= count; i += 2) {
+		acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	result = lanes[0] + lanes[1];
+#endif
+	for (; i < count; i++) {
+		result += a[i] * b[i];
+	}
+	return result;
+}
+
+double numeric_min(double const * values, uint32_t count) {
+	if (count == 0) { return 0; }
+	uint32_t i = 0;
+	double result = values[0];
+#if defined(NUMERIC_AVX)
+	if (count >= 4) {
+		__m256d acc = _mm256_loadu_pd(values);
+		for (i = 4; i + 4 <= count; i += 4) {
+			acc = _mm256_min_pd(acc, _mm256_loadu_pd(values + i));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (lanes[lane] < result) { result = lanes[lane]; }
+		}
+	}
+#elif defined(NUMERIC_SSE2)
+	if (count >= 2) {
+		__m128d acc = _mm_loadu_pd(values);
+		for (i = 2; i + 2 <= count; i += 2) {
+			acc = _mm_min_pd(acc, _mm_loadu_pd(values + i));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, acc);
+		for (uint32_t lane = 0; lane < 2; lane++) {
+			if (lanes[lane] < result) { result = lanes[lane]; }
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		if (values[i] < result) { result = values[i]; }
+	}
+	return result;
+}
+
+double numeric_max(double const * values, uint32_t count) {
+	if (count == 0) { return 0; }
+	uint32_t i = 0;
+	double result = values[0];
+#if defined(NUMERIC_AVX)
+	if (count >= 4) {
+		__m256d acc = _mm256_loadu_pd(values);
+		for (i = 4; i + 4 <= count; i += 4) {
+			acc = _mm256_max_pd(acc, _mm256_loadu_pd(values + i));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (lanes[lane] > result) { result = lanes[lane]; }
+		}
+	}
+#elif defined(NUMERIC_SSE2)
+	if (count >= 2) {
+		__m128d acc = _mm_loadu_pd(values);
+		for (i = 2; i + 2 <= count; i += 2) {
+			acc = _mm_max_pd(acc, _mm_loadu_pd(values + i));
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, acc);
+		for (uint32_t lane = 0; lane < 2; lane++) {
+			if (lanes[lane] > result) { result = lanes[lane]; }
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		if (values[i] > result) { result = values[i]; }
+	}
+	return result;
+}
+
+void numeric_scale(double * values, uint32_t count, double factor) {
+	uint32_t i = 0;
+#if defined(NUMERIC_AVX)
+	__m256d factor_vector = _mm256_set1_pd(factor);
+	for (; i + 4 <= count; i += 4) {
+		_mm256_storeu_pd(values + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), factor_vector));
+	}
+#elif defined(NUMERIC_SSE2)
+	__m128d factor_vector = _mm_set1_pd(factor);
+	for (; i + 2 <= count; i += 2) {
+		_mm_storeu_pd(values + i, _mm_mul_pd(_mm_loadu_pd(values + i), factor_vector));
+	}
+#endif
+	for (; i < count; i++) {
+		values[i] *= factor;
+	}
+}
+
+void numeric_add(double * target, double const * values, uint32_t count) {
+	uint32_t i = 0;
+#if defined(NUMERIC_AVX)
+	for (; i + 4 <= count; i += 4) {
+		_mm256_storeu_pd(target + i, _mm256_add_pd(_mm256_loadu_pd(target + i), _mm256_loadu_pd(values + i)));
+	}
+#elif defined(NUMERIC_SSE2)
+	for (; i + 2 <= count; i += 2) {
+		_mm_storeu_pd(target + i, _mm_add_pd(_mm_loadu_pd(target + i), _mm_loadu_pd(values + i)));
+	}
+#endif
+	for (; i < count; i++) {
+		target[i] += values[i];
+	}
+}
+
+static int compare_doubles(void const * a, void const * b) {
+	double a_value = *(double const *)a;
+	double b_value = *(double const *)b;
+	return (a_value > b_value) - (a_value < b_value);
+}
+
+void numeric_sort(double * values, uint32_t count) {
+	qsort(values, count, sizeof(double), compare_doubles);
+}
+
+#undef NUMERIC_AVX
+#undef NUMERIC_SSE2
@@ -0,0 +1,17 @@
+#if !defined(LOX_NUMERIC)
+#define LOX_NUMERIC
+
+#include "common.h"
+
+// bulk kernels over raw doubles;
+// vectorized with SSE2 on x64 and AVX when the compiler targets it
+
+double numeric_sum(double const * values, uint32_t count);
+double numeric_dot(double const * a, double const * b, uint32_t count);
+double numeric_min(double const * values, uint32_t count);
+double numeric_max(double const * values, uint32_t count);
+void numeric_scale(double * values, uint32_t count, double factor);
+void numeric_add(double * target, double const * values, uint32_t count);
+void numeric_sort(double * values, uint32_t count);
+
+#endif
@@ -4,20 +4,23 @@
 
 #include "memory.h"
 #include "object.h"
+#include "output.h"
 #include "vm.h"
+#include "isolate.h"
+#include "event.h"
 
-#define ALLOCATE_OBJ(type, flexible, object_type) \
-	(type *)(void *)allocate_object(sizeof(type) + flexible, object_type)
+#define ALLOCATE_OBJ(vm, type, flexible, object_type) \
+	(type *)(void *)allocate_object(vm, sizeof(type) + flexible, object_type)
 
-#define FREE_OBJ(pointer, flexible) \
-	reallocate(pointer, sizeof(*pointer) + flexible, 0)
+#define FREE_OBJ(vm, pointer, flexible) \
+	reallocate(vm, pointer, sizeof(*pointer) + flexible, 0)
 
 typedef struct VM VM;
 
 typedef struct Obj Obj;
 
-static Obj * allocate_object(size_t size, Obj_Type type) {
-	Obj * object = (Obj *)reallocate(NULL, 0, size);
+static Obj * allocate_object(VM * vm, size_t size, Obj_Type type) {
+	Obj * object = (Obj *)reallocate(vm, NULL, 0, size);
 #if defined(DEBUG_TRACE_GC)
 	printf("%p allocate %zu, type %d\n", (void *)object, size, type);
 #endif // DEBUG_TRACE_GC
@@ -25,17 +28,18 @@ static Obj * allocate_object(size_t size, Obj_Type type) {
 	object->type = type;
 	object->is_marked = false;
 
-	object->next = vm.objects;
-	vm.objects = object;
+	object->next = vm->objects;
+	vm->objects = object;
 
 	return object;
 }
 
 typedef struct Obj_String Obj_String;
 
-static Obj_String * allocate_string(uint32_t length) {
-	Obj_String * string = ALLOCATE_OBJ(Obj_String, sizeof(char) * (length + 1), OBJ_STRING);
+static Obj_String * allocate_string(VM * vm, uint32_t length) {
+	Obj_String * string = ALLOCATE_OBJ(vm, Obj_String, sizeof(char) * (length + 1), OBJ_STRING);
 	string->length = length;
+	string->is_native_name = false;
 	string->chars[length] = '\0';
 	return string;
 }
@@ -55,19 +59,19 @@ static uint32_t hash_string(char const * chars, uint32_t length) {
 	return hash_string_2(2166136261u, chars, length);
 }
 
-Obj_String * copy_string(char const * chars, uint32_t length) {
+Obj_String * copy_string(VM * vm, char const * chars, uint32_t length) {
 	uint32_t hash = hash_string(chars, length);
-	Obj_String * interned = table_find_key_copy(&vm.strings, chars, length, hash);
+	Obj_String * interned = table_find_key_copy(&vm->strings, chars, length, hash);
 	if (interned != NULL) { return interned; }
 
-	Obj_String * string = allocate_string(length);
+	Obj_String * string = allocate_string(vm, length);
 	memcpy(string->chars, chars, length);
 	string->hash = hash;
 
 	// GC protection
-	vm_stack_push(TO_OBJ(string));
-	table_set(&vm.strings, string, TO_NIL());
-	vm_stack_pop();
+	vm_stack_push(vm, TO_OBJ(string));
+	table_set(vm, &vm->strings, string, TO_NIL());
+	vm_stack_pop(vm);
 
 	return string;
 }
@@ -79,109 +83,217 @@ typedef struct Obj_Upvalue Obj_Upvalue;
 typedef struct Obj_Class Obj_Class;
 typedef struct Obj_Instance Obj_Instance;
 typedef struct Obj_Bound_Method Obj_Bound_Method;
+typedef struct Obj_List Obj_List;
+typedef struct Obj_Map Obj_Map;
+typedef struct Obj_Float_Array Obj_Float_Array;
+
+#define OUTPUT_LITERAL(output, text) output_chars(output, text, sizeof(text) - 1)
+
+// lists and maps being written, innermost first; a container that holds
+// itself or nests too deep is written as `[...]` or `{...}`
+#define WRITE_DEPTH_MAX 64
+
+typedef struct Nesting Nesting;
+struct Nesting {
+	Obj const * object;
+	Nesting const * outer;
+	uint32_t depth;
+};
+
+static bool nesting_contains(Nesting const * nesting, Obj const * object) {
+	for (; nesting != NULL; nesting = nesting->outer) {
+		if (nesting->object == object) { return true; }
+	}
+	return false;
+}
+
+static void object_write_nested(Output * output, Obj * object, Nesting const * outer);
+
+static void element_write(Output * output, Value value, Nesting const * nesting) {
+	if (IS_OBJ(value)) { object_write_nested(output, AS_OBJ(value), nesting); }
+	else { value_write(output, value); }
+}
+
+void object_write(Output * output, Obj * object) {
+	object_write_nested(output, object, NULL);
+}
+
+static void object_write_nested(Output * output, Obj * object, Nesting const * outer) {
+	Nesting nesting = {.object = object, .outer = outer, .depth = outer != NULL ? outer->depth + 1 : 0};
+	bool is_container = object->type == OBJ_LIST || object->type == OBJ_MAP;
+	if (is_container && (nesting.depth == WRITE_DEPTH_MAX || nesting_contains(outer, object))) {
+		if (object->type == OBJ_LIST) { OUTPUT_LITERAL(output, "[...]"); }
+		else { OUTPUT_LITERAL(output, "{...}"); }
+		return;
+	}
 
-void print_object(Obj * object) {
 	switch (object->type) {
 		case OBJ_STRING:
 			Obj_String * string = (Obj_String *)object;
-			printf("%s", string->chars);
+			output_chars(output, string->chars, string->length);
 			break;
 
 		case OBJ_FUNCTION: {
 			Obj_Function * function = (Obj_Function *)object;
 			if (function->name == NULL) {
-				printf("<script>");
+				OUTPUT_LITERAL(output, "<script>");
 			}
 			else {
-				printf("<fn %s>", function->name->chars);
+				OUTPUT_LITERAL(output, "<fn ");
+				output_chars(output, function->name->chars, function->name->length);
+				output_char(output, '>');
 			}
 			break;
 		}
 
 		case OBJ_NATIVE: {
 			// Obj_Native * native = (Obj_Native *)object;
-			printf("<native fn>");
+			OUTPUT_LITERAL(output, "<native fn>");
 			break;
 		}
 
 		case OBJ_CLOSURE: {
 			Obj_Closure * closure = (Obj_Closure *)object;
-			print_object((Obj *)closure->function);
-			printf(" closure");
+			object_write(output, (Obj *)closure->function);
+			OUTPUT_LITERAL(output, " closure");
 			break;
 		}
 
 		case OBJ_UPVALUE: {
 			// Obj_Upvalue * upvalue = (Obj_Upvalue *)object;
-			// value_print(*upvalue->location);
-			printf("upvalue");
+			// value_write(output, *upvalue->location);
+			OUTPUT_LITERAL(output, "upvalue");
 			break;
 		}
 
 		case OBJ_CLASS: {
 			Obj_Class * lox_class = (Obj_Class *)object;
-			printf("%s", lox_class->name->chars);
+			output_chars(output, lox_class->name->chars, lox_class->name->length);
 			break;
 		}
 
 		case OBJ_INSTANCE: {
 			Obj_Instance * instance = (Obj_Instance *)object;
-			print_object((Obj *)instance->lox_class);
-			printf(" instance");
+			object_write(output, (Obj *)instance->lox_class);
+			OUTPUT_LITERAL(output, " instance");
 			break;
 		}
 
 		case OBJ_BOUND_METHOD: {
 			Obj_Bound_Method * bound = (Obj_Bound_Method *)object;
-			print_object((Obj *)bound->method);
-			printf(" bound");
+			object_write(output, (Obj *)bound->method);
+			OUTPUT_LITERAL(output, " bound");
+			break;
+		}
+
+		case OBJ_LIST: {
+			Obj_List * list = (Obj_List *)object;
+			output_char(output, '[');
+			for (uint32_t i = 0; i < list->values.count; i++) {
+				if (i > 0) { OUTPUT_LITERAL(output, ", "); }
+				element_write(output, list->values.values[i], &nesting);
+			}
+			output_char(output, ']');
+			break;
+		}
+
+		case OBJ_MAP: {
+			Obj_Map * map = (Obj_Map *)object;
+			output_char(output, '{');
+			bool is_first = true;
+			for (uint32_t i = 0; i < map->table.capacity; i++) {
+				Value_Entry * entry = &map->table.entries[i];
+				if (IS_NIL(entry->key)) { continue; }
+				if (!is_first) { OUTPUT_LITERAL(output, ", "); }
+				is_first = false;
+				element_write(output, entry->key, &nesting);
+				OUTPUT_LITERAL(output, ": ");
+				element_write(output, entry->value, &nesting);
+			}
+			output_char(output, '}');
+			break;
+		}
+
+		case OBJ_FLOAT_ARRAY: {
+			Obj_Float_Array * array = (Obj_Float_Array *)object;
+			output_char(output, '[');
+			for (uint32_t i = 0; i < array->count; i++) {
+				if (i > 0) { OUTPUT_LITERAL(output, ", "); }
+				output_number(output, array->values[i]);
+			}
+			output_char(output, ']');
+			break;
+		}
+
+		case OBJ_FIBER: {
+			OUTPUT_LITERAL(output, "fiber");
+			break;
+		}
+
+		case OBJ_CHANNEL: {
+			OUTPUT_LITERAL(output, "channel");
+			break;
+		}
+
+		case OBJ_HANDLE: {
+			OUTPUT_LITERAL(output, "handle");
 			break;
 		}
 	}
 }
 
-Obj_String * strings_concatenate(Obj_String * a_string, Obj_String * b_string) {
+#undef OUTPUT_LITERAL
+
+Obj_String * strings_concatenate(VM * vm, Obj_String * a_string, Obj_String * b_string) {
 	uint32_t hash = hash_string_2(a_string->hash, b_string->chars, b_string->length);
 	uint32_t length = a_string->length + b_string->length;
-	Obj_String * interned = table_find_key_concatenate(&vm.strings, a_string->chars, a_string->length, b_string->chars, b_string->length, hash);
+	Obj_String * interned = table_find_key_concatenate(&vm->strings, a_string->chars, a_string->length, b_string->chars, b_string->length, hash);
 	if (interned != NULL) { return interned; }
 
-	Obj_String * string = allocate_string(length);
+	Obj_String * string = allocate_string(vm, length);
 	memcpy(string->chars, a_string->chars, sizeof(char) * a_string->length);
 	memcpy(string->chars + a_string->length, b_string->chars, sizeof(char) * b_string->length);
 	string->hash = hash;
 
 	// GC protection
-	vm_stack_push(TO_OBJ(string));
-	table_set(&vm.strings, string, TO_NIL());
-	vm_stack_pop();
+	vm_stack_push(vm, TO_OBJ(string));
+	table_set(vm, &vm->strings, string, TO_NIL());
+	vm_stack_pop(vm);
 
 	return string;
 }
 
-Obj_Function * new_function(void) {
-	Obj_Function * function = ALLOCATE_OBJ(Obj_Function, 0, OBJ_FUNCTION);
+Obj_Function * new_function(VM * vm) {
+	Obj_Function * function = ALLOCATE_OBJ(vm, Obj_Function, 0, OBJ_FUNCTION);
 	function->arity = 0;
+	function->is_generator = false;
+	function->inline_kind = INLINE_NONE;
 	function->upvalue_count = 0;
+	function->stack_max = 0;
 	function->name = NULL;
+	function->lazy = NULL;
+	function->inline_value = TO_NIL();
 	chunk_init(&function->chunk);
 	return function;
 }
 
-Obj_Native * new_native(Native_Fn * function, uint8_t arity) {
-	Obj_Native * native = ALLOCATE_OBJ(Obj_Native, 0, OBJ_NATIVE);
+Obj_Native * new_native(VM * vm, Obj_String * name, Native_Fn * function, uint8_t arity, bool is_variadic) {
+	Obj_Native * native = ALLOCATE_OBJ(vm, Obj_Native, 0, OBJ_NATIVE);
 	native->function = function;
+	native->name = name;
 	native->arity = arity;
+	native->is_variadic = is_variadic;
+	native->is_shadowed = false;
 	return native;
 }
 
-Obj_Closure * new_closure(Obj_Function * function) {
-	Obj_Upvalue ** upvalues = reallocate(NULL, 0, sizeof(Obj_Upvalue *) * function->upvalue_count);
+Obj_Closure * new_closure(VM * vm, Obj_Function * function) {
+	Obj_Upvalue ** upvalues = reallocate(vm, NULL, 0, sizeof(Obj_Upvalue *) * function->upvalue_count);
 	for (uint32_t i = 0; i < function->upvalue_count; i++) {
 		upvalues[i] = NULL;
 	}
 
-	Obj_Closure * closure = ALLOCATE_OBJ(Obj_Closure, 0, OBJ_CLOSURE);
+	Obj_Closure * closure = ALLOCATE_OBJ(vm, Obj_Closure, 0, OBJ_CLOSURE);
 	closure->function = function;
 	closure->upvalues = upvalues;
 	closure->upvalue_count = function->upvalue_count;
@@ -189,37 +301,100 @@ Obj_Closure * new_closure(Obj_Function * function) {
 	return closure;
 }
 
-Obj_Upvalue * new_upvalue(Value * slot) {
-	Obj_Upvalue * upvalue = ALLOCATE_OBJ(Obj_Upvalue, 0, OBJ_UPVALUE);
+Obj_Upvalue * new_upvalue(VM * vm, Value * slot) {
+	Obj_Upvalue * upvalue = ALLOCATE_OBJ(vm, Obj_Upvalue, 0, OBJ_UPVALUE);
 	upvalue->closed = TO_NIL();
 	upvalue->location = slot;
 	upvalue->next = NULL;
 	return upvalue;
 }
 
-Obj_Class * new_class(Obj_String * name) {
-	Obj_Class * lox_class = ALLOCATE_OBJ(Obj_Class, 0, OBJ_CLASS);
+Obj_Class * new_class(VM * vm, Obj_String * name) {
+	Obj_Class * lox_class = ALLOCATE_OBJ(vm, Obj_Class, 0, OBJ_CLASS);
 	lox_class->name = name;
 	table_init(&lox_class->methods);
 	return lox_class;
 }
 
-Obj_Instance * new_instance(Obj_Class * lox_class) {
-	Obj_Instance * instance = ALLOCATE_OBJ(Obj_Instance, 0, OBJ_INSTANCE);
+Obj_Instance * new_instance(VM * vm, Obj_Class * lox_class) {
+	Obj_Instance * instance = ALLOCATE_OBJ(vm, Obj_Instance, 0, OBJ_INSTANCE);
 	instance->lox_class = lox_class;
 	table_init(&instance->table);
 	return instance;
 }
 
-Obj_Bound_Method * new_bound_method(Value receiver, struct Obj_Function * method) {
-	Obj_Bound_Method * bound = ALLOCATE_OBJ(Obj_Bound_Method, 0, OBJ_BOUND_METHOD);
+Obj_Bound_Method * new_bound_method(VM * vm, Value receiver, struct Obj_Function * method) {
+	Obj_Bound_Method * bound = ALLOCATE_OBJ(vm, Obj_Bound_Method, 0, OBJ_BOUND_METHOD);
 	bound->receiver = receiver;
 	bound->method = method;
 	return bound;
 
 }
 
-void gc_free_object(Obj * object) {
+Obj_List * new_list(VM * vm) {
+	Obj_List * list = ALLOCATE_OBJ(vm, Obj_List, 0, OBJ_LIST);
+	value_array_init(&list->values);
+	return list;
+}
+
+Obj_Map * new_map(VM * vm) {
+	Obj_Map * map = ALLOCATE_OBJ(vm, Obj_Map, 0, OBJ_MAP);
+	value_table_init(&map->table);
+	return map;
+}
+
+Obj_Float_Array * new_float_array(VM * vm, uint32_t count) {
+	Obj_Float_Array * array = ALLOCATE_OBJ(vm, Obj_Float_Array, sizeof(double) * count, OBJ_FLOAT_ARRAY);
+	array->count = count;
+	memset(array->values, 0, sizeof(double) * count);
+	return array;
+}
+
+typedef struct Obj_Fiber Obj_Fiber;
+
+Obj_Fiber * new_fiber(VM * vm, Obj * function, Value * args, uint8_t arg_count) {
+	Obj_Fiber * fiber = ALLOCATE_OBJ(vm, Obj_Fiber, 0, OBJ_FIBER);
+	fiber->state = FIBER_NEW;
+	fiber->caller = NULL;
+	fiber->function = function;
+	fiber->loop_exit = NULL;
+
+	fiber->frame_count = 0;
+	fiber->frame_capacity = FRAMES_INITIAL;
+	fiber->frames = malloc(sizeof(*fiber->frames) * fiber->frame_capacity);
+	fiber->stack_capacity = STACK_INITIAL;
+	fiber->stack = malloc(sizeof(*fiber->stack) * fiber->stack_capacity);
+	if (fiber->frames == NULL || fiber->stack == NULL) { exit(1); }
+
+	// the first `resume` calls it; methods have the receiver in `args[-1]`
+	memcpy(fiber->stack, args - 1, sizeof(Value) * (arg_count + 1));
+	fiber->stack_top = fiber->stack + arg_count + 1;
+	fiber->open_upvalues = NULL;
+
+	fiber->next_fiber = vm->fibers;
+	vm->fibers = fiber;
+	return fiber;
+}
+
+typedef struct Obj_Channel Obj_Channel;
+
+Obj_Channel * new_channel(VM * vm, struct Channel * channel) {
+	Obj_Channel * object = ALLOCATE_OBJ(vm, Obj_Channel, 0, OBJ_CHANNEL);
+	object->channel = channel;
+	isolate_channel_retain(vm, channel);
+	return object;
+}
+
+typedef struct Obj_Handle Obj_Handle;
+
+Obj_Handle * new_handle(VM * vm, int fd, bool is_standard) {
+	Obj_Handle * handle = ALLOCATE_OBJ(vm, Obj_Handle, 0, OBJ_HANDLE);
+	handle->fd = fd;
+	handle->is_standard = is_standard;
+	return handle;
+}
+
+void gc_free_object(VM * vm, Obj * object) {
 #if defined(DEBUG_TRACE_GC)
 	printf("%p free, type %d\n", (void *)object, object->type);
 #endif // DEBUG_TRACE_GC
@@ -227,130 +402,211 @@ void gc_free_object(Obj * object) {
 	switch (object->type) {
 		case OBJ_STRING: {
 			Obj_String * string = (Obj_String *)object;
-			FREE_OBJ(string, sizeof(char) * string->length);
+			FREE_OBJ(vm, string, sizeof(char) * string->length);
 			break;
 		}
 
 		case OBJ_FUNCTION: {
 			Obj_Function * function = (Obj_Function *)object;
-			chunk_free(&function->chunk);
-			FREE_OBJ(function, 0);
+			chunk_free(vm, &function->chunk);
+			if (function->lazy != NULL) {
+				reallocate(vm, function->lazy, sizeof(*function->lazy) + function->lazy->size, 0);
+			}
+			FREE_OBJ(vm, function, 0);
 			break;
 		}
 
 		case OBJ_NATIVE: {
 			Obj_Native * native = (Obj_Native *)object;
-			FREE_OBJ(native, 0);
+			FREE_OBJ(vm, native, 0);
 			break;
 		}
 
 		case OBJ_CLOSURE: {
 			Obj_Closure * closure = (Obj_Closure *)object;
-			reallocate(closure->upvalues, sizeof(*closure->upvalues) * closure->upvalue_count, 0);
-			FREE_OBJ(closure, 0);
+			reallocate(vm, closure->upvalues, sizeof(*closure->upvalues) * closure->upvalue_count, 0);
+			FREE_OBJ(vm, closure, 0);
 			break;
 		}
 
 		case OBJ_UPVALUE: {
 			Obj_Upvalue * upvalue = (Obj_Upvalue *)object;
-			FREE_OBJ(upvalue, 0);
+			FREE_OBJ(vm, upvalue, 0);
 			break;
 		}
 
 		case OBJ_CLASS: {
 			Obj_Class * lox_class = (Obj_Class *)object;
-			table_free(&lox_class->methods);
-			FREE_OBJ(lox_class, 0);
+			table_free(vm, &lox_class->methods);
+			FREE_OBJ(vm, lox_class, 0);
 			break;
 		}
 
 		case OBJ_INSTANCE: {
 			Obj_Instance * instance = (Obj_Instance *)object;
-			table_free(&instance->table);
-			FREE_OBJ(instance, 0);
+			table_free(vm, &instance->table);
+			FREE_OBJ(vm, instance, 0);
 			break;
 		}
 
 		case OBJ_BOUND_METHOD: {
 			Obj_Bound_Method * bound = (Obj_Bound_Method *)object;
-			FREE_OBJ(bound, 0);
+			FREE_OBJ(vm, bound, 0);
+			break;
+		}
+
+		case OBJ_LIST: {
+			Obj_List * list = (Obj_List *)object;
+			value_array_free(vm, &list->values);
+			FREE_OBJ(vm, list, 0);
+			break;
+		}
+
+		case OBJ_MAP: {
+			Obj_Map * map = (Obj_Map *)object;
+			value_table_free(vm, &map->table);
+			FREE_OBJ(vm, map, 0);
+			break;
+		}
+
+		case OBJ_FLOAT_ARRAY: {
+			Obj_Float_Array * array = (Obj_Float_Array *)object;
+			FREE_OBJ(vm, array, sizeof(double) * array->count);
+			break;
+		}
+
+		case OBJ_FIBER: {
+			Obj_Fiber * fiber = (Obj_Fiber *)object;
+			free(fiber->frames);
+			free(fiber->stack);
+			FREE_OBJ(vm, fiber, 0);
+			break;
+		}
+
+		case OBJ_CHANNEL: {
+			Obj_Channel * channel = (Obj_Channel *)object;
+			isolate_channel_release(vm, channel->channel);
+			FREE_OBJ(vm, channel, 0);
+			break;
+		}
+
+		case OBJ_HANDLE: {
+			Obj_Handle * handle = (Obj_Handle *)object;
+			event_handle_free(handle);
+			FREE_OBJ(vm, handle, 0);
 			break;
 		}
 	}
 }
 
-void gc_mark_object_grey(Obj * object) {
+void gc_mark_object_grey(VM * vm, Obj * object) {
 	if (object == NULL) { return; }
 	if (object->is_marked) { return; }
 
 #if defined(DEBUG_TRACE_GC)
 	printf("%p mark grey ", (void *)object);
-	print_object(object);
+	value_print(TO_OBJ(object));
 	printf("\n");
 #endif // DEBUG_TRACE_GC
 
 	object->is_marked = true;
 
-	if (vm.greyCapacity < vm.greyCount + 1) {
-		vm.greyCapacity = GROW_CAPACITY(vm.greyCapacity);
-		vm.greyStack = realloc(vm.greyStack, sizeof(*vm.greyStack) * vm.greyCapacity);
-		if (vm.greyStack == NULL) { exit(1); }
+	if (vm->greyCapacity < vm->greyCount + 1) {
+		vm->greyCapacity = GROW_CAPACITY(vm->greyCapacity);
+		vm->greyStack = realloc(vm->greyStack, sizeof(*vm->greyStack) * vm->greyCapacity);
+		if (vm->greyStack == NULL) { exit(1); }
 	}
 
-	vm.greyStack[vm.greyCount++] = object;
+	vm->greyStack[vm->greyCount++] = object;
 }
 
-void gc_mark_object_black(Obj * object) {
+void gc_mark_object_black(VM * vm, Obj * object) {
 #if defined(DEBUG_TRACE_GC)
 	printf("%p mark black ", (void *)object);
-	print_object((Obj *)object);
+	value_print(TO_OBJ((Obj *)object));
 	printf("\n");
 #endif
 
 	switch (object->type) {
 		case OBJ_STRING:
-		case OBJ_NATIVE:
+		case OBJ_FLOAT_ARRAY:
+		case OBJ_CHANNEL:
+		case OBJ_HANDLE:
+			break;
+
+		case OBJ_NATIVE: {
+			gc_mark_object_grey(vm, (Obj *)((Obj_Native *)object)->name);
 			break;
+		}
 
 		case OBJ_FUNCTION: {
 			Obj_Function * function = (Obj_Function *)object;
-			gc_mark_object_grey((Obj *)function->name);
-			gc_mark_value_array_grey(&function->chunk.constants);
+			gc_mark_object_grey(vm, (Obj *)function->name);
+			gc_mark_value_array_grey(vm, &function->chunk.constants);
 			break;
 		}
 
 		case OBJ_CLOSURE: {
 			Obj_Closure * closure = (Obj_Closure *)object;
-			gc_mark_object_grey((Obj *)closure->function);
+			gc_mark_object_grey(vm, (Obj *)closure->function);
 			for (uint32_t i = 0; i < closure->upvalue_count; i++) {
-				gc_mark_object_grey((Obj *)closure->upvalues[i]);
+				gc_mark_object_grey(vm, (Obj *)closure->upvalues[i]);
 			}
 			break;
 		}
 
 		case OBJ_UPVALUE: {
-			gc_mark_value_grey(((Obj_Upvalue *)object)->closed);
+			// an open upvalue might point into a dead fiber's stack
+			gc_mark_value_grey(vm, *((Obj_Upvalue *)object)->location);
 			break;
 		}
 
 		case OBJ_CLASS: {
 			Obj_Class * lox_class = (Obj_Class *)object;
-			gc_mark_object_grey((Obj *)lox_class->name);
-			gc_mark_table_grey(&lox_class->methods);
+			gc_mark_object_grey(vm, (Obj *)lox_class->name);
+			gc_mark_table_grey(vm, &lox_class->methods);
 			break;
 		}
 
 		case OBJ_INSTANCE: {
 			Obj_Instance * instance = (Obj_Instance *)object;
-			gc_mark_object_grey((Obj *)instance->lox_class);
-			gc_mark_table_grey(&instance->table);
+			gc_mark_object_grey(vm, (Obj *)instance->lox_class);
+			gc_mark_table_grey(vm, &instance->table);
 			break;
 		}
 
 		case OBJ_BOUND_METHOD: {
 			Obj_Bound_Method * bound = (Obj_Bound_Method *)object;
-			gc_mark_value_grey(bound->receiver);
-			gc_mark_object_grey((Obj *)bound->method);
+			gc_mark_value_grey(vm, bound->receiver);
+			gc_mark_object_grey(vm, (Obj *)bound->method);
+			break;
+		}
+
+		case OBJ_LIST: {
+			Obj_List * list = (Obj_List *)object;
+			gc_mark_value_array_grey(vm, &list->values);
+			break;
+		}
+
+		case OBJ_MAP: {
+			Obj_Map * map = (Obj_Map *)object;
+			gc_mark_value_table_grey(vm, &map->table);
+			break;
+		}
+
+		case OBJ_FIBER: {
+			Obj_Fiber * fiber = (Obj_Fiber *)object;
+			for (Value * slot = fiber->stack; slot < fiber->stack_top; slot++) {
+				gc_mark_value_grey(vm, *slot);
+			}
+			for (uint32_t i = 0; i < fiber->frame_count; i++) {
+				gc_mark_object_grey(vm, fiber->frames[i].function);
+			}
+			for (Obj_Upvalue * upvalue = fiber->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+				gc_mark_object_grey(vm, (Obj *)upvalue);
+			}
+			gc_mark_object_grey(vm, (Obj *)fiber->caller);
+			gc_mark_object_grey(vm, fiber->function);
 			break;
 		}
 	}
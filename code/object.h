@@ -13,6 +13,12 @@ typedef enum {
 	OBJ_CLASS,
 	OBJ_INSTANCE,
 	OBJ_BOUND_METHOD,
+	OBJ_LIST,
+	OBJ_MAP,
+	OBJ_FLOAT_ARRAY,
+	OBJ_FIBER,
+	OBJ_CHANNEL,
+	OBJ_HANDLE,
 } Obj_Type;
 
 struct Obj {
@@ -25,21 +31,51 @@ struct Obj_String {
 	struct Obj obj;
 	uint32_t hash;
 	uint32_t length;
+	bool is_native_name;
 	char chars[FLEXIBLE_ARRAY];
 };
 
+// a function body kept as source until the first call, see `compile_body`
+struct Lazy_Body {
+	uint32_t length; // of the parameters and the body, the upvalue names follow
+	uint32_t size; // of `chars`
+	uint32_t line;
+	uint8_t type;
+	bool is_in_class;
+	bool has_superclass;
+	char chars[FLEXIBLE_ARRAY];
+};
+
+// a leaf body `call` runs without a frame, recognized by `optimize_function`
+typedef enum {
+	INLINE_NONE,
+	INLINE_CONSTANT,  // returns `inline_value`
+	INLINE_LOCAL,     // returns the first slot
+	INLINE_GET_FIELD, // returns the field `inline_value` of the first slot
+	INLINE_SET_FIELD, // sets it to the second slot, returns nil
+} Inline_Kind;
+
 struct Obj_Function {
 	struct Obj obj;
 	uint8_t arity;
+	bool is_generator; // starts with `OP_GENERATOR`
+	uint8_t inline_kind; // see `Inline_Kind`
+	uint8_t inline_slots[2];
 	uint32_t upvalue_count;
+	uint32_t stack_max; // slots a frame uses, counted by the compiler
 	struct Chunk chunk;
 	struct Obj_String * name;
+	struct Lazy_Body * lazy; // an empty chunk until compiled
+	Value inline_value; // one of the constants, or an immediate
 };
 
 struct Obj_Native {
 	struct Obj obj;
 	Native_Fn * function;
+	struct Obj_String * name;
 	uint8_t arity;
+	bool is_variadic;
+	bool is_shadowed;
 };
 
 struct Obj_Upvalue {
@@ -74,6 +110,64 @@ struct Obj_Bound_Method {
 	struct Obj_Function * method;
 };
 
+struct Obj_List {
+	struct Obj obj;
+	Value_Array values;
+};
+
+struct Obj_Map {
+	struct Obj obj;
+	Value_Table table;
+};
+
+struct Obj_Float_Array {
+	struct Obj obj;
+	uint32_t count;
+	double values[FLEXIBLE_ARRAY];
+};
+
+struct Channel;
+
+// a handle to a queue between isolates, see `isolate.c`
+struct Obj_Channel {
+	struct Obj obj;
+	struct Channel * channel; // owned by the isolate pool
+};
+
+// a file descriptor, closed when collected unless it is a standard one, see `event.h`
+struct Obj_Handle {
+	struct Obj obj;
+	int fd; // -1 once closed
+	bool is_standard;
+};
+
+typedef enum {
+	FIBER_NEW,
+	FIBER_SUSPENDED,
+	FIBER_RUNNING,
+	FIBER_WAITING, // for I/O, only the event loop resumes it
+	FIBER_DONE,
+} Fiber_State;
+
+struct Call_Frame;
+
+struct Obj_Fiber {
+	struct Obj obj;
+	Fiber_State state;
+	struct Obj_Fiber * caller;
+	struct Obj * function;
+	uint8_t * loop_exit; // set by `OP_FOR_ITER`, where the caller continues once the fiber is done
+	struct Obj_Fiber * next_fiber; // every fiber of the VM, see `gc_fibers_remove_white`
+
+	// its own execution state while suspended, the caller's one while running
+	struct Call_Frame * frames;
+	uint32_t frame_count, frame_capacity;
+	Value * stack;
+	Value * stack_top;
+	uint32_t stack_capacity;
+	struct Obj_Upvalue * open_upvalues;
+};
+
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
@@ -84,6 +178,12 @@ struct Obj_Bound_Method {
 #define IS_CLASS(value) is_obj_type(value, OBJ_CLASS)
 #define IS_INSTANCE(value) is_obj_type(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) is_obj_type(value, OBJ_BOUND_METHOD)
+#define IS_LIST(value) is_obj_type(value, OBJ_LIST)
+#define IS_MAP(value) is_obj_type(value, OBJ_MAP)
+#define IS_FLOAT_ARRAY(value) is_obj_type(value, OBJ_FLOAT_ARRAY)
+#define IS_FIBER(value) is_obj_type(value, OBJ_FIBER)
+#define IS_CHANNEL(value) is_obj_type(value, OBJ_CHANNEL)
+#define IS_HANDLE(value) is_obj_type(value, OBJ_HANDLE)
 
 #define AS_STRING(value) ((struct Obj_String *)(void *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((struct Obj_Function *)(void *)AS_OBJ(value))
@@ -93,27 +193,41 @@ struct Obj_Bound_Method {
 #define AS_CLASS(value) ((struct Obj_Class *)(void *)AS_OBJ(value))
 #define AS_INSTANCE(value) ((struct Obj_Instance *)(void *)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((struct Obj_Bound_Method *)(void *)AS_OBJ(value))
+#define AS_LIST(value) ((struct Obj_List *)(void *)AS_OBJ(value))
+#define AS_MAP(value) ((struct Obj_Map *)(void *)AS_OBJ(value))
+#define AS_FLOAT_ARRAY(value) ((struct Obj_Float_Array *)(void *)AS_OBJ(value))
+#define AS_FIBER(value) ((struct Obj_Fiber *)(void *)AS_OBJ(value))
+#define AS_CHANNEL(value) ((struct Obj_Channel *)(void *)AS_OBJ(value))
+#define AS_HANDLE(value) ((struct Obj_Handle *)(void *)AS_OBJ(value))
 
-struct Obj_String * copy_string(char const * chars, uint32_t length);
+struct Obj_String * copy_string(struct VM * vm, char const * chars, uint32_t length);
 
 inline static bool is_obj_type(Value value, Obj_Type type) {
 	return IS_OBJ(value) && OBJ_TYPE(value) == type;
 }
 
-void print_object(struct Obj * object);
-struct Obj_String * strings_concatenate(struct Obj_String * a, struct Obj_String * b);
-
-struct Obj_Function * new_function(void);
-struct Obj_Native * new_native(Native_Fn * function, uint8_t arity);
-struct Obj_Closure * new_closure(struct Obj_Function * function);
-struct Obj_Upvalue * new_upvalue(Value * slot);
-struct Obj_Class * new_class(struct Obj_String * name);
-struct Obj_Instance * new_instance(struct Obj_Class * lox_class);
-struct Obj_Bound_Method * new_bound_method(Value receiver, struct Obj_Function * method);
-
-void gc_free_object(struct Obj * object);
-
-void gc_mark_object_grey(struct Obj * object);
-void gc_mark_object_black(struct Obj * object);
+struct Output;
+
+void object_write(struct Output * output, struct Obj * object);
+struct Obj_String * strings_concatenate(struct VM * vm, struct Obj_String * a, struct Obj_String * b);
+
+struct Obj_Function * new_function(struct VM * vm);
+struct Obj_Native * new_native(struct VM * vm, struct Obj_String * name, Native_Fn * function, uint8_t arity, bool is_variadic);
+struct Obj_Closure * new_closure(struct VM * vm, struct Obj_Function * function);
+struct Obj_Upvalue * new_upvalue(struct VM * vm, Value * slot);
+struct Obj_Class * new_class(struct VM * vm, struct Obj_String * name);
+struct Obj_Instance * new_instance(struct VM * vm, struct Obj_Class * lox_class);
+struct Obj_Bound_Method * new_bound_method(struct VM * vm, Value receiver, struct Obj_Function * method);
+struct Obj_List * new_list(struct VM * vm);
+struct Obj_Map * new_map(struct VM * vm);
+struct Obj_Float_Array * new_float_array(struct VM * vm, uint32_t count);
+struct Obj_Fiber * new_fiber(struct VM * vm, struct Obj * function, Value * args, uint8_t arg_count);
+struct Obj_Channel * new_channel(struct VM * vm, struct Channel * channel);
+struct Obj_Handle * new_handle(struct VM * vm, int fd, bool is_standard);
+
+void gc_free_object(struct VM * vm, struct Obj * object);
+
+void gc_mark_object_grey(struct VM * vm, struct Obj * object);
+void gc_mark_object_black(struct VM * vm, struct Obj * object);
 
 #endif
@@ -0,0 +1,1232 @@
+#include <string.h>
+
+#include "object.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "vm.h"
+
+typedef struct VM VM;
+typedef struct Obj_Function Obj_Function;
+typedef struct Chunk Chunk;
+
+#define OPTIMIZER_ROUNDS 8
+#define NO_INDEX UINT32_MAX
+
+// an instruction with its `OP_WIDE` prefix folded in
+typedef struct {
+	uint8_t op;
+	uint8_t arg;       // an argument count, or the slot of `OP_FOR_ITER`
+	bool is_dead;      // dropped by `ir_compact`
+	bool is_target;    // a jump lands here, see `ir_mark_targets`
+	bool is_wide;      // a jump too long for 16 bits, see `ir_lower`
+	uint32_t operand;  // a slot, a constant, a native or the index of a jump target
+	uint32_t line;
+	uint32_t upvalues; // offset of the `OP_CLOSURE` pairs in the original code
+	uint32_t depth;    // stack slots in use before it runs, see `ir_analyze`
+} Ir_Op;
+
+typedef enum {
+	SLOT_UNKNOWN,
+	SLOT_CONSTANT,
+	SLOT_COPY, // of another slot, which hasn't changed since
+} Slot_Kind;
+
+typedef struct {
+	Slot_Kind kind;
+	uint32_t slot;
+	Value value;
+} Slot;
+
+typedef struct {
+	Slot * slots;
+	uint32_t depth, capacity;
+} Stack_State;
+
+typedef struct {
+	uint32_t start, end;
+	uint32_t depth; // on entry, `NO_INDEX` while unreached
+	Slot * slots;   // on entry
+	uint64_t * live;
+	bool is_pending; // the entry changed since the block was walked
+} Block;
+
+typedef struct {
+	VM * vm;
+	Obj_Function * function;
+	Ir_Op * ops;
+	uint32_t count, capacity;
+	Block * blocks;
+	uint32_t block_count, block_capacity;
+	uint32_t * block_of; // per op, sized like `ops`
+	uint32_t depth_max;
+	Value_Table constants; // filled on demand, see `ir_constant`
+	bool captured[LOCALS_MAX]; // slots closed over are never tracked
+	bool is_changed;
+} Ir;
+
+// -- instructions
+
+typedef enum {
+	FORMAT_SIMPLE,
+	FORMAT_BYTE,     // a slot or a count
+	FORMAT_CONSTANT, // widened past 255
+	FORMAT_INVOKE,   // a constant and an argument count
+	FORMAT_NATIVE,   // a native and an argument count
+	FORMAT_CLOSURE,  // a constant and the upvalue pairs
+	FORMAT_JUMP,     // widened past 16 bits
+	FORMAT_FOR_ITER, // a slot and a jump
+} Format;
+
+static Format op_format(uint8_t op) {
+	switch (op) {
+		case OP_SET_LOCAL:
+		case OP_GET_LOCAL:
+		case OP_SET_UPVALUE:
+		case OP_GET_UPVALUE:
+		case OP_CALL:
+		case OP_TAIL_CALL:
+		case OP_LIST:
+		case OP_ADD_LOCAL:
+		case OP_SUBTRACT_LOCAL:
+		case OP_LESS_LOCAL:
+		case OP_GREATER_LOCAL:
+			return FORMAT_BYTE;
+
+		case OP_CONSTANT:
+		case OP_SET_GLOBAL:
+		case OP_GET_GLOBAL:
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_PROPERTY:
+		case OP_GET_PROPERTY:
+		case OP_CLASS:
+		case OP_METHOD:
+		case OP_GET_SUPER:
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_LESS_CONSTANT:
+		case OP_GREATER_CONSTANT:
+			return FORMAT_CONSTANT;
+
+		case OP_INVOKE:
+		case OP_SUPER_INVOKE:
+			return FORMAT_INVOKE;
+
+		case OP_CALL_NATIVE: return FORMAT_NATIVE;
+		case OP_CLOSURE:     return FORMAT_CLOSURE;
+
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_LOOP:
+			return FORMAT_JUMP;
+
+		case OP_FOR_ITER: return FORMAT_FOR_ITER;
+	}
+	return FORMAT_SIMPLE;
+}
+
+static bool is_jump(uint8_t op) {
+	return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP || op == OP_FOR_ITER;
+}
+
+static bool ends_block(uint8_t op) {
+	return is_jump(op) || op == OP_RETURN;
+}
+
+static bool is_push_constant(uint8_t op) {
+	return op == OP_NIL || op == OP_TRUE || op == OP_FALSE || op == OP_CONSTANT;
+}
+
+// pushes without side effects
+static bool is_pure_push(uint8_t op) {
+	return is_push_constant(op) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE;
+}
+
+// the plain form of a fused operator, see `REGISTER_OPERANDS`
+static uint8_t binary_of(uint8_t op) {
+	switch (op) {
+		case OP_ADD_LOCAL:         case OP_ADD_CONSTANT:      return OP_ADD;
+		case OP_SUBTRACT_LOCAL:    case OP_SUBTRACT_CONSTANT: return OP_SUBTRACT;
+		case OP_LESS_LOCAL:        case OP_LESS_CONSTANT:     return OP_LESS;
+		case OP_GREATER_LOCAL:     case OP_GREATER_CONSTANT:  return OP_GREATER;
+	}
+	return op;
+}
+
+static bool is_binary(uint8_t op) {
+	switch (op) {
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+			return true;
+	}
+	return false;
+}
+
+static bool is_fused_constant(uint8_t op) {
+	return op == OP_ADD_CONSTANT || op == OP_SUBTRACT_CONSTANT || op == OP_LESS_CONSTANT || op == OP_GREATER_CONSTANT;
+}
+
+// how many slots below the top an instruction reads, pops and then pushes;
+// `OP_GENERATOR` and `OP_FOR_ITER` reach further, see `ir_transfer`
+static void op_stack_effect(Ir_Op const * op, uint32_t * reads, uint32_t * pops, uint32_t * pushes) {
+	uint32_t r = 0, p = 0, q = 0;
+	switch (op->op) {
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+		case OP_CONSTANT:
+		case OP_GET_GLOBAL:
+		case OP_GET_UPVALUE:
+		case OP_GET_LOCAL:
+		case OP_CLOSURE:
+		case OP_CLASS:
+			q = 1; break;
+
+		case OP_POP:           p = 1; break;
+		case OP_CLOSE_UPVALUE: r = 1; p = 1; break;
+
+		case OP_SET_LOCAL:
+		case OP_SET_GLOBAL:
+		case OP_SET_UPVALUE:
+		case OP_JUMP_IF_FALSE:
+			r = 1; break;
+
+		case OP_DEFINE_GLOBAL: r = 1; p = 1; break;
+		case OP_SET_PROPERTY:  r = 2; p = 2; q = 1; break;
+		case OP_GET_PROPERTY:  r = 1; p = 1; q = 1; break;
+		case OP_SET_INDEX:     r = 3; p = 3; q = 1; break;
+		case OP_GET_INDEX:     r = 2; p = 2; q = 1; break;
+
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_GET_SUPER:
+			r = 2; p = 2; q = 1; break;
+
+		case OP_ADD_LOCAL:
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_LOCAL:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_LESS_LOCAL:
+		case OP_LESS_CONSTANT:
+		case OP_GREATER_LOCAL:
+		case OP_GREATER_CONSTANT:
+		case OP_NOT:
+		case OP_NEGATE:
+		case OP_YIELD:
+			r = 1; p = 1; q = 1; break;
+
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			r = op->operand + 1; p = r; q = 1; break;
+
+		case OP_CALL_NATIVE:
+		case OP_INVOKE:
+			r = op->arg + 1u; p = r; q = 1; break;
+
+		case OP_SUPER_INVOKE: r = op->arg + 2u; p = r; q = 1; break;
+		case OP_LIST:         r = op->operand; p = r; q = 1; break;
+
+		case OP_METHOD:
+		case OP_INHERIT:
+			r = 2; p = 1; break;
+
+		case OP_RETURN: r = 1; p = 1; break;
+	}
+	*reads = r;
+	*pops = p;
+	*pushes = q;
+}
+
+// -- decoding
+
+static void ir_add(Ir * ir, Ir_Op op) {
+	if (ir->capacity < ir->count + 1) {
+		uint32_t old_capacity = ir->capacity;
+		ir->capacity = GROW_CAPACITY(old_capacity);
+		ir->ops = GROW_ARRAY(ir->vm, ir->ops, old_capacity, ir->capacity);
+	}
+	ir->ops[ir->count++] = op;
+}
+
+static bool ir_decode(Ir * ir) {
+	Chunk * chunk = &ir->function->chunk;
+	uint8_t const * code = chunk->code;
+	uint32_t count = chunk->count;
+
+	// jumps are decoded to offsets, then mapped to the instructions there
+	uint32_t * index_of = NULL;
+	index_of = GROW_ARRAY(ir->vm, index_of, 0, count + 1);
+	for (uint32_t i = 0; i <= count; i++) { index_of[i] = NO_INDEX; }
+
+	bool is_ok = true;
+	uint32_t offset = 0;
+	while (is_ok && offset < count) {
+		uint32_t start = offset;
+		uint32_t wide = 0;
+		if (code[offset] == OP_WIDE) {
+			if (offset + 3 >= count) { is_ok = false; break; }
+			wide = (uint32_t)(code[offset + 1] << 8) | code[offset + 2];
+			offset += 3;
+		}
+
+		Ir_Op op = {.op = code[offset], .line = chunk_get_line(chunk, start)};
+		uint32_t size = 1;
+		switch (op_format(op.op)) {
+			case FORMAT_SIMPLE: break;
+			case FORMAT_BYTE:     size = 2; break;
+			case FORMAT_CONSTANT: size = 2; break;
+			case FORMAT_INVOKE:   size = 3; break;
+			case FORMAT_NATIVE:   size = 3; break;
+			case FORMAT_CLOSURE:  size = 2; break;
+			case FORMAT_JUMP:     size = 3; break;
+			case FORMAT_FOR_ITER: size = 4; break;
+		}
+		if (op.op == OP_WIDE || offset + size > count) { is_ok = false; break; }
+
+		uint8_t const * operands = code + offset + 1;
+		switch (op_format(op.op)) {
+			case FORMAT_SIMPLE: break;
+			case FORMAT_BYTE: op.operand = operands[0]; break;
+			case FORMAT_CONSTANT: op.operand = (wide << 8) | operands[0]; break;
+			case FORMAT_INVOKE:
+				op.operand = (wide << 8) | operands[0];
+				op.arg = operands[1];
+				break;
+			case FORMAT_NATIVE:
+				op.operand = operands[0];
+				op.arg = operands[1];
+				break;
+			case FORMAT_CLOSURE: {
+				op.operand = (wide << 8) | operands[0];
+				if (op.operand >= chunk->constants.count || !IS_FUNCTION(chunk->constants.values[op.operand])) {
+					is_ok = false;
+					break;
+				}
+				uint32_t upvalue_count = AS_FUNCTION(chunk->constants.values[op.operand])->upvalue_count;
+				op.upvalues = offset + 2;
+				size += upvalue_count * 2;
+				if (offset + size > count) { is_ok = false; break; }
+				for (uint32_t i = 0; i < upvalue_count; i++) {
+					if (code[op.upvalues + i * 2 + 1]) { ir->captured[code[op.upvalues + i * 2]] = true; }
+				}
+				break;
+			}
+			case FORMAT_JUMP: {
+				uint32_t jump = (wide << 16) | (uint32_t)(operands[0] << 8) | operands[1];
+				uint32_t end = offset + size;
+				if (op.op == OP_LOOP) { op.operand = jump <= end ? end - jump : NO_INDEX; }
+				else { op.operand = jump <= count - end ? end + jump : NO_INDEX; }
+				break;
+			}
+			case FORMAT_FOR_ITER: {
+				uint32_t jump = (wide << 16) | (uint32_t)(operands[1] << 8) | operands[2];
+				uint32_t end = offset + size;
+				op.arg = operands[0];
+				op.operand = jump <= count - end ? end + jump : NO_INDEX;
+				break;
+			}
+		}
+		if (!is_ok) { break; }
+		if (op_format(op.op) == FORMAT_CONSTANT || op_format(op.op) == FORMAT_INVOKE) {
+			if (op.operand >= chunk->constants.count) { is_ok = false; break; }
+		}
+
+		index_of[start] = ir->count;
+		ir_add(ir, op);
+		offset += size;
+	}
+
+	for (uint32_t i = 0; is_ok && i < ir->count; i++) {
+		Ir_Op * op = &ir->ops[i];
+		if (!is_jump(op->op)) { continue; }
+		if (op->operand == NO_INDEX || index_of[op->operand] == NO_INDEX) { is_ok = false; break; }
+		op->operand = index_of[op->operand];
+		// only loops go back
+		if ((op->op == OP_LOOP) != (op->operand <= i)) { is_ok = false; }
+	}
+
+	FREE_ARRAY(ir->vm, index_of, count + 1);
+	return is_ok && ir->count > 0;
+}
+
+// -- values
+
+static bool values_identical(Value a, Value b) {
+#if defined(NAN_BOXING)
+	return a == b;
+#else
+	if (a.type != b.type) { return false; }
+	if (a.type == VAL_NUMBER) { return memcmp(&a.as.number, &b.as.number, sizeof(a.as.number)) == 0; }
+	return values_equal(a, b);
+#endif // NAN_BOXING
+}
+
+// mirrors the VM, and gives up wherever it would allocate or report an error
+static bool fold_binary(uint8_t op, Value a, Value b, Value * result) {
+	if (op == OP_EQUAL) {
+		*result = TO_BOOL(values_equal(a, b));
+		return true;
+	}
+	if (!IS_NUMBER(a) || !IS_NUMBER(b)) { return false; }
+
+	if (IS_INT(a) && IS_INT(b)) {
+		int64_t x = AS_INT(a), y = AS_INT(b);
+		switch (op) {
+			case OP_ADD:      *result = int64_to_value(x + y); return true;
+			case OP_SUBTRACT: *result = int64_to_value(x - y); return true;
+			case OP_LESS:     *result = TO_BOOL(x < y); return true;
+			case OP_GREATER:  *result = TO_BOOL(x > y); return true;
+			case OP_MULTIPLY:
+				// `-1 * 0` is a `-0` double
+				if ((x < 0 || y < 0) && (x == 0 || y == 0)) { break; }
+				*result = int64_to_value(x * y);
+				return true;
+		}
+	}
+
+	double x = AS_NUMBER(a), y = AS_NUMBER(b);
+	switch (op) {
+		case OP_ADD:      *result = TO_NUMBER(x + y); return true;
+		case OP_SUBTRACT: *result = TO_NUMBER(x - y); return true;
+		case OP_MULTIPLY: *result = TO_NUMBER(x * y); return true;
+		case OP_DIVIDE:   *result = TO_NUMBER(x / y); return true;
+		case OP_LESS:     *result = TO_BOOL(x < y); return true;
+		case OP_GREATER:  *result = TO_BOOL(x > y); return true;
+	}
+	return false;
+}
+
+static bool fold_unary(uint8_t op, Value value, Value * result) {
+	if (op == OP_NOT) {
+		*result = TO_BOOL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)));
+		return true;
+	}
+	if (!IS_NUMBER(value)) { return false; }
+	if (IS_INT(value) && AS_INT(value) != 0 && AS_INT(value) != INT32_MIN) {
+		*result = TO_INT(-AS_INT(value));
+		return true;
+	}
+	*result = TO_NUMBER(-AS_NUMBER(value));
+	return true;
+}
+
+static Value ir_push_value(Ir * ir, Ir_Op const * op) {
+	switch (op->op) {
+		case OP_TRUE:  return TO_BOOL(true);
+		case OP_FALSE: return TO_BOOL(false);
+		case OP_CONSTANT: return ir->function->chunk.constants.values[op->operand];
+	}
+	return TO_NIL();
+}
+
+// an index into the pool, which only keeps numbers, strings and functions
+static uint32_t ir_constant(Ir * ir, Value value) {
+	if (!IS_NUMBER(value) && !IS_STRING(value)) { return NO_INDEX; }
+
+	Chunk * chunk = &ir->function->chunk;
+	if (ir->constants.count == 0) {
+		for (uint32_t i = 0; i < chunk->constants.count; i++) {
+			Value constant = chunk->constants.values[i];
+			Value index;
+			if (!IS_NUMBER(constant) && !IS_STRING(constant)) { continue; }
+			if (value_table_get(&ir->constants, constant, &index)) { continue; }
+			value_table_set(ir->vm, &ir->constants, constant, TO_INT((int32_t)i));
+		}
+	}
+
+	// the table treats `1.0` and `1` as the same key
+	Value index;
+	if (value_table_get(&ir->constants, value, &index)) {
+		uint32_t constant = (uint32_t)AS_INT(index);
+		if (values_identical(chunk->constants.values[constant], value)) { return constant; }
+	}
+
+	if (chunk->constants.count >= CONSTANTS_MAX) { return NO_INDEX; }
+	uint32_t constant = chunk_add_constant(ir->vm, chunk, value);
+	if (!value_table_get(&ir->constants, value, &index)) {
+		value_table_set(ir->vm, &ir->constants, value, TO_INT((int32_t)constant));
+	}
+	return constant;
+}
+
+// turns an instruction into a push of the value
+static bool ir_set_constant(Ir * ir, Ir_Op * op, Value value) {
+	if (IS_NIL(value)) { op->op = OP_NIL; op->operand = 0; }
+	else if (IS_BOOL(value)) { op->op = AS_BOOL(value) ? OP_TRUE : OP_FALSE; op->operand = 0; }
+	else {
+		uint32_t constant = ir_constant(ir, value);
+		if (constant == NO_INDEX) { return false; }
+		op->op = OP_CONSTANT;
+		op->operand = constant;
+	}
+	ir->is_changed = true;
+	return true;
+}
+
+// -- layout
+
+static void ir_mark_targets(Ir * ir) {
+	for (uint32_t i = 0; i < ir->count; i++) { ir->ops[i].is_target = false; }
+	for (uint32_t i = 0; i < ir->count; i++) {
+		Ir_Op * op = &ir->ops[i];
+		if (!op->is_dead && is_jump(op->op)) { ir->ops[op->operand].is_target = true; }
+	}
+}
+
+// the first live instruction at or after the index
+static uint32_t ir_live_from(Ir * ir, uint32_t index) {
+	while (index < ir->count && ir->ops[index].is_dead) { index++; }
+	return index;
+}
+
+static uint32_t ir_live_before(Ir * ir, uint32_t index) {
+	while (index > 0) {
+		index--;
+		if (!ir->ops[index].is_dead) { return index; }
+	}
+	return NO_INDEX;
+}
+
+// jumps to a dead instruction land on the next live one
+static bool ir_compact(Ir * ir) {
+	uint32_t * index_of = NULL;
+	index_of = GROW_ARRAY(ir->vm, index_of, 0, ir->count + 1);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < ir->count; i++) {
+		index_of[i] = count;
+		if (!ir->ops[i].is_dead) { ir->ops[count++] = ir->ops[i]; }
+	}
+	index_of[ir->count] = count;
+
+	bool is_ok = true;
+	for (uint32_t i = 0; i < count; i++) {
+		Ir_Op * op = &ir->ops[i];
+		if (!is_jump(op->op)) { continue; }
+		op->operand = index_of[op->operand];
+		if (op->operand >= count) { is_ok = false; }
+	}
+
+	FREE_ARRAY(ir->vm, index_of, ir->count + 1);
+	ir->count = count;
+	return is_ok && count > 0;
+}
+
+// -- blocks
+
+static void ir_free_blocks(Ir * ir) {
+	uint32_t words = (ir->depth_max + 63) / 64;
+	for (uint32_t i = 0; i < ir->block_count; i++) {
+		Block * block = &ir->blocks[i];
+		if (block->slots != NULL) { FREE_ARRAY(ir->vm, block->slots, block->depth); }
+		if (block->live != NULL) { FREE_ARRAY(ir->vm, block->live, words); }
+	}
+	ir->block_count = 0;
+}
+
+static void ir_build_blocks(Ir * ir) {
+	ir_free_blocks(ir);
+	ir_mark_targets(ir);
+
+	for (uint32_t i = 0; i < ir->count; i++) {
+		if (i == 0 || ir->ops[i].is_target || ends_block(ir->ops[i - 1].op)) {
+			if (ir->block_capacity < ir->block_count + 1) {
+				uint32_t old_capacity = ir->block_capacity;
+				ir->block_capacity = GROW_CAPACITY(old_capacity);
+				ir->blocks = GROW_ARRAY(ir->vm, ir->blocks, old_capacity, ir->block_capacity);
+			}
+			ir->blocks[ir->block_count++] = (Block){.start = i, .depth = NO_INDEX};
+		}
+		ir->blocks[ir->block_count - 1].end = i + 1;
+		ir->block_of[i] = ir->block_count - 1;
+	}
+}
+
+// instruction indices, `NO_INDEX` when the code runs off its end
+static uint32_t ir_successors(Ir * ir, uint32_t last, uint32_t successors[2]) {
+	Ir_Op * op = &ir->ops[last];
+	uint32_t next = last + 1 < ir->count ? last + 1 : NO_INDEX;
+	switch (op->op) {
+		case OP_RETURN: return 0;
+		case OP_JUMP:
+		case OP_LOOP:
+			successors[0] = op->operand;
+			return 1;
+		case OP_JUMP_IF_FALSE:
+		case OP_FOR_ITER:
+			successors[0] = next;
+			successors[1] = op->operand;
+			return 2;
+	}
+	successors[0] = next;
+	return 1;
+}
+
+// -- constants and copies
+
+static Slot slot_unknown(void) {
+	return (Slot){.kind = SLOT_UNKNOWN};
+}
+
+static Slot slot_constant(Value value) {
+	return (Slot){.kind = SLOT_CONSTANT, .value = value};
+}
+
+static bool slots_same(Slot a, Slot b) {
+	if (a.kind != b.kind) { return false; }
+	if (a.kind == SLOT_CONSTANT) { return values_identical(a.value, b.value); }
+	if (a.kind == SLOT_COPY) { return a.slot == b.slot; }
+	return true;
+}
+
+// whatever was copied from the slot is on its own now
+static void state_invalidate(Stack_State * state, uint32_t slot) {
+	for (uint32_t i = 0; i < state->depth; i++) {
+		if (state->slots[i].kind == SLOT_COPY && state->slots[i].slot == slot) {
+			state->slots[i] = slot_unknown();
+		}
+	}
+}
+
+static void state_push(Ir * ir, Stack_State * state, Slot slot) {
+	if (state->capacity < state->depth + 1) {
+		uint32_t old_capacity = state->capacity;
+		state->capacity = GROW_CAPACITY(old_capacity);
+		state->slots = GROW_ARRAY(ir->vm, state->slots, old_capacity, state->capacity);
+	}
+	if (state->depth < LOCALS_MAX && ir->captured[state->depth]) { slot = slot_unknown(); }
+	state->slots[state->depth++] = slot;
+	if (ir->depth_max < state->depth) { ir->depth_max = state->depth; }
+}
+
+static Slot state_pop(Stack_State * state) {
+	Slot slot = state->slots[--state->depth];
+	state_invalidate(state, state->depth);
+	return slot;
+}
+
+// what reading the slot yields
+static Slot state_load(Ir * ir, Stack_State * state, uint32_t slot) {
+	if (slot < LOCALS_MAX && ir->captured[slot]) { return slot_unknown(); }
+	Slot value = state->slots[slot];
+	if (value.kind == SLOT_UNKNOWN) { return (Slot){.kind = SLOT_COPY, .slot = slot}; }
+	return value;
+}
+
+static void state_store(Ir * ir, Stack_State * state, uint32_t slot, Slot value) {
+	if (slot < LOCALS_MAX && ir->captured[slot]) {
+		state->slots[slot] = slot_unknown();
+		return;
+	}
+	if (value.kind == SLOT_COPY && value.slot == slot) { return; }
+	state_invalidate(state, slot);
+	state->slots[slot] = value;
+}
+
+static void state_binary(Ir * ir, Stack_State * state, uint8_t op, Slot right) {
+	Slot left = state_pop(state);
+	Value result;
+	if (left.kind == SLOT_CONSTANT && right.kind == SLOT_CONSTANT && fold_binary(op, left.value, right.value, &result)) {
+		state_push(ir, state, slot_constant(result));
+	}
+	else {
+		state_push(ir, state, slot_unknown());
+	}
+}
+
+// false when the code doesn't fit the stack
+static bool ir_transfer(Ir * ir, Ir_Op * op, Stack_State * state) {
+	Value * constants = ir->function->chunk.constants.values;
+	uint32_t depth = state->depth;
+	switch (op->op) {
+		case OP_NIL:   state_push(ir, state, slot_constant(TO_NIL())); return true;
+		case OP_TRUE:  state_push(ir, state, slot_constant(TO_BOOL(true))); return true;
+		case OP_FALSE: state_push(ir, state, slot_constant(TO_BOOL(false))); return true;
+		case OP_CONSTANT: state_push(ir, state, slot_constant(constants[op->operand])); return true;
+
+		case OP_GET_LOCAL:
+			if (op->operand >= depth) { return false; }
+			state_push(ir, state, state_load(ir, state, op->operand));
+			return true;
+
+		case OP_SET_LOCAL:
+			if (op->operand >= depth) { return false; }
+			state_store(ir, state, op->operand, state->slots[depth - 1]);
+			return true;
+
+		case OP_ADD_LOCAL:
+		case OP_SUBTRACT_LOCAL:
+		case OP_LESS_LOCAL:
+		case OP_GREATER_LOCAL:
+			if (op->operand >= depth) { return false; }
+			state_binary(ir, state, binary_of(op->op), state_load(ir, state, op->operand));
+			return true;
+
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_LESS_CONSTANT:
+		case OP_GREATER_CONSTANT:
+			if (depth < 1) { return false; }
+			state_binary(ir, state, binary_of(op->op), slot_constant(constants[op->operand]));
+			return true;
+
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE: {
+			if (depth < 2) { return false; }
+			Slot right = state_pop(state);
+			state_binary(ir, state, op->op, right);
+			return true;
+		}
+
+		case OP_NOT:
+		case OP_NEGATE: {
+			if (depth < 1) { return false; }
+			Slot value = state_pop(state);
+			Value result;
+			bool is_folded = value.kind == SLOT_CONSTANT && fold_unary(op->op, value.value, &result);
+			state_push(ir, state, is_folded ? slot_constant(result) : slot_unknown());
+			return true;
+		}
+
+		// the element is pushed on the way into the loop, see `ir_analyze`
+		case OP_FOR_ITER:
+			if (op->arg + 1u >= depth) { return false; }
+			state_store(ir, state, op->arg + 1u, slot_unknown());
+			return true;
+
+		case OP_GENERATOR: return true;
+	}
+
+	uint32_t reads, pops, pushes;
+	op_stack_effect(op, &reads, &pops, &pushes);
+	if (reads > depth || pops > depth) { return false; }
+	for (uint32_t i = 0; i < pops; i++) { state_pop(state); }
+	for (uint32_t i = 0; i < pushes; i++) { state_push(ir, state, slot_unknown()); }
+	return true;
+}
+
+// reads of known slots become constants or reads of the original
+static void ir_rewrite(Ir * ir, Ir_Op * op, Stack_State * state) {
+	switch (op->op) {
+		case OP_GET_LOCAL:
+		case OP_ADD_LOCAL:
+		case OP_SUBTRACT_LOCAL:
+		case OP_LESS_LOCAL:
+		case OP_GREATER_LOCAL: {
+			if (op->operand >= state->depth) { return; }
+			Slot value = state_load(ir, state, op->operand);
+			if (value.kind == SLOT_COPY && value.slot != op->operand) {
+				op->operand = value.slot;
+				ir->is_changed = true;
+			}
+			else if (value.kind == SLOT_CONSTANT && op->op == OP_GET_LOCAL) {
+				ir_set_constant(ir, op, value.value);
+			}
+			else if (value.kind == SLOT_CONSTANT) {
+				uint32_t constant = ir_constant(ir, value.value);
+				if (constant == NO_INDEX) { return; }
+				op->op = (uint8_t)(op->op + 1); // the `_CONSTANT` form follows
+				op->operand = constant;
+				ir->is_changed = true;
+			}
+			return;
+		}
+
+		case OP_JUMP_IF_FALSE: {
+			if (state->depth < 1) { return; }
+			Slot value = state->slots[state->depth - 1];
+			if (value.kind != SLOT_CONSTANT) { return; }
+			if (IS_NIL(value.value) || (IS_BOOL(value.value) && !AS_BOOL(value.value))) { op->op = OP_JUMP; }
+			else { op->is_dead = true; }
+			ir->is_changed = true;
+			return;
+		}
+	}
+}
+
+// false when the paths disagree on the depth
+static bool block_merge(Ir * ir, Block * block, Stack_State * state) {
+	if (block->depth == NO_INDEX) {
+		block->depth = state->depth;
+		block->slots = GROW_ARRAY(ir->vm, block->slots, 0, state->depth);
+		memcpy(block->slots, state->slots, sizeof(*state->slots) * state->depth);
+		block->is_pending = true;
+		return true;
+	}
+	if (block->depth != state->depth) { return false; }
+
+	for (uint32_t i = 0; i < block->depth; i++) {
+		Slot * slot = &block->slots[i];
+		if (slot->kind != SLOT_UNKNOWN && !slots_same(*slot, state->slots[i])) {
+			*slot = slot_unknown();
+			block->is_pending = true;
+		}
+	}
+	return true;
+}
+
+static void state_enter(Ir * ir, Stack_State * state, Block * block) {
+	state->depth = 0;
+	for (uint32_t i = 0; i < block->depth; i++) { state_push(ir, state, block->slots[i]); }
+}
+
+// a forward pass over the paths through the function, to a fixed point;
+// sets the depth of each instruction, removes the unreachable ones and,
+// if asked, rewrites what the known slots allow
+static bool ir_analyze(Ir * ir, bool is_rewriting) {
+	ir_build_blocks(ir);
+
+	Stack_State state = {.slots = NULL};
+	for (uint32_t i = 0; i <= ir->function->arity; i++) { state_push(ir, &state, slot_unknown()); }
+	block_merge(ir, &ir->blocks[0], &state);
+
+	// sweeps in order until no entry changes; loops take a few
+	bool is_ok = true, is_pending = true;
+	while (is_ok && is_pending) {
+		is_pending = false;
+		for (uint32_t b = 0; is_ok && b < ir->block_count; b++) {
+			Block * block = &ir->blocks[b];
+			if (!block->is_pending) { continue; }
+			block->is_pending = false;
+
+			state_enter(ir, &state, block);
+			for (uint32_t i = block->start; is_ok && i < block->end; i++) {
+				ir->ops[i].depth = state.depth;
+				is_ok = ir_transfer(ir, &ir->ops[i], &state);
+			}
+			if (!is_ok) { break; }
+
+			uint32_t last = block->end - 1;
+			uint32_t successors[2];
+			uint32_t count = ir_successors(ir, last, successors);
+			for (uint32_t i = 0; is_ok && i < count; i++) {
+				if (successors[i] == NO_INDEX) { is_ok = false; break; }
+				uint32_t target = ir->block_of[successors[i]];
+				if (ir->ops[last].op == OP_FOR_ITER && i == 0) {
+					state_push(ir, &state, slot_unknown());
+					is_ok = block_merge(ir, &ir->blocks[target], &state);
+					state_pop(&state);
+				}
+				else {
+					is_ok = block_merge(ir, &ir->blocks[target], &state);
+				}
+				if (target <= b && ir->blocks[target].is_pending) { is_pending = true; }
+			}
+		}
+	}
+
+	for (uint32_t b = 0; is_ok && b < ir->block_count; b++) {
+		Block * block = &ir->blocks[b];
+		if (block->depth == NO_INDEX) {
+			for (uint32_t i = block->start; i < block->end; i++) { ir->ops[i].is_dead = true; }
+			ir->is_changed = true;
+			continue;
+		}
+		if (!is_rewriting) { continue; }
+
+		state_enter(ir, &state, block);
+		for (uint32_t i = block->start; i < block->end; i++) {
+			ir_rewrite(ir, &ir->ops[i], &state);
+			ir_transfer(ir, &ir->ops[i], &state);
+		}
+	}
+
+	FREE_ARRAY(ir->vm, state.slots, state.capacity);
+	return is_ok;
+}
+
+// -- peephole
+
+// folds constant operands and drops values that are pushed to be popped
+static void ir_fold(Ir * ir) {
+	ir_mark_targets(ir);
+	for (uint32_t i = 0; i < ir->count; i++) {
+		Ir_Op * op = &ir->ops[i];
+		if (op->is_dead || op->is_target) { continue; }
+
+		uint32_t previous = ir_live_before(ir, i);
+		if (previous == NO_INDEX) { continue; }
+		Ir_Op * right = &ir->ops[previous];
+
+		if (op->op == OP_POP && is_pure_push(right->op)) {
+			right->is_dead = true;
+			op->is_dead = true;
+			if (i + 1 < ir->count) { ir->ops[i + 1].is_target |= right->is_target; }
+			ir->is_changed = true;
+			continue;
+		}
+		if (!is_push_constant(right->op)) { continue; }
+
+		Value result;
+		bool is_folded = false;
+		uint32_t first = previous;
+		if (op->op == OP_NOT || op->op == OP_NEGATE) {
+			is_folded = fold_unary(op->op, ir_push_value(ir, right), &result);
+		}
+		else if (is_fused_constant(op->op)) {
+			Value constant = ir->function->chunk.constants.values[op->operand];
+			is_folded = fold_binary(binary_of(op->op), ir_push_value(ir, right), constant, &result);
+		}
+		else if (is_binary(op->op) && !right->is_target) {
+			first = ir_live_before(ir, previous);
+			if (first == NO_INDEX || !is_push_constant(ir->ops[first].op)) { continue; }
+			is_folded = fold_binary(op->op, ir_push_value(ir, &ir->ops[first]), ir_push_value(ir, right), &result);
+		}
+		if (!is_folded || !ir_set_constant(ir, op, result)) { continue; }
+
+		op->is_target = ir->ops[first].is_target;
+		ir->ops[first].is_dead = true;
+		right->is_dead = true;
+	}
+}
+
+// drops jumps that go nowhere and follows jumps to jumps
+static void ir_thread(Ir * ir) {
+	for (uint32_t i = 0; i < ir->count; i++) {
+		Ir_Op * op = &ir->ops[i];
+		if (op->is_dead || (op->op != OP_JUMP && op->op != OP_JUMP_IF_FALSE)) { continue; }
+
+		uint32_t target = op->operand;
+		for (uint32_t hops = 0; hops < OPTIMIZER_ROUNDS; hops++) {
+			uint32_t next = ir_live_from(ir, target);
+			if (next >= ir->count || ir->ops[next].op != OP_JUMP || ir->ops[next].operand <= next) { break; }
+			target = ir->ops[next].operand;
+		}
+		if (target != op->operand) {
+			op->operand = target;
+			ir->is_changed = true;
+		}
+
+		// the condition is only peeked at
+		if (ir_live_from(ir, target) == ir_live_from(ir, i + 1)) {
+			op->is_dead = true;
+			ir->is_changed = true;
+		}
+	}
+}
+
+// -- dead stores
+
+static void live_set(uint64_t * live, uint32_t slot, bool is_live) {
+	if (is_live) { live[slot / 64] |= (uint64_t)1 << (slot % 64); }
+	else { live[slot / 64] &= ~((uint64_t)1 << (slot % 64)); }
+}
+
+static bool live_get(uint64_t const * live, uint32_t slot) {
+	return (live[slot / 64] >> (slot % 64)) & 1;
+}
+
+// the slots read before they are written, from the state after the instruction
+static void live_transfer(Ir_Op const * op, uint64_t * live, uint32_t words) {
+	uint32_t depth = op->depth;
+	switch (op->op) {
+		case OP_SET_LOCAL:
+			live_set(live, op->operand, false);
+			live_set(live, depth - 1, true);
+			return;
+
+		case OP_GET_LOCAL:
+			live_set(live, depth, false);
+			live_set(live, op->operand, true);
+			return;
+
+		case OP_ADD_LOCAL:
+		case OP_SUBTRACT_LOCAL:
+		case OP_LESS_LOCAL:
+		case OP_GREATER_LOCAL:
+			live_set(live, depth - 1, true);
+			live_set(live, op->operand, true);
+			return;
+
+		case OP_FOR_ITER:
+			live_set(live, depth, false);
+			live_set(live, op->arg, true);
+			live_set(live, op->arg + 1u, true);
+			return;
+
+		case OP_GENERATOR:
+			for (uint32_t i = 0; i < depth; i++) { live_set(live, i, true); }
+			return;
+
+		case OP_RETURN:
+			memset(live, 0, sizeof(*live) * words);
+			live_set(live, depth - 1, true);
+			return;
+	}
+
+	uint32_t reads, pops, pushes;
+	op_stack_effect(op, &reads, &pops, &pushes);
+	for (uint32_t i = 0; i < pushes; i++) { live_set(live, depth - pops + i, false); }
+	for (uint32_t i = 0; i < reads; i++) { live_set(live, depth - reads + i, true); }
+}
+
+// one backward sweep over the blocks, true if an entry set changed;
+// the last one drops `SET_LOCAL; POP` of slots no path reads again
+static bool live_sweep(Ir * ir, uint64_t * live, uint32_t words, bool is_eliminating) {
+	bool is_changed = false;
+	for (uint32_t b = ir->block_count; b-- > 0;) {
+		Block * block = &ir->blocks[b];
+		if (block->depth == NO_INDEX) { continue; }
+
+		memset(live, 0, sizeof(*live) * words);
+		uint32_t successors[2];
+		uint32_t count = ir_successors(ir, block->end - 1, successors);
+		for (uint32_t i = 0; i < count; i++) {
+			uint64_t const * in = ir->blocks[ir->block_of[successors[i]]].live;
+			for (uint32_t w = 0; w < words; w++) { live[w] |= in[w]; }
+		}
+
+		for (uint32_t i = block->end; i-- > block->start;) {
+			Ir_Op * op = &ir->ops[i];
+			if (is_eliminating && op->op == OP_POP && i > block->start) {
+				Ir_Op * store = &ir->ops[i - 1];
+				if (store->op == OP_SET_LOCAL && !ir->captured[store->operand] && !live_get(live, store->operand)) {
+					store->is_dead = true;
+					ir->is_changed = true;
+				}
+			}
+			if (!op->is_dead) { live_transfer(op, live, words); }
+		}
+
+		if (memcmp(block->live, live, sizeof(*live) * words) != 0) {
+			memcpy(block->live, live, sizeof(*live) * words);
+			is_changed = true;
+		}
+	}
+	return is_changed;
+}
+
+static void ir_eliminate_stores(Ir * ir) {
+	uint32_t words = (ir->depth_max + 63) / 64;
+	for (uint32_t b = 0; b < ir->block_count; b++) {
+		Block * block = &ir->blocks[b];
+		block->live = GROW_ARRAY(ir->vm, block->live, 0, words);
+		memset(block->live, 0, sizeof(*block->live) * words);
+	}
+
+	uint64_t * live = NULL;
+	live = GROW_ARRAY(ir->vm, live, 0, words);
+	while (live_sweep(ir, live, words, false)) {}
+	live_sweep(ir, live, words, true);
+	FREE_ARRAY(ir->vm, live, words);
+}
+
+// -- inlining
+
+static bool ir_matches(Ir * ir, uint8_t const * ops, uint32_t count) {
+	if (ir->count != count) { return false; }
+	for (uint32_t i = 0; i < count; i++) {
+		if (ir->ops[i].op != ops[i]) { return false; }
+	}
+	return true;
+}
+
+// the whole body is one of the shapes `call_inline` runs without a frame,
+// anything reading upvalues or yielding keeps its frame
+static void ir_mark_inline(Ir * ir) {
+	Obj_Function * function = ir->function;
+	if (function->is_generator || function->upvalue_count > 0) { return; }
+
+	Ir_Op const * ops = ir->ops;
+	Value const * constants = function->chunk.constants.values;
+	for (uint32_t i = 0; i < ir->count; i++) {
+		if (ops[i].op == OP_GET_LOCAL && ops[i].operand > function->arity) { return; }
+	}
+
+	if (ir->count == 2 && ops[1].op == OP_RETURN && is_push_constant(ops[0].op)) {
+		switch (ops[0].op) {
+			case OP_NIL:   function->inline_value = TO_NIL(); break;
+			case OP_TRUE:  function->inline_value = TO_BOOL(true); break;
+			case OP_FALSE: function->inline_value = TO_BOOL(false); break;
+			default:       function->inline_value = constants[ops[0].operand]; break;
+		}
+		function->inline_kind = INLINE_CONSTANT;
+	}
+	else if (ir_matches(ir, (uint8_t[]){OP_GET_LOCAL, OP_RETURN}, 2)) {
+		function->inline_kind = INLINE_LOCAL;
+		function->inline_slots[0] = (uint8_t)ops[0].operand;
+	}
+	else if (ir_matches(ir, (uint8_t[]){OP_GET_LOCAL, OP_GET_PROPERTY, OP_RETURN}, 3)) {
+		function->inline_kind = INLINE_GET_FIELD;
+		function->inline_slots[0] = (uint8_t)ops[0].operand;
+		function->inline_value = constants[ops[1].operand];
+	}
+	else if (ir_matches(ir, (uint8_t[]){OP_GET_LOCAL, OP_GET_LOCAL, OP_SET_PROPERTY, OP_POP, OP_NIL, OP_RETURN}, 6)) {
+		function->inline_kind = INLINE_SET_FIELD;
+		function->inline_slots[0] = (uint8_t)ops[0].operand;
+		function->inline_slots[1] = (uint8_t)ops[1].operand;
+		function->inline_value = constants[ops[2].operand];
+	}
+}
+
+// -- lowering
+
+static bool ir_is_wide(Ir_Op const * op) {
+	switch (op_format(op->op)) {
+		case FORMAT_CONSTANT:
+		case FORMAT_INVOKE:
+		case FORMAT_CLOSURE:
+			return op->operand > UINT8_MAX;
+		case FORMAT_JUMP:
+		case FORMAT_FOR_ITER:
+			return op->is_wide;
+		default:
+			return false;
+	}
+}
+
+static uint32_t ir_size(Ir * ir, Ir_Op const * op) {
+	uint32_t wide = ir_is_wide(op) ? 3 : 0;
+	switch (op_format(op->op)) {
+		case FORMAT_SIMPLE:   return 1;
+		case FORMAT_BYTE:     return 2;
+		case FORMAT_CONSTANT: return wide + 2;
+		case FORMAT_INVOKE:   return wide + 3;
+		case FORMAT_NATIVE:   return 3;
+		case FORMAT_CLOSURE: {
+			Obj_Function * function = AS_FUNCTION(ir->function->chunk.constants.values[op->operand]);
+			return wide + 2 + function->upvalue_count * 2;
+		}
+		case FORMAT_JUMP:     return wide + 3;
+		case FORMAT_FOR_ITER: return wide + 4;
+	}
+	return 1;
+}
+
+static uint32_t ir_distance(Ir * ir, uint32_t const * offsets, uint32_t index) {
+	Ir_Op const * op = &ir->ops[index];
+	uint32_t end = offsets[index] + ir_size(ir, op);
+	if (op->op == OP_LOOP) { return end - offsets[op->operand]; }
+	return offsets[op->operand] - end;
+}
+
+static void ir_lower(Ir * ir, uint8_t const * code) {
+	// jumps start short and widen until the layout settles
+	uint32_t * offsets = NULL;
+	offsets = GROW_ARRAY(ir->vm, offsets, 0, ir->count);
+	for (bool is_settled = false; !is_settled;) {
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < ir->count; i++) {
+			offsets[i] = offset;
+			offset += ir_size(ir, &ir->ops[i]);
+		}
+
+		is_settled = true;
+		for (uint32_t i = 0; i < ir->count; i++) {
+			Ir_Op * op = &ir->ops[i];
+			if (is_jump(op->op) && !op->is_wide && ir_distance(ir, offsets, i) > UINT16_MAX) {
+				op->is_wide = true;
+				is_settled = false;
+			}
+		}
+	}
+
+	Chunk chunk;
+	chunk_init(&chunk);
+	for (uint32_t i = 0; i < ir->count; i++) {
+		Ir_Op const * op = &ir->ops[i];
+		uint32_t line = op->line;
+		Format format = op_format(op->op);
+
+		uint32_t jump = is_jump(op->op) ? ir_distance(ir, offsets, i) : 0;
+		uint32_t high = is_jump(op->op) ? jump >> 16 : op->operand >> 8;
+		if (ir_is_wide(op)) {
+			chunk_write(ir->vm, &chunk, OP_WIDE, line);
+			chunk_write(ir->vm, &chunk, (high >> 8) & 0xff, line);
+			chunk_write(ir->vm, &chunk, high & 0xff, line);
+		}
+
+		chunk_write(ir->vm, &chunk, op->op, line);
+		switch (format) {
+			case FORMAT_SIMPLE: break;
+			case FORMAT_BYTE:
+			case FORMAT_CONSTANT:
+				chunk_write(ir->vm, &chunk, op->operand & 0xff, line);
+				break;
+			case FORMAT_INVOKE:
+			case FORMAT_NATIVE:
+				chunk_write(ir->vm, &chunk, op->operand & 0xff, line);
+				chunk_write(ir->vm, &chunk, op->arg, line);
+				break;
+			case FORMAT_CLOSURE: {
+				chunk_write(ir->vm, &chunk, op->operand & 0xff, line);
+				Obj_Function * function = AS_FUNCTION(ir->function->chunk.constants.values[op->operand]);
+				for (uint32_t b = 0; b < function->upvalue_count * 2; b++) {
+					chunk_write(ir->vm, &chunk, code[op->upvalues + b], line);
+				}
+				break;
+			}
+			case FORMAT_FOR_ITER:
+				chunk_write(ir->vm, &chunk, op->arg, line);
+				// fallthrough
+			case FORMAT_JUMP:
+				chunk_write(ir->vm, &chunk, (jump >> 8) & 0xff, line);
+				chunk_write(ir->vm, &chunk, jump & 0xff, line);
+				break;
+		}
+	}
+	FREE_ARRAY(ir->vm, offsets, ir->count);
+
+	// the constants stay, the code and its lines are replaced
+	Chunk * target = &ir->function->chunk;
+	FREE_ARRAY(ir->vm, target->code, target->capacity);
+	FREE_ARRAY(ir->vm, target->lines, target->line_capacity);
+	target->code = chunk.code;
+	target->count = chunk.count;
+	target->capacity = chunk.capacity;
+	target->lines = chunk.lines;
+	target->line_count = chunk.line_count;
+	target->line_capacity = chunk.line_capacity;
+}
+
+void optimize_function(VM * vm, Obj_Function * function) {
+	Ir ir = {.vm = vm, .function = function};
+	value_table_init(&ir.constants);
+
+	bool is_ok = ir_decode(&ir);
+	ir.block_of = GROW_ARRAY(vm, ir.block_of, 0, ir.capacity);
+	for (uint32_t round = 0; is_ok && round < OPTIMIZER_ROUNDS; round++) {
+		ir.is_changed = false;
+
+		is_ok = ir_analyze(&ir, true) && ir_compact(&ir);
+		if (!is_ok) { break; }
+
+		ir_fold(&ir);
+		ir_thread(&ir);
+		is_ok = ir_compact(&ir);
+		if (!is_ok) { break; }
+
+		// liveness needs the depths
+		is_ok = ir_analyze(&ir, false);
+		if (!is_ok) { break; }
+		ir_eliminate_stores(&ir);
+		is_ok = ir_compact(&ir);
+
+		if (!ir.is_changed) { break; }
+	}
+
+	if (is_ok) {
+		ir_mark_inline(&ir);
+		ir_lower(&ir, function->chunk.code);
+	}
+
+	ir_free_blocks(&ir);
+	FREE_ARRAY(vm, ir.blocks, ir.block_capacity);
+	FREE_ARRAY(vm, ir.block_of, ir.capacity);
+	FREE_ARRAY(vm, ir.ops, ir.capacity);
+	value_table_free(vm, &ir.constants);
+}
@@ -0,0 +1,23 @@
+#if !defined(LOX_OPTIMIZER)
+#define LOX_OPTIMIZER
+
+#include "common.h"
+
+// an optional pass over the bytecode of a compiled function, enabled by
+// `vm->is_optimizing`; the code is decoded into a list of instructions
+// with resolved jump targets, rewritten and lowered back into the chunk:
+// - locals that hold a known constant or a copy of another local
+//   are read as that constant or local instead
+// - constant operands are folded and constant branches are resolved
+// - stores into locals that are never read again are dropped
+// - unreachable code and jumps to jumps are removed
+// - a body that only returns a constant, an argument or a field of one,
+//   or sets a field, is marked to run without a frame, see `Inline_Kind`
+// the function is left untouched if its code isn't understood
+
+struct VM;
+struct Obj_Function;
+
+void optimize_function(struct VM * vm, struct Obj_Function * function);
+
+#endif
@@ -0,0 +1,280 @@
+#include <math.h>
+#include <string.h>
+
+#include "output.h"
+#include "output_table.h"
+
+#define EXACT_INTEGER_LIMIT 9007199254740992.0 // 2^53
+
+void output_flush(Output * output) {
+	if (output->count == 0) { return; }
+	fwrite(output->chars, sizeof(char), output->count, output->file);
+	fflush(output->file);
+	output->count = 0;
+}
+
+void output_chars(Output * output, char const * chars, uint32_t length) {
+	if (output->count + length > output->capacity) {
+		output_flush(output);
+		if (length > output->capacity) {
+			fwrite(chars, sizeof(char), length, output->file);
+			return;
+		}
+	}
+	memcpy(output->chars + output->count, chars, sizeof(char) * length);
+	output->count += length;
+}
+
+void output_number(Output * output, double value) {
+	char buffer[NUMBER_FORMAT_MAX];
+	output_chars(output, buffer, number_format(value, buffer));
+}
+
+static uint32_t format_digits(uint64_t value, char * buffer) {
+	char digits[24];
+	uint32_t count = 0;
+	do {
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+
+	for (uint32_t i = 0; i < count; i++) {
+		buffer[i] = digits[count - i - 1];
+	}
+	return count;
+}
+
+void output_int(Output * output, int64_t value) {
+	char buffer[NUMBER_FORMAT_MAX];
+	uint32_t length = 0;
+	if (value < 0) { buffer[length++] = '-'; }
+	uint64_t magnitude = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+	length += format_digits(magnitude, buffer + length);
+	output_chars(output, buffer, length);
+}
+
+// -- shortest round trip, after Ulf Adams' Ryu
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+
+#if defined(__SIZEOF_INT128__)
+inline static uint64_t multiply_128(uint64_t a, uint64_t b, uint64_t * high) {
+	__extension__ unsigned __int128 product = (unsigned __int128)a * b;
+	*high = (uint64_t)(product >> 64);
+	return (uint64_t)product;
+}
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+inline static uint64_t multiply_128(uint64_t a, uint64_t b, uint64_t * high) {
+	return _umul128(a, b, high);
+}
+#else
+inline static uint64_t multiply_128(uint64_t a, uint64_t b, uint64_t * high) {
+	uint64_t a_low = (uint32_t)a, a_high = a >> 32;
+	uint64_t b_low = (uint32_t)b, b_high = b >> 32;
+	uint64_t low_low = a_low * b_low;
+	uint64_t low_high = a_low * b_high;
+	uint64_t high_low = a_high * b_low;
+	uint64_t middle = high_low + (low_low >> 32) + (uint32_t)low_high;
+	*high = a_high * b_high + (middle >> 32) + (low_high >> 32);
+	return (middle << 32) | (uint32_t)low_low;
+}
+#endif
+
+// `m * mul >> j`, where `m` fits 55 bits and `64 < j < 128`
+inline static uint64_t multiply_shift(uint64_t m, uint64_t const * mul, int32_t j) {
+	uint64_t high_0, high_1;
+	multiply_128(m, mul[0], &high_0);
+	uint64_t low_1 = multiply_128(m, mul[1], &high_1);
+	uint64_t sum = high_0 + low_1;
+	if (sum < high_0) { high_1++; }
+	uint32_t shift = (uint32_t)(j - 64);
+	return (high_1 << (64 - shift)) | (sum >> shift);
+}
+
+inline static uint32_t pow5_bits(int32_t e) { return (((uint32_t)e * 1217359) >> 19) + 1; }
+inline static uint32_t log10_pow2(int32_t e) { return ((uint32_t)e * 78913) >> 18; }
+inline static uint32_t log10_pow5(int32_t e) { return ((uint32_t)e * 732923) >> 20; }
+
+static bool is_multiple_of_pow5(uint64_t value, uint32_t p) {
+	uint32_t count = 0;
+	while (value % 5 == 0) {
+		value /= 5;
+		count++;
+	}
+	return count >= p;
+}
+
+inline static bool is_multiple_of_pow2(uint64_t value, uint32_t p) {
+	return (value & (((uint64_t)1 << p) - 1)) == 0;
+}
+
+// the shortest `digits * 10^exponent` within the rounding interval of the double
+static uint64_t shortest_decimal(uint64_t ieee_mantissa, uint32_t ieee_exponent, int32_t * exponent) {
+	int32_t e2;
+	uint64_t m2;
+	if (ieee_exponent == 0) {
+		e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = ieee_mantissa;
+	}
+	else {
+		e2 = (int32_t)ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+		m2 = ((uint64_t)1 << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+	}
+	bool accept_bounds = (m2 & 1) == 0;
+
+	// the interval is `[mv - 1 - mm_shift, mv + 2]`, scaled by 4
+	uint64_t mv = 4 * m2;
+	uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+	uint64_t vr, vp, vm;
+	int32_t e10;
+	bool vm_is_trailing_zeros = false;
+	bool vr_is_trailing_zeros = false;
+	if (e2 >= 0) {
+		uint32_t q = log10_pow2(e2) - (e2 > 3);
+		e10 = (int32_t)q;
+		int32_t k = POW5_INV_BITCOUNT + (int32_t)pow5_bits((int32_t)q) - 1;
+		int32_t i = -e2 + (int32_t)q + k;
+		vr = multiply_shift(mv, POW5_INV_SPLIT[q], i);
+		vp = multiply_shift(mv + 2, POW5_INV_SPLIT[q], i);
+		vm = multiply_shift(mv - 1 - mm_shift, POW5_INV_SPLIT[q], i);
+		if (q <= 21) {
+			if (mv % 5 == 0) { vr_is_trailing_zeros = is_multiple_of_pow5(mv, q); }
+			else if (accept_bounds) { vm_is_trailing_zeros = is_multiple_of_pow5(mv - 1 - mm_shift, q); }
+			else { vp -= is_multiple_of_pow5(mv + 2, q); }
+		}
+	}
+	else {
+		uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+		e10 = (int32_t)q + e2;
+		int32_t i = -e2 - (int32_t)q;
+		int32_t k = (int32_t)pow5_bits(i) - POW5_BITCOUNT;
+		int32_t j = (int32_t)q - k;
+		vr = multiply_shift(mv, POW5_SPLIT[i], j);
+		vp = multiply_shift(mv + 2, POW5_SPLIT[i], j);
+		vm = multiply_shift(mv - 1 - mm_shift, POW5_SPLIT[i], j);
+		if (q <= 1) {
+			vr_is_trailing_zeros = true;
+			if (accept_bounds) { vm_is_trailing_zeros = mm_shift == 1; }
+			else { vp--; }
+		}
+		else if (q < 63) {
+			vr_is_trailing_zeros = is_multiple_of_pow2(mv, q);
+		}
+	}
+
+	// drop digits while the interval still has a shorter representative
+	int32_t removed = 0;
+	uint64_t output;
+	if (vm_is_trailing_zeros || vr_is_trailing_zeros) {
+		uint32_t last_removed_digit = 0;
+		while (vp / 10 > vm / 10) {
+			vm_is_trailing_zeros &= vm % 10 == 0;
+			vr_is_trailing_zeros &= last_removed_digit == 0;
+			last_removed_digit = (uint32_t)(vr % 10);
+			vr /= 10; vp /= 10; vm /= 10;
+			removed++;
+		}
+		if (vm_is_trailing_zeros) {
+			while (vm % 10 == 0) {
+				vr_is_trailing_zeros &= last_removed_digit == 0;
+				last_removed_digit = (uint32_t)(vr % 10);
+				vr /= 10; vp /= 10; vm /= 10;
+				removed++;
+			}
+		}
+		// exact ties round to even
+		if (vr_is_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+			last_removed_digit = 4;
+		}
+		output = vr + ((vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) || last_removed_digit >= 5);
+	}
+	else {
+		bool round_up = false;
+		if (vp / 100 > vm / 100) {
+			round_up = vr % 100 >= 50;
+			vr /= 100; vp /= 100; vm /= 100;
+			removed += 2;
+		}
+		while (vp / 10 > vm / 10) {
+			round_up = vr % 10 >= 5;
+			vr /= 10; vp /= 10; vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+
+	*exponent = e10 + removed;
+	return output;
+}
+
+// plain notation within `[1e-7, 1e21)`, like `%g` beyond
+uint32_t number_format(double value, char * buffer) {
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	bool sign = (bits >> (DOUBLE_MANTISSA_BITS + DOUBLE_EXPONENT_BITS)) != 0;
+	uint64_t ieee_mantissa = bits & (((uint64_t)1 << DOUBLE_MANTISSA_BITS) - 1);
+	uint32_t ieee_exponent = (uint32_t)(bits >> DOUBLE_MANTISSA_BITS) & ((1u << DOUBLE_EXPONENT_BITS) - 1);
+
+	uint32_t length = 0;
+	if (ieee_exponent == ((1u << DOUBLE_EXPONENT_BITS) - 1)) {
+		if (ieee_mantissa != 0) {
+			memcpy(buffer, "nan", 3);
+			return 3;
+		}
+		if (sign) { buffer[length++] = '-'; }
+		memcpy(buffer + length, "inf", 3);
+		return length + 3;
+	}
+
+	if (sign) { buffer[length++] = '-'; }
+	double magnitude = fabs(value);
+
+	// integers are the common case
+	if (magnitude < EXACT_INTEGER_LIMIT && magnitude == floor(magnitude)) {
+		return length + format_digits((uint64_t)magnitude, buffer + length);
+	}
+
+	int32_t exponent;
+	char digits[24];
+	uint64_t decimal = shortest_decimal(ieee_mantissa, ieee_exponent, &exponent);
+	int32_t count = (int32_t)format_digits(decimal, digits);
+
+	// the position of the decimal point relative to the digits
+	int32_t point = count + exponent;
+	if (point > -7 && point <= 21) {
+		if (point <= 0) {
+			buffer[length++] = '0';
+			buffer[length++] = '.';
+			for (int32_t i = point; i < 0; i++) { buffer[length++] = '0'; }
+			memcpy(buffer + length, digits, (size_t)count);
+			return length + (uint32_t)count;
+		}
+		if (point >= count) {
+			memcpy(buffer + length, digits, (size_t)count);
+			length += (uint32_t)count;
+			for (int32_t i = count; i < point; i++) { buffer[length++] = '0'; }
+			return length;
+		}
+		memcpy(buffer + length, digits, (size_t)point);
+		length += (uint32_t)point;
+		buffer[length++] = '.';
+		memcpy(buffer + length, digits + point, (size_t)(count - point));
+		return length + (uint32_t)(count - point);
+	}
+
+	buffer[length++] = digits[0];
+	if (count > 1) {
+		buffer[length++] = '.';
+		memcpy(buffer + length, digits + 1, (size_t)(count - 1));
+		length += (uint32_t)(count - 1);
+	}
+	int32_t scientific = point - 1;
+	buffer[length++] = 'e';
+	buffer[length++] = scientific < 0 ? '-' : '+';
+	if (scientific < 0) { scientific = -scientific; }
+	if (scientific < 10) { buffer[length++] = '0'; }
+	return length + format_digits((uint64_t)scientific, buffer + length);
+}
@@ -0,0 +1,33 @@
+#if !defined(LOX_OUTPUT)
+#define LOX_OUTPUT
+
+#include <stdio.h>
+
+#include "common.h"
+
+// a fixed buffer in front of a file, flushed when full or on request;
+// the VM owns one for `print`, see `vm->output`
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define NUMBER_FORMAT_MAX 32
+
+typedef struct Output {
+	char * chars;
+	uint32_t count, capacity;
+	FILE * file;
+} Output;
+
+void output_flush(Output * output);
+void output_chars(Output * output, char const * chars, uint32_t length);
+void output_number(Output * output, double value);
+void output_int(Output * output, int64_t value);
+
+inline static void output_char(Output * output, char value) {
+	if (output->count == output->capacity) { output_flush(output); }
+	output->chars[output->count++] = value;
+}
+
+// the shortest text that reads back as the same double
+uint32_t number_format(double value, char * buffer);
+
+#endif
@@ -4,80 +4,75 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-	char const * start;
-	char const * current;
-	uint32_t line;
-} Scanner;
-
-static Scanner scanner;
-
-void scanner_init(char const * source) {
-	scanner.start = source;
-	scanner.current = source;
-	scanner.line = 1;
+void scanner_init(Scanner * scanner, char const * source, size_t length) {
+	scanner->start = source;
+	scanner->current = source;
+	scanner->end = source + length;
+	scanner->line = 1;
 }
 
-static bool is_at_end(void) {
-	return *scanner.current == '\0';
+static bool is_at_end(Scanner * scanner) {
+	return scanner->current >= scanner->end;
 }
 
-static Token make_token(Token_Type type) {
+static Token make_token(Scanner * scanner, Token_Type type) {
 	return (Token) {
 		.type = type,
-		.start = scanner.start,
-		.length = (uint32_t)(scanner.current - scanner.start),
-		.line = scanner.line,
+		.start = scanner->start,
+		.length = (uint32_t)(scanner->current - scanner->start),
+		.line = scanner->line,
 	};
 }
 
-static Token make_error_token(char const * message) {
+static Token make_error_token(Scanner * scanner, char const * message) {
 	return (Token) {
 		.type = TOKEN_ERROR,
 		.start = message,
 		.length = (uint32_t)strlen(message),
-		.line = scanner.line,
+		.line = scanner->line,
 	};
 }
 
-static char scanner_advance(void) {
-	return *(scanner.current++);
+static char scanner_advance(Scanner * scanner) {
+	return *(scanner->current++);
 }
 
-static bool scanner_match(char expected) {
-	if (is_at_end()) { return false; }
-	if (*scanner.current != expected) { return false; }
-	scanner.current++;
+static bool scanner_match(Scanner * scanner, char expected) {
+	if (is_at_end(scanner)) { return false; }
+	if (*scanner->current != expected) { return false; }
+	scanner->current++;
 	return true;
 }
 
-static char peek(void) {
-	return *scanner.current;
+// `'\0'` past the end
+static char peek(Scanner * scanner) {
+	if (is_at_end(scanner)) { return '\0'; }
+	return *scanner->current;
 }
 
-static char peek_next(void) {
-	if (is_at_end()) { return '\0'; }
-	return *(scanner.current + 1);
+static char peek_next(Scanner * scanner) {
+	if (scanner->current + 1 >= scanner->end) { return '\0'; }
+	return *(scanner->current + 1);
 }
 
-static void skip_whitespace(void) {
+static void skip_whitespace(Scanner * scanner) {
 	for (;;) {
-		char c = peek();
+		char c = peek(scanner);
 		switch (c) {
 			case ' ':
 			case '\t':
 			case '\r':
-				scanner_advance();
+				scanner_advance(scanner);
 				break;
 
 			case '\n':
-				scanner.line++;
-				scanner_advance();
+				scanner->line++;
+				scanner_advance(scanner);
 				break;
 
 			case '/':
-				if (peek_next() == '/') {
-					while (!is_at_end() && peek() != '\n') { scanner_advance(); }
+				if (peek_next(scanner) == '/') {
+					while (!is_at_end(scanner) && peek(scanner) != '\n') { scanner_advance(scanner); }
 				}
 				else {
 					return;
@@ -90,16 +85,16 @@ static void skip_whitespace(void) {
 	}
 }
 
-static Token make_string_token(void) {
-	while (!is_at_end() && peek() != '"') {
-		if (peek() == '\n') { scanner.line++; }
-		scanner_advance();
+static Token make_string_token(Scanner * scanner) {
+	while (!is_at_end(scanner) && peek(scanner) != '"') {
+		if (peek(scanner) == '\n') { scanner->line++; }
+		scanner_advance(scanner);
 	}
 
-	if (is_at_end()) { return make_error_token("unterminated string"); }
+	if (is_at_end(scanner)) { return make_error_token(scanner, "unterminated string"); }
 
-	scanner_advance();
-	return make_token(TOKEN_STRING);
+	scanner_advance(scanner);
+	return make_token(scanner, TOKEN_STRING);
 }
 
 static bool is_digit(char c) {
@@ -112,99 +107,102 @@ static bool is_alpha(char c) {
 	    || c == '_';
 }
 
-static Token make_number_token(void) {
-	while (is_digit(peek())) { scanner_advance(); }
+static Token make_number_token(Scanner * scanner) {
+	while (is_digit(peek(scanner))) { scanner_advance(scanner); }
 
-	if (peek() == '.' && is_digit(peek_next())) {
-		scanner_advance();
-		while (is_digit(peek())) { scanner_advance(); }
+	if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
+		scanner_advance(scanner);
+		while (is_digit(peek(scanner))) { scanner_advance(scanner); }
 	}
 
-	return make_token(TOKEN_NUMBER);
+	return make_token(scanner, TOKEN_NUMBER);
 }
 
-static Token_Type check_keyword(uint32_t start, uint32_t length, char const * rest, Token_Type type) {
-	if (scanner.current - scanner.start == start + length && memcmp(scanner.start + start, rest, length) == 0) {
+static Token_Type check_keyword(Scanner * scanner, uint32_t start, uint32_t length, char const * rest, Token_Type type) {
+	if (scanner->current - scanner->start == start + length && memcmp(scanner->start + start, rest, length) == 0) {
 		return type;
 	}
 	return TOKEN_IDENTIFIER;
 }
 
-static Token_Type identifier_type(void) {
-	switch (scanner.start[0]) {
-		case 'a': return check_keyword(1, 2, "nd", TOKEN_AND);
-		case 'c': return check_keyword(1, 4, "lass", TOKEN_CLASS);
-		case 'e': return check_keyword(1, 3, "lse", TOKEN_ELSE);
+static Token_Type identifier_type(Scanner * scanner) {
+	switch (scanner->start[0]) {
+		case 'a': return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
+		case 'c': return check_keyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+		case 'e': return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
 		case 'f':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
-					case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
-					case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'a': return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+					case 'o': return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
+					case 'u': return check_keyword(scanner, 2, 1, "n", TOKEN_FUN);
 				}
 			}
 			break;
-		case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
-		case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
-		case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
-		case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-		case 's': return check_keyword(1, 4, "uper", TOKEN_SUPER);
+		case 'i': return check_keyword(scanner, 1, 1, "f", TOKEN_IF);
+		case 'n': return check_keyword(scanner, 1, 2, "il", TOKEN_NIL);
+		case 'o': return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
+		case 'r': return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+		case 's': return check_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
 		case 't':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
-					case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'h': return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
+					case 'r': return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
 				}
 			}
 			break;
-		case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
-		case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
+		case 'v': return check_keyword(scanner, 1, 2, "ar", TOKEN_VAR);
+		case 'w': return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+		case 'y': return check_keyword(scanner, 1, 4, "ield", TOKEN_YIELD);
 	}
 	return TOKEN_IDENTIFIER;
 }
 
-static Token make_identifier_token(void) {
-	while (is_alpha(peek()) || is_digit(peek())) { scanner_advance(); }
-	return make_token(identifier_type());
+static Token make_identifier_token(Scanner * scanner) {
+	while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) { scanner_advance(scanner); }
+	return make_token(scanner, identifier_type(scanner));
 }
 
-Token scan_token(void) {
-	skip_whitespace();
+Token scan_token(Scanner * scanner) {
+	skip_whitespace(scanner);
 
-	scanner.start = scanner.current;
+	scanner->start = scanner->current;
 
-	if (is_at_end()) { return make_token(TOKEN_EOF); }
+	if (is_at_end(scanner)) { return make_token(scanner, TOKEN_EOF); }
 
-	char c = scanner_advance();
-	if (is_alpha(c)) { return make_identifier_token(); }
-	if (is_digit(c)) { return make_number_token(); }
+	char c = scanner_advance(scanner);
+	if (is_alpha(c)) { return make_identifier_token(scanner); }
+	if (is_digit(c)) { return make_number_token(scanner); }
 
 	switch (c) {
-		case '(': return make_token(TOKEN_LEFT_PAREN);
-		case ')': return make_token(TOKEN_RIGHT_PAREN);
-		case '{': return make_token(TOKEN_LEFT_BRACE);
-		case '}': return make_token(TOKEN_RIGHT_BRACE);
-		case ';': return make_token(TOKEN_SEMICOLON);
-		case ',': return make_token(TOKEN_COMMA);
-		case '.': return make_token(TOKEN_DOT);
-		case '-': return make_token(TOKEN_MINUS);
-		case '+': return make_token(TOKEN_PLUS);
-		case '/': return make_token(TOKEN_SLASH);
-		case '*': return make_token(TOKEN_STAR);
+		case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
+		case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
+		case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
+		case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
+		case '[': return make_token(scanner, TOKEN_LEFT_BRACKET);
+		case ']': return make_token(scanner, TOKEN_RIGHT_BRACKET);
+		case ';': return make_token(scanner, TOKEN_SEMICOLON);
+		case ',': return make_token(scanner, TOKEN_COMMA);
+		case '.': return make_token(scanner, TOKEN_DOT);
+		case '-': return make_token(scanner, TOKEN_MINUS);
+		case '+': return make_token(scanner, TOKEN_PLUS);
+		case '/': return make_token(scanner, TOKEN_SLASH);
+		case '*': return make_token(scanner, TOKEN_STAR);
 
 		case '!':
-			return make_token(scanner_match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+			return make_token(scanner, scanner_match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
 		case '=':
-			return make_token(scanner_match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+			return make_token(scanner, scanner_match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
 		case '<':
-			return make_token(scanner_match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+			return make_token(scanner, scanner_match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
 		case '>':
-			return make_token(scanner_match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+			return make_token(scanner, scanner_match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
 
-		case '"': return make_string_token();
+		case '"': return make_string_token(scanner);
 	}
 
-	return make_error_token("unexpected character");
+	return make_error_token(scanner, "unexpected character");
 }
 
 // data
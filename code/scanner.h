@@ -9,6 +9,7 @@ typedef enum {
 	// single-character tokens
 	TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
 	TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+	TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
 	TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
 	TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
 
@@ -26,6 +27,7 @@ typedef enum {
 	TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
 	TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
 	TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+	TOKEN_YIELD,
 
 	//
 	TOKEN_ERROR,
@@ -39,7 +41,15 @@ typedef struct {
 	uint32_t line;
 } Token;
 
-void scanner_init(char const * source);
-Token scan_token(void);
+// the source needs no terminator, scanning stops at `end`
+typedef struct {
+	char const * start;
+	char const * current;
+	char const * end;
+	uint32_t line;
+} Scanner;
+
+void scanner_init(Scanner * scanner, char const * source, size_t length);
+Token scan_token(Scanner * scanner);
 
 #endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define SOURCE_MMAP
+#endif
+
+#include "source.h"
+
+typedef struct Source Source;
+
+// the fallback copies the file into the heap, it might be a pipe
+static bool source_read(Source * source, char const * path) {
+	FILE * file = fopen(path, "rb");
+	if (file == NULL) { return false; }
+
+	size_t capacity = 0, length = 0;
+	char * buffer = NULL;
+	for (;;) {
+		if (length == capacity) {
+			capacity = capacity < 4096 ? 4096 : capacity * 2;
+			char * grown = realloc(buffer, capacity);
+			if (grown == NULL) { break; }
+			buffer = grown;
+		}
+		size_t count = fread(buffer + length, sizeof(char), capacity - length, file);
+		length += count;
+		if (count == 0) { break; }
+	}
+
+	bool is_ok = !ferror(file) && feof(file);
+	fclose(file);
+	if (!is_ok) {
+		free(buffer);
+		return false;
+	}
+
+	source->chars = buffer;
+	source->length = length;
+	source->is_mapped = false;
+	return true;
+}
+
+bool source_open(Source * source, char const * path) {
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) { return false; }
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	if (size.QuadPart == 0) {
+		CloseHandle(file);
+		return source_read(source, path);
+	}
+
+	// the view keeps the mapping alive
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void * view = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (mapping != NULL) { CloseHandle(mapping); }
+	CloseHandle(file);
+	if (view == NULL) { return source_read(source, path); }
+
+	source->chars = view;
+	source->length = (size_t)size.QuadPart;
+	source->is_mapped = true;
+	return true;
+#elif defined(SOURCE_MMAP)
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) { return false; }
+
+	// pipes and empty files can't be mapped
+	struct stat info;
+	if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+		close(fd);
+		return source_read(source, path);
+	}
+
+	void * view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) { return source_read(source, path); }
+
+	source->chars = view;
+	source->length = (size_t)info.st_size;
+	source->is_mapped = true;
+	return true;
+#else
+	return source_read(source, path);
+#endif
+}
+
+void source_close(Source * source) {
+	if (!source->is_mapped) {
+		free((void *)source->chars);
+	}
+#if defined(_WIN32)
+	else {
+		UnmapViewOfFile(source->chars);
+	}
+#elif defined(SOURCE_MMAP)
+	else {
+		munmap((void *)source->chars, source->length);
+	}
+#endif
+	source->chars = NULL;
+	source->length = 0;
+}
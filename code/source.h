@@ -0,0 +1,18 @@
+#if !defined(LOX_SOURCE)
+#define LOX_SOURCE
+
+#include "common.h"
+
+// a read-only view of a script file, mapped into memory where the platform allows;
+// it is not terminated, see `scanner_init`
+
+typedef struct Source {
+	char const * chars;
+	size_t length;
+	bool is_mapped;
+} Source;
+
+bool source_open(Source * source, char const * path);
+void source_close(Source * source);
+
+#endif
@@ -7,26 +7,28 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+typedef struct VM VM;
+
 void table_init(Table * table) {
 	table->count = 0;
 	table->capacity = 0;
 	table->entries = NULL;
 }
 
-void table_free(Table * table) {
-	FREE_ARRAY(table->entries, table->capacity);
+void table_free(VM * vm, Table * table) {
+	FREE_ARRAY(vm, table->entries, table->capacity);
 	table_init(table);
 }
 
 typedef struct Obj_String Obj_String;
 
-static Entry * find_entry(Entry * entries, uint32_t capacity, Obj_String * key) {
 #if GROWTH_FACTOR == 2
 	#define WRAP_VALUE(value, range) ((value) & ((range) - 1))
 #else
 	#define WRAP_VALUE(value, range) ((value) % (range))
 #endif
 
+static Entry * find_entry(Entry * entries, uint32_t capacity, Obj_String * key) {
 	uint32_t index = WRAP_VALUE(key->hash, capacity);
 	Entry* empty = NULL;
 	for (uint32_t i = 0; i < capacity; i++) {
@@ -44,12 +46,10 @@ static Entry * find_entry(Entry * entries, uint32_t capacity, Obj_String * key)
 		// return entry;
 	}
 	return empty;
-
-#undef WRAP_VALUE
 }
 
-static void adjust_capacity(Table * table, uint32_t capacity) {
-	Entry * entries = reallocate(NULL, 0, sizeof(Entry) * capacity);
+static void adjust_capacity(VM * vm, Table * table, uint32_t capacity) {
+	Entry * entries = reallocate(vm, NULL, 0, sizeof(Entry) * capacity);
 	for (uint32_t i = 0; i < capacity; i++) {
 		entries[i].key = NULL;
 		entries[i].value = TO_NIL();
@@ -65,7 +65,7 @@ static void adjust_capacity(Table * table, uint32_t capacity) {
 		dest->value = entry->value;
 	}
 
-	FREE_ARRAY(table->entries, table->capacity);
+	FREE_ARRAY(vm, table->entries, table->capacity);
 	table->entries = entries;
 	table->capacity = capacity;
 }
@@ -80,10 +80,10 @@ bool table_get(Table * table, Obj_String * key, Value * value) {
 	return true;
 }
 
-bool table_set(Table * table, Obj_String * key, Value value) {
+bool table_set(VM * vm, Table * table, Obj_String * key, Value value) {
 	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
 		uint32_t capacity = GROW_CAPACITY(table->capacity);
-		adjust_capacity(table, capacity);
+		adjust_capacity(vm, table, capacity);
 	}
 
 	Entry * entry = find_entry(table->entries, table->capacity, key);
@@ -109,14 +109,125 @@ bool table_delete(Table * table, Obj_String * key) {
 	return true;
 }
 
-void table_add_all(Table * table, Table * from) {
+void table_add_all(VM * vm, Table * table, Table * from) {
 	for (uint32_t i = 0; i < from->capacity; i++) {
 		Entry * entry = &from->entries[i];
 		if (entry->key == NULL) { continue; }
-		table_set(table, entry->key, entry->value);
+		table_set(vm, table, entry->key, entry->value);
+	}
+}
+
+void value_table_init(Value_Table * table) {
+	table->count = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+}
+
+void value_table_free(VM * vm, Value_Table * table) {
+	FREE_ARRAY(vm, table->entries, table->capacity);
+	value_table_init(table);
+}
+
+inline static uint32_t hash_bits(uint64_t bits) {
+	// Fibonacci hashing
+	return (uint32_t)((bits * 0x9e3779b97f4a7c15u) >> 32);
+}
+
+static uint32_t hash_value(Value key) {
+	if (IS_STRING(key)) { return AS_STRING(key)->hash; }
+	if (IS_OBJ(key)) { return hash_bits((uint64_t)(uintptr_t)AS_OBJ(key)); }
+	if (IS_INT(key)) { return hash_bits((uint64_t)(uint32_t)AS_INT(key)); }
+	if (IS_BOOL(key)) { return AS_BOOL(key) ? 1 : 2; }
+	double number = AS_NUMBER(key);
+	uint64_t bits;
+	memcpy(&bits, &number, sizeof(bits));
+	return hash_bits(bits);
+}
+
+static Value_Entry * find_value_entry(Value_Entry * entries, uint32_t capacity, Value key) {
+	uint32_t index = WRAP_VALUE(hash_value(key), capacity);
+	Value_Entry * empty = NULL;
+	for (uint32_t i = 0; i < capacity; i++) {
+		Value_Entry * entry = &entries[WRAP_VALUE(index + i, capacity)];
+		if (IS_NIL(entry->key)) {
+			if (empty == NULL) { empty = entry; }
+			if (IS_NIL(entry->value)) { break; }
+			continue;
+		}
+		if (values_equal(entry->key, key)) { return entry; }
+	}
+	return empty;
+}
+
+static void adjust_value_capacity(VM * vm, Value_Table * table, uint32_t capacity) {
+	Value_Entry * entries = reallocate(vm, NULL, 0, sizeof(Value_Entry) * capacity);
+	for (uint32_t i = 0; i < capacity; i++) {
+		entries[i].key = TO_NIL();
+		entries[i].value = TO_NIL();
+	}
+
+	// @note: `table->count` remains as is
+	for (uint32_t i = 0; i < table->capacity; i++) {
+		Value_Entry * entry = &table->entries[i];
+		if (IS_NIL(entry->key)) { continue; }
+
+		Value_Entry * dest = find_value_entry(entries, capacity, entry->key);
+		dest->key = entry->key;
+		dest->value = entry->value;
+	}
+
+	FREE_ARRAY(vm, table->entries, table->capacity);
+	table->entries = entries;
+	table->capacity = capacity;
+}
+
+inline static Value normalize_key(Value key) {
+	// `1.0` and `1` are the same key
+	return IS_DOUBLE(key) ? double_to_value(AS_NUMBER(key)) : key;
+}
+
+bool value_table_get(Value_Table * table, Value key, Value * value) {
+	if (table->count == 0) { return false; }
+
+	Value_Entry * entry = find_value_entry(table->entries, table->capacity, normalize_key(key));
+	if (IS_NIL(entry->key)) { return false; }
+
+	*value = entry->value;
+	return true;
+}
+
+bool value_table_set(VM * vm, Value_Table * table, Value key, Value value) {
+	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+		uint32_t capacity = GROW_CAPACITY(table->capacity);
+		adjust_value_capacity(vm, table, capacity);
 	}
+
+	key = normalize_key(key);
+	Value_Entry * entry = find_value_entry(table->entries, table->capacity, key);
+
+	bool is_new_key = IS_NIL(entry->key);
+	if (is_new_key) { table->count++; }
+
+	entry->key = key;
+	entry->value = value;
+	return is_new_key;
 }
 
+bool value_table_delete(Value_Table * table, Value key) {
+	if (table->count == 0) { return false; }
+
+	Value_Entry * entry = find_value_entry(table->entries, table->capacity, normalize_key(key));
+	if (IS_NIL(entry->key)) { return false; }
+
+	entry->key = TO_NIL();
+	entry->value = TO_BOOL(true);
+	table->count--;
+
+	return true;
+}
+
+#undef WRAP_VALUE
+
 struct Obj_String * table_find_key_copy(Table * table, char const * chars, uint32_t length, uint32_t hash) {
 	// currently, it's compile-time and initialization-time function
 	if (table->count == 0) { return false; }
@@ -159,11 +270,19 @@ struct Obj_String * table_find_key_concatenate(Table * table, char const * a_cha
 
 typedef struct Obj Obj;
 
-void gc_mark_table_grey(Table * table) {
+void gc_mark_table_grey(VM * vm, Table * table) {
 	for (uint32_t i = 0; i < table->capacity; i++) {
 		Entry * entry = &table->entries[i];
-		gc_mark_object_grey((Obj *)entry->key);
-		gc_mark_value_grey(entry->value);
+		gc_mark_object_grey(vm, (Obj *)entry->key);
+		gc_mark_value_grey(vm, entry->value);
+	}
+}
+
+void gc_mark_value_table_grey(VM * vm, Value_Table * table) {
+	for (uint32_t i = 0; i < table->capacity; i++) {
+		Value_Entry * entry = &table->entries[i];
+		gc_mark_value_grey(vm, entry->key);
+		gc_mark_value_grey(vm, entry->value);
 	}
 }
 
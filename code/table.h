@@ -16,16 +16,36 @@ typedef struct {
 } Table;
 
 void table_init(Table * table);
-void table_free(Table * table);
+void table_free(struct VM * vm, Table * table);
 bool table_get(Table * table, struct Obj_String * key, Value * value);
-bool table_set(Table * table, struct Obj_String * key, Value value);
+bool table_set(struct VM * vm, Table * table, struct Obj_String * key, Value value);
 bool table_delete(Table * table, struct Obj_String * key);
-void table_add_all(Table * table, Table * from);
+void table_add_all(struct VM * vm, Table * table, Table * from);
+
+// a table keyed by arbitrary non-nil values:
+// strings are hashed by content, other objects by identity,
+// integral doubles share keys with the integers
+typedef struct {
+	Value key;
+	Value value;
+} Value_Entry;
+
+typedef struct {
+	uint32_t capacity, count;
+	Value_Entry * entries;
+} Value_Table;
+
+void value_table_init(Value_Table * table);
+void value_table_free(struct VM * vm, Value_Table * table);
+bool value_table_get(Value_Table * table, Value key, Value * value);
+bool value_table_set(struct VM * vm, Value_Table * table, Value key, Value value);
+bool value_table_delete(Value_Table * table, Value key);
 
 struct Obj_String * table_find_key_copy(Table * table, char const * chars, uint32_t length, uint32_t hash);
 struct Obj_String * table_find_key_concatenate(Table * table, char const * a_chars, uint32_t a_length, char const * b_chars, uint32_t b_length, uint32_t hash);
 
-void gc_mark_table_grey(Table * table);
+void gc_mark_table_grey(struct VM * vm, Table * table);
 void gc_table_remove_white_keys(Table * table);
+void gc_mark_value_table_grey(struct VM * vm, Value_Table * table);
 
 #endif
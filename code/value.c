@@ -2,11 +2,13 @@
 
 #include "object.h"
 #include "memory.h"
+#include "output.h"
 
 inline static Value_Type value_type(Value value) {
 #if defined(NAN_BOXING)
 	if (IS_NIL(value)) { return VAL_NIL; }
-	if (IS_NUMBER(value)) { return VAL_NUMBER; }
+	if (IS_DOUBLE(value)) { return VAL_NUMBER; }
+	if (IS_INT(value)) { return VAL_INT; }
 	if (IS_BOOL(value)) { return VAL_BOOL; }
 	if (IS_OBJ(value)) { return VAL_OBJ; }
 	return VAL_NIL;
@@ -15,15 +17,28 @@ inline static Value_Type value_type(Value value) {
 #endif // NAN_BOXING
 }
 
-void value_print(Value value) {
+void value_write(Output * output, Value value) {
 	switch (value_type(value)) {
-		case VAL_NIL:    printf("nil"); break;
-		case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-		case VAL_BOOL:   printf(AS_BOOL(value) ? "true" : "false"); break;
-		case VAL_OBJ:    print_object(AS_OBJ(value)); break;
+		case VAL_NIL:    output_chars(output, "nil", 3); break;
+		case VAL_NUMBER: output_number(output, AS_NUMBER(value)); break;
+		case VAL_INT:    output_int(output, AS_INT(value)); break;
+		case VAL_BOOL:
+			if (AS_BOOL(value)) { output_chars(output, "true", 4); }
+			else { output_chars(output, "false", 5); }
+			break;
+		case VAL_OBJ:    object_write(output, AS_OBJ(value)); break;
 	}
 }
 
+// unbuffered, for diagnostics
+void value_print(Value value) {
+	char buffer[256];
+	Output output = {.chars = buffer, .count = 0, .capacity = sizeof(buffer), .file = stdout};
+	value_write(&output, value);
+	output_flush(&output);
+}
+
+typedef struct VM VM;
 typedef struct Obj Obj;
 
 bool values_equal(Value a, Value b) {
@@ -32,12 +47,20 @@ bool values_equal(Value a, Value b) {
 	// if (IS_NUMBER(a) && IS_NUMBER(b)) {
 	// 	return AS_NUMBER(a) == AS_NUMBER(b);
 	// }
-	return a == b;
+	if (a == b) { return true; }
+	// an integer equals a double only if it were the same double bits
+	if (IS_INT(a) && IS_DOUBLE(b)) { return TO_NUMBER((double)AS_INT(a)) == b; }
+	if (IS_DOUBLE(a) && IS_INT(b)) { return a == TO_NUMBER((double)AS_INT(b)); }
+	return false;
 #else
+	if (IS_NUMBER(a) && IS_NUMBER(b) && value_type(a) != value_type(b)) {
+		return AS_NUMBER(a) == AS_NUMBER(b);
+	}
 	if (value_type(a) != value_type(b)) { return false; }
 	switch (value_type(a)) {
 		case VAL_NIL:    return true;
 		case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+		case VAL_INT:    return AS_INT(a) == AS_INT(b);
 		case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
 		case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
 	}
@@ -51,29 +74,29 @@ void value_array_init(Value_Array * array) {
 	array->values = NULL;
 }
 
-void value_array_free(Value_Array * array) {
-	FREE_ARRAY(array->values, array->capacity);
+void value_array_free(VM * vm, Value_Array * array) {
+	FREE_ARRAY(vm, array->values, array->capacity);
 	value_array_init(array);
 }
 
-void value_array_write(Value_Array * array, Value value) {
+void value_array_write(VM * vm, Value_Array * array, Value value) {
 	if (array->capacity < array->count + 1) {
 		uint32_t old_capacity = array->capacity;
 		array->capacity = GROW_CAPACITY(old_capacity);
-		array->values = GROW_ARRAY(array->values, old_capacity, array->capacity);
+		array->values = GROW_ARRAY(vm, array->values, old_capacity, array->capacity);
 	}
 
 	array->values[array->count] = value;
 	array->count++;
 }
 
-void gc_mark_value_grey(Value value) {
+void gc_mark_value_grey(VM * vm, Value value) {
 	if (!IS_OBJ(value)) { return; }
-	gc_mark_object_grey(AS_OBJ(value));
+	gc_mark_object_grey(vm, AS_OBJ(value));
 }
 
-void gc_mark_value_array_grey(Value_Array * array) {
+void gc_mark_value_array_grey(VM * vm, Value_Array * array) {
 	for (uint32_t i = 0; i < array->count; i++) {
-		gc_mark_value_grey(array->values[i]);
+		gc_mark_value_grey(vm, array->values[i]);
 	}
 }
@@ -1,16 +1,20 @@
 #if !defined(LOX_VALUE)
 #define LOX_VALUE
 
+#include <math.h>
+
 #include "common.h"
 
 typedef enum {
 	VAL_NIL,
 	VAL_NUMBER,
+	VAL_INT,
 	VAL_BOOL,
 	VAL_OBJ,
 } Value_Type;
 
 struct Obj;
+struct VM;
 
 #if defined(NAN_BOXING)
 	typedef uint64_t Value;
@@ -19,13 +23,16 @@ struct Obj;
 		Value_Type type;
 		union {
 			double number;
+			int32_t integer;
 			bool boolean;
 			struct Obj * obj;
 		} as;
 	} Value;
 #endif // NAN_BOXING
 
-typedef Value Native_Fn(uint8_t arg_count, Value * args);
+// natives read arguments straight from the stack and write the result
+// into the callee slot; `false` means a runtime error was reported
+typedef bool Native_Fn(struct VM * vm, uint8_t arg_count, Value * args, Value * result);
 
 #if defined(NAN_BOXING)
 	inline static Value num_to_value(double number) {
@@ -48,54 +55,94 @@ typedef Value Native_Fn(uint8_t arg_count, Value * args);
 
 	#define TO_FALSE() ((Value)(uint64_t)(NAN_MASK | NAN_TAG_FALSE))
 	#define TO_TRUE()  ((Value)(uint64_t)(NAN_MASK | NAN_TAG_TRUE))
+
+	#define IS_DOUBLE(value) (((value) & NAN_MASK) != NAN_MASK)
 #endif // NAN_BOXING
 
 #if defined(NAN_BOXING)
 	#define TO_NIL()          ((Value)(uint64_t)(NAN_MASK | NAN_TAG_NIL))
 	#define TO_NUMBER(number) num_to_value(number)
+	#define TO_INT(integer)   ((Value)(uint64_t)(NAN_MASK | NAN_TAG_INT | (uint32_t)(integer)))
 	#define TO_BOOL(boolean)  ((boolean) ? TO_TRUE() : TO_FALSE())
 	#define TO_OBJ(obj)       ((Value)(uint64_t)(NAN_SIGN | NAN_MASK | (uintptr_t)(obj)))
 
 	#define AS_NIL           (NULL)
-	#define AS_NUMBER(value) value_to_num(value)
+	#define AS_NUMBER(value) value_to_double(value)
+	#define AS_INT(value)    ((int32_t)(uint32_t)(value))
 	#define AS_BOOL(value)   ((value) == TO_TRUE())
 	#define AS_OBJ(value)    ((struct Obj *)(uintptr_t)((value) & ~(NAN_SIGN | NAN_MASK)))
 
 	#define IS_NIL(value)    ((value) == TO_NIL())
-	#define IS_NUMBER(value) (((value) & NAN_MASK) != NAN_MASK)
+	#define IS_NUMBER(value) (IS_DOUBLE(value) || IS_INT(value))
+	#define IS_INT(value)    (((value) & (NAN_SIGN | NAN_MASK | NAN_TAG_INT)) == (NAN_MASK | NAN_TAG_INT))
 	#define IS_BOOL(value)   (((value) | 1) == TO_TRUE())
 	#define IS_OBJ(value)    (((value) & (NAN_SIGN | NAN_MASK)) == (NAN_SIGN | NAN_MASK))
 #else
 	#define TO_NIL()         ((Value){VAL_NIL,    {.obj     = NULL}})
 	#define TO_NUMBER(value) ((Value){VAL_NUMBER, {.number  = value}})
+	#define TO_INT(value)    ((Value){VAL_INT,    {.integer = value}})
 	#define TO_BOOL(value)   ((Value){VAL_BOOL,   {.boolean = value}})
 	#define TO_OBJ(value)    ((Value){VAL_OBJ,    {.obj     = (struct Obj *)(value)}})
 
 	#define AS_NIL           (NULL)
-	#define AS_NUMBER(value) ((value).as.number)
+	#define AS_NUMBER(value) value_to_double(value)
+	#define AS_INT(value)    ((value).as.integer)
 	#define AS_BOOL(value)   ((value).as.boolean)
 	#define AS_OBJ(value)    ((value).as.obj)
 
 	#define IS_NIL(value)    ((value).type == VAL_NIL)
-	#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+	#define IS_NUMBER(value) ((value).type == VAL_NUMBER || (value).type == VAL_INT)
+	#define IS_DOUBLE(value) ((value).type == VAL_NUMBER)
+	#define IS_INT(value)    ((value).type == VAL_INT)
 	#define IS_BOOL(value)   ((value).type == VAL_BOOL)
 	#define IS_OBJ(value)    ((value).type == VAL_OBJ)
 #endif // NAN_BOXING
 
+inline static double value_to_double(Value value) {
+#if defined(NAN_BOXING)
+	return IS_INT(value) ? (double)AS_INT(value) : value_to_num(value);
+#else
+	return IS_INT(value) ? (double)value.as.integer : value.as.number;
+#endif // NAN_BOXING
+}
+
+// integers are an internal representation of integral numbers;
+// scripts can't tell them from doubles: arithmetic overflow promotes
+// to a double and `-0` stays a double
+inline static Value int64_to_value(int64_t number) {
+	if (number < INT32_MIN || number > INT32_MAX) {
+		return TO_NUMBER((double)number);
+	}
+	return TO_INT((int32_t)number);
+}
+
+inline static Value double_to_value(double number) {
+	if (number >= INT32_MIN && number <= INT32_MAX) {
+		int32_t integer = (int32_t)number;
+		if ((double)integer == number && (integer != 0 || !signbit(number))) {
+			return TO_INT(integer);
+		}
+	}
+	return TO_NUMBER(number);
+}
+
 typedef struct {
 	uint32_t capacity, count;
 	Value * values;
 } Value_Array;
 
+struct Output;
+
+void value_write(struct Output * output, Value value);
 void value_print(Value value);
 
 bool values_equal(Value a, Value b);
 
 void value_array_init(Value_Array * array);
-void value_array_free(Value_Array * array);
-void value_array_write(Value_Array * array, Value value);
+void value_array_free(struct VM * vm, Value_Array * array);
+void value_array_write(struct VM * vm, Value_Array * array, Value value);
 
-void gc_mark_value_grey(Value value);
-void gc_mark_value_array_grey(Value_Array * array);
+void gc_mark_value_grey(struct VM * vm, Value value);
+void gc_mark_value_array_grey(struct VM * vm, Value_Array * array);
 
 #endif
@@ -6,19 +6,21 @@
 #include "object.h"
 #include "compiler.h"
 #include "memory.h"
+#include "event.h"
 #include "vm.h"
 
 #if defined(DEBUG_TRACE_EXECUTION)
 #include "debug.h"
 #endif // DEBUG_TRACE_EXECUTION
 
+#define TRACE_FRAMES_MAX 32
+
 typedef struct VM VM;
-VM vm;
 
-static void stack_reset(void) {
-	vm.stack_top = vm.stack;
-	vm.frame_count = 0;
-	vm.open_upvalues = NULL;
+static void stack_reset(VM * vm) {
+	vm->stack_top = vm->stack;
+	vm->frame_count = 0;
+	vm->open_upvalues = NULL;
 }
 
 typedef struct Obj_Function Obj_Function;
@@ -36,11 +38,17 @@ inline static Obj_Function * get_frame_function(Call_Frame * frame) {
 	// return NULL;
 }
 
-#if defined(__clang__) // clang: argument 1 of 2 is a printf-like format literal
-__attribute__((format(printf, 1, 2)))
+typedef struct Obj_Fiber Obj_Fiber;
+
+static void fiber_leave(VM * vm, Fiber_State state, Value value);
+
+#if defined(__clang__) // clang: argument 2 of 3 is a printf-like format literal
+__attribute__((format(printf, 2, 3)))
 #endif // __clang__
-void runtime_error(char const * format, ...) {
+void runtime_error(VM * vm, char const * format, ...) {
 	DEBUG_BREAK();
+	output_flush(&vm->output);
+
 	va_list args;
 	va_start(args, format);
 	vfprintf(stderr, format, args);
@@ -48,11 +56,19 @@ void runtime_error(char const * format, ...) {
 
 	fputs("\n", stderr);
 
-	for (uint32_t i = vm.frame_count; i-- > 0;) {
-		Call_Frame * frame = &vm.frames[i];
+	for (uint32_t i = vm->frame_count; i-- > 0;) {
+		// deep recursion would flood the output
+		uint32_t depth = vm->frame_count - i;
+		if (depth == TRACE_FRAMES_MAX && i > 0) {
+			fprintf(stderr, "... %d more frames\n", i);
+			i = 1;
+			continue;
+		}
+
+		Call_Frame * frame = &vm->frames[i];
 		Obj_Function * function = get_frame_function(frame);
 		size_t instruction = (size_t)(frame->ip - function->chunk.code - 1);
-		fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+		fprintf(stderr, "[line %d] in ", chunk_get_line(&function->chunk, (uint32_t)instruction));
 		if (function->name == NULL) {
 			fprintf(stderr, "script\n");
 		}
@@ -61,175 +77,399 @@ void runtime_error(char const * format, ...) {
 		}
 	}
 
-	stack_reset();
-	vm.had_error = true;
+	// errors abort the fibers back to the main one
+	while (vm->fiber != NULL) {
+		fiber_leave(vm, FIBER_DONE, TO_NIL());
+	}
+	vm->fiber_switch = NULL;
+
+	stack_reset(vm);
+	vm->had_error = true;
 }
 
-void vm_init(void) {
-	stack_reset();
+void vm_init(VM * vm) {
+	vm->frame_capacity = FRAMES_INITIAL;
+	vm->frames_limit = FRAMES_MAX;
+	vm->frames = malloc(sizeof(*vm->frames) * vm->frame_capacity);
+	vm->stack_capacity = STACK_INITIAL;
+	vm->stack = malloc(sizeof(*vm->stack) * vm->stack_capacity);
+	if (vm->frames == NULL || vm->stack == NULL) { exit(1); }
 
-	vm.objects = NULL;
-	vm.had_error = false;
+	stack_reset(vm);
 
-	vm.greyCapacity = 0;
-	vm.greyCount = 0;
-	vm.greyStack = NULL;
+	vm->objects = NULL;
+	vm->had_error = false;
+	vm->native_count = 0;
 
-	vm.bytes_allocated = 0;
-	vm.next_gc = 1024 * 1024;
+	vm->greyCapacity = 0;
+	vm->greyCount = 0;
+	vm->greyStack = NULL;
 
-	table_init(&vm.globals);
-	table_init(&vm.strings);
+	vm->parser = NULL;
+	vm->is_lazy = false;
+	vm->is_optimizing = false;
+	vm->isolates = NULL;
+	vm->events = NULL;
+
+	vm->output.chars = malloc(sizeof(char) * OUTPUT_BUFFER_SIZE);
+	if (vm->output.chars == NULL) { exit(1); }
+	vm->output.count = 0;
+	vm->output.capacity = OUTPUT_BUFFER_SIZE;
+	vm->output.file = stdout;
+
+	vm->fiber = NULL;
+	vm->fiber_switch = NULL;
+	vm->fibers = NULL;
+
+	vm->bytes_allocated = 0;
+	vm->next_gc = 1024 * 1024;
+
+	table_init(&vm->globals);
+	table_init(&vm->strings);
 
 	// GC protection
-	vm.init_string = NULL;
-	vm.init_string = copy_string("init", 4);
+	vm->init_string = NULL;
+	vm->init_string = copy_string(vm, "init", 4);
 }
 
 typedef struct Obj Obj;
 
-static void gc_free_objects(void) {
-	Obj * object = vm.objects;
+static void gc_free_objects(VM * vm) {
+	Obj * object = vm->objects;
 	while (object != NULL) {
 		Obj * next = object->next;
-		gc_free_object(object);
+		gc_free_object(vm, object);
 		object = next;
 	}
 }
 
-void vm_free(void) {
-	table_free(&vm.globals);
-	table_free(&vm.strings);
-	gc_free_objects();
+void vm_free(VM * vm) {
+	output_flush(&vm->output);
+	free(vm->output.chars);
+
+	table_free(vm, &vm->globals);
+	table_free(vm, &vm->strings);
+	gc_free_objects(vm);
+
+	if (vm->events != NULL) { event_loop_free(vm->events); }
+
+	free(vm->frames);
+	free(vm->stack);
+	free(vm->greyStack);
 }
 
 static bool is_falsey(Value value) {
 	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static bool call(Obj * callee, Obj_Function * function, uint8_t arg_count) {
+typedef struct Obj_Upvalue Obj_Upvalue;
+
+static void stack_grow(VM * vm, uint32_t capacity) {
+	Value * stack = realloc(vm->stack, sizeof(*vm->stack) * capacity);
+	if (stack == NULL) { exit(1); }
+
+	// fix up pointers into the old stack
+	if (stack != vm->stack) {
+		vm->stack_top = stack + (vm->stack_top - vm->stack);
+		for (uint32_t i = 0; i < vm->frame_count; i++) {
+			vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+		}
+		for (Obj_Upvalue * upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+			upvalue->location = stack + (upvalue->location - vm->stack);
+		}
+	}
+
+	vm->stack = stack;
+	vm->stack_capacity = capacity;
+}
+
+// room for a frame of `function` starting at `base`
+static void stack_reserve(VM * vm, uint32_t base, Obj_Function * function) {
+	uint32_t count = base + function->stack_max + STACK_SLACK;
+	if (count <= vm->stack_capacity) { return; }
+	uint32_t capacity = vm->stack_capacity * GROWTH_FACTOR;
+	stack_grow(vm, capacity > count ? capacity : count);
+}
+
+static void frames_grow(VM * vm, uint32_t capacity) {
+	Call_Frame * frames = realloc(vm->frames, sizeof(*vm->frames) * capacity);
+	if (frames == NULL) { exit(1); }
+	vm->frames = frames;
+	vm->frame_capacity = capacity;
+}
+
+// a lazily compiled function gets its code on the first call
+static bool function_ready(VM * vm, Obj_Function * function) {
+	if (function->lazy == NULL) { return true; }
+
+	// compile errors go after what the script has printed
+	output_flush(&vm->output);
+	if (compile_body(vm, function)) { return true; }
+	runtime_error(vm, "couldn't compile '%s'", function->name->chars);
+	return false;
+}
+
+static bool call_frame(VM * vm, Obj * callee, Obj_Function * function, uint8_t arg_count) {
 	if (arg_count != function->arity) {
-		runtime_error("expected %d arguments, but got %d", function->arity, arg_count);
+		runtime_error(vm, "expected %d arguments, but got %d", function->arity, arg_count);
 		return false;
 	}
+	if (!function_ready(vm, function)) { return false; }
 
-	if (vm.frame_count == FRAMES_MAX) {
-		runtime_error("stack overflow");
-		return false;
+	if (vm->frame_count == vm->frame_capacity) {
+		if (vm->frame_count >= vm->frames_limit) {
+			runtime_error(vm, "stack overflow");
+			return false;
+		}
+		uint32_t capacity = vm->frame_capacity * GROWTH_FACTOR;
+		frames_grow(vm, capacity < vm->frames_limit ? capacity : vm->frames_limit);
 	}
 
-	Call_Frame * frame = &vm.frames[vm.frame_count++];
+	stack_reserve(vm, (uint32_t)(vm->stack_top - vm->stack) - arg_count - 1, function);
+
+	Call_Frame * frame = &vm->frames[vm->frame_count++];
 	frame->function = (Obj *)callee;
 	frame->ip = function->chunk.code;
+	frame->constants = function->chunk.constants.values;
+
+	frame->slots = vm->stack_top - arg_count - 1;
+
+	return true;
+}
+
+typedef struct Obj_Instance Obj_Instance;
+
+// runs a body recognized by `optimize_function` without a frame;
+// anything it can't handle is left to the frame, which reports errors
+static bool call_inline(VM * vm, Obj_Function * function, uint8_t arg_count) {
+	Value * slots = vm->stack_top - arg_count - 1;
+	Value first = slots[function->inline_slots[0]];
+	Value result = TO_NIL();
+	switch ((Inline_Kind)function->inline_kind) {
+		case INLINE_NONE: return false;
+
+		case INLINE_CONSTANT: result = function->inline_value; break;
+		case INLINE_LOCAL:    result = first; break;
+
+		case INLINE_GET_FIELD: {
+			if (!IS_INSTANCE(first)) { return false; }
+			Obj_Instance * instance = AS_INSTANCE(first);
+			// methods are bound by the frame
+			if (!table_get(&instance->table, AS_STRING(function->inline_value), &result)) { return false; }
+			break;
+		}
+
+		case INLINE_SET_FIELD: {
+			if (!IS_INSTANCE(first)) { return false; }
+			Obj_Instance * instance = AS_INSTANCE(first);
+			table_set(vm, &instance->table, AS_STRING(function->inline_value), slots[function->inline_slots[1]]);
+			break;
+		}
+	}
+
+	slots[0] = result;
+	vm->stack_top = slots + 1;
+	return true;
+}
+
+inline static bool call(VM * vm, Obj * callee, Obj_Function * function, uint8_t arg_count) {
+	if (function->inline_kind != INLINE_NONE && arg_count == function->arity) {
+		if (call_inline(vm, function, arg_count)) { return true; }
+	}
+	return call_frame(vm, callee, function, arg_count);
+}
+
+// the running fiber and `fiber` exchange their execution states
+static void fiber_swap(VM * vm, Obj_Fiber * fiber) {
+#define SWAP(type, field) do { type temp = vm->field; vm->field = fiber->field; fiber->field = temp; } while (false)
+	SWAP(Call_Frame *, frames);
+	SWAP(uint32_t, frame_count);
+	SWAP(uint32_t, frame_capacity);
+	SWAP(Value *, stack);
+	SWAP(Value *, stack_top);
+	SWAP(uint32_t, stack_capacity);
+	SWAP(Obj_Upvalue *, open_upvalues);
+#undef SWAP
+}
+
+static void close_upvalues(VM * vm, Value * last);
+
+// `value` replaces the result of the caller's `resume`
+static void fiber_leave(VM * vm, Fiber_State state, Value value) {
+	Obj_Fiber * fiber = vm->fiber;
+	// closures may outlive the stack, also when an error unwinds the fiber
+	if (state == FIBER_DONE) { close_upvalues(vm, vm->stack); }
+	fiber_swap(vm, fiber);
+	vm->fiber = fiber->caller;
+	fiber->caller = NULL;
+	fiber->state = state;
+	vm->stack_top[-1] = value;
+
+	if (state == FIBER_DONE) {
+		free(fiber->frames);
+		free(fiber->stack);
+		fiber->frames = NULL;
+		fiber->stack = NULL;
+		fiber->stack_top = NULL;
+		fiber->frame_count = 0;
+		fiber->open_upvalues = NULL;
+	}
+}
 
-	frame->slots = vm.stack_top - arg_count - 1;
+// `value` replaces the result of the fiber's `yield`, or is its argument
+static bool fiber_enter(VM * vm, Obj_Fiber * fiber, Value value) {
+	Fiber_State state = fiber->state;
+	fiber->state = FIBER_RUNNING;
+	fiber->caller = vm->fiber;
+	vm->fiber = fiber;
+	fiber_swap(vm, fiber);
+
+	if (state != FIBER_NEW) {
+		vm->stack_top[-1] = value;
+		return true;
+	}
+
+	Obj * callee = fiber->function;
+	Obj_Function * function = callee->type == OBJ_CLOSURE
+		? ((Obj_Closure *)callee)->function
+		: (Obj_Function *)callee;
+
+	// generators come with their arguments, `fiber(fn)` takes one from `resume`
+	if (vm->stack_top - vm->stack <= function->arity) {
+		vm_stack_push(vm, value);
+	}
+	// the fiber needs a frame even for a leaf
+	if (!call_frame(vm, callee, function, function->arity)) { return false; }
 
+	// skip `OP_GENERATOR`, the fiber is the generator
+	if (function->is_generator) {
+		vm->frames[vm->frame_count - 1].ip++;
+	}
 	return true;
 }
 
+static bool fiber_switch(VM * vm) {
+	Obj_Fiber * fiber = vm->fiber_switch;
+	vm->fiber_switch = NULL;
+
+	// the native has left its result on top of the stack
+	if (fiber == vm->fiber) {
+		fiber_leave(vm, FIBER_WAITING, vm->stack_top[-1]);
+		return true;
+	}
+	return fiber_enter(vm, fiber, vm->stack_top[-1]);
+}
+
 typedef struct Obj_Native Obj_Native;
 
-static bool call_native(Obj_Native * native, uint8_t arg_count) {
-	if (arg_count != native->arity) {
-		runtime_error("expected %d arguments, but got %d", native->arity, arg_count);
+static bool call_native(VM * vm, Obj_Native * native, uint8_t arg_count) {
+	if (native->is_variadic) {
+		if (arg_count < native->arity) {
+			runtime_error(vm, "expected at least %d arguments, but got %d", native->arity, arg_count);
+			return false;
+		}
+	}
+	else if (arg_count != native->arity) {
+		runtime_error(vm, "expected %d arguments, but got %d", native->arity, arg_count);
 		return false;
 	}
 
-	Value result = native->function(arg_count, vm.stack_top - arg_count);
-	vm.stack_top -= arg_count + 1;
-	vm_stack_push(result);
+	Value * args = vm->stack_top - arg_count;
+	if (!native->function(vm, arg_count, args, args - 1)) { return false; }
+	vm->stack_top = args;
 
-	return !vm.had_error;
+	// `resume` switches once its arguments are consumed
+	if (vm->fiber_switch != NULL) {
+		return fiber_switch(vm);
+	}
+
+	return true;
 }
 
-inline static bool call_function(Obj_Function * function, uint8_t arg_count) {
-	return call((Obj *)function, function, arg_count);
+inline static bool call_function(VM * vm, Obj_Function * function, uint8_t arg_count) {
+	return call(vm, (Obj *)function, function, arg_count);
 }
 
-inline static bool call_closure(Obj_Closure * closure, uint8_t arg_count) {
-	return call((Obj *)closure, closure->function, arg_count);
+inline static bool call_closure(VM * vm, Obj_Closure * closure, uint8_t arg_count) {
+	return call(vm, (Obj *)closure, closure->function, arg_count);
 }
 
-inline static bool call_bound(Obj_Bound_Method * bound, uint8_t arg_count) {
-	vm_stack_set(arg_count, bound->receiver);
-	return call((Obj *)bound->method, bound->method, arg_count);
+inline static bool call_bound(VM * vm, Obj_Bound_Method * bound, uint8_t arg_count) {
+	vm_stack_set(vm, arg_count, bound->receiver);
+	return call(vm, (Obj *)bound->method, bound->method, arg_count);
 }
 
 typedef struct Obj_Class Obj_Class;
 
-static bool call_value(Value callee, uint8_t arg_count);
-static bool call_class(Obj_Class * lox_class, uint8_t arg_count) {
-	vm_stack_set(arg_count, TO_OBJ(new_instance(lox_class)));
+static bool call_value(VM * vm, Value callee, uint8_t arg_count);
+static bool call_class(VM * vm, Obj_Class * lox_class, uint8_t arg_count) {
+	vm_stack_set(vm, arg_count, TO_OBJ(new_instance(vm, lox_class)));
 
 	Value initializer;
-	if (table_get(&lox_class->methods, vm.init_string, &initializer)) {
-		return call_value(initializer, arg_count);
+	if (table_get(&lox_class->methods, vm->init_string, &initializer)) {
+		return call_value(vm, initializer, arg_count);
 	}
 
 	if (arg_count > 0) {
-		runtime_error("expected %d arguments, but got %d", 0, arg_count);
+		runtime_error(vm, "expected %d arguments, but got %d", 0, arg_count);
 		return false;
 	}
 
 	return true;
 }
 
-static bool call_value(Value callee, uint8_t arg_count) {
+static bool call_value(VM * vm, Value callee, uint8_t arg_count) {
 	if (IS_OBJ(callee)) {
 		switch (OBJ_TYPE(callee)) {
 			case OBJ_FUNCTION:
-				return call_function(AS_FUNCTION(callee), arg_count);
+				return call_function(vm, AS_FUNCTION(callee), arg_count);
 			case OBJ_NATIVE:
-				return call_native(AS_NATIVE(callee), arg_count);
+				return call_native(vm, AS_NATIVE(callee), arg_count);
 			case OBJ_CLOSURE:
-				return call_closure(AS_CLOSURE(callee), arg_count);
+				return call_closure(vm, AS_CLOSURE(callee), arg_count);
 			case OBJ_CLASS:
-				return call_class(AS_CLASS(callee), arg_count);
+				return call_class(vm, AS_CLASS(callee), arg_count);
 			case OBJ_BOUND_METHOD:
-				return call_bound(AS_BOUND_METHOD(callee), arg_count);
+				return call_bound(vm, AS_BOUND_METHOD(callee), arg_count);
 			default: break;
 		}
 	}
 
-	runtime_error("can only call functions and classes");
+	runtime_error(vm, "can only call functions and classes");
 	return false;
 }
 
 typedef struct Obj_String Obj_String;
 
-inline static bool invoke_from_class(Obj_Class * lox_class, Obj_String * name, uint8_t arg_count) {
+inline static bool invoke_from_class(VM * vm, Obj_Class * lox_class, Obj_String * name, uint8_t arg_count) {
 	Value method;
 	if (!table_get(&lox_class->methods, name, &method)) {
-		runtime_error("class '%s' doesn't have method '%s'", lox_class->name->chars, name->chars);
+		runtime_error(vm, "class '%s' doesn't have method '%s'", lox_class->name->chars, name->chars);
 		return false;
 	}
-	return call_value(method, arg_count);
+	return call_value(vm, method, arg_count);
 }
 
-typedef struct Obj_Instance Obj_Instance;
-
-inline static bool invoke(Obj_String * name, uint8_t arg_count) {
-	Value receiver = vm_stack_peek(arg_count);
+inline static bool invoke(VM * vm, Obj_String * name, uint8_t arg_count) {
+	Value receiver = vm_stack_peek(vm, arg_count);
 	if (!IS_INSTANCE(receiver)) {
-		runtime_error("only instances have methods");
+		runtime_error(vm, "only instances have methods");
 		return false;
 	}
 	Obj_Instance * instance = AS_INSTANCE(receiver);
 
 	Value value;
 	if (table_get(&instance->table, name, &value)) {
-		vm_stack_set(arg_count, value);
-		return call_value(value, arg_count);
+		vm_stack_set(vm, arg_count, value);
+		return call_value(vm, value, arg_count);
 	}
 
-	return invoke_from_class(instance->lox_class, name, arg_count);
+	return invoke_from_class(vm, instance->lox_class, name, arg_count);
 }
 
-typedef struct Obj_Upvalue Obj_Upvalue;
-
-static Obj_Upvalue * capture_upvalue(Value * local) {
+static Obj_Upvalue * capture_upvalue(VM * vm, Value * local) {
 	Obj_Upvalue * prev_upvalue = NULL;
-	Obj_Upvalue * upvalue = vm.open_upvalues;
+	Obj_Upvalue * upvalue = vm->open_upvalues;
 
 	while (upvalue != NULL && upvalue->location > local) {
 		prev_upvalue = upvalue;
@@ -240,11 +480,11 @@ static Obj_Upvalue * capture_upvalue(Value * local) {
 		return upvalue;
 	}
 
-	Obj_Upvalue * created_upvalue = new_upvalue(local);
+	Obj_Upvalue * created_upvalue = new_upvalue(vm, local);
 	created_upvalue->next = upvalue;
 
 	if (prev_upvalue == NULL) {
-		vm.open_upvalues = created_upvalue;
+		vm->open_upvalues = created_upvalue;
 	}
 	else {
 		prev_upvalue->next = created_upvalue;
@@ -253,60 +493,136 @@ static Obj_Upvalue * capture_upvalue(Value * local) {
 	return created_upvalue;
 }
 
-static void close_upvalues(Value * last) {
-	while (vm.open_upvalues != NULL && vm.open_upvalues->location >= last) {
-		Obj_Upvalue * upvalue = vm.open_upvalues;
+static void close_upvalues(VM * vm, Value * last) {
+	while (vm->open_upvalues != NULL && vm->open_upvalues->location >= last) {
+		Obj_Upvalue * upvalue = vm->open_upvalues;
 		upvalue->closed = *upvalue->location;
 		upvalue->location = &upvalue->closed;
-		vm.open_upvalues = upvalue->next;
+		vm->open_upvalues = upvalue->next;
 	}
 }
 
-static void define_method(Obj_String * name) {
-	Value method = vm_stack_peek(0);
-	Obj_Class * lox_class = AS_CLASS(vm_stack_peek(1));
-	table_set(&lox_class->methods, name, method);
-	vm_stack_pop();
+static void define_method(VM * vm, Obj_String * name) {
+	Value method = vm_stack_peek(vm, 0);
+	Obj_Class * lox_class = AS_CLASS(vm_stack_peek(vm, 1));
+	table_set(vm, &lox_class->methods, name, method);
+	vm_stack_pop(vm);
 }
 
-static bool bind_method(Obj_Class * lox_class, Obj_String * name) {
+static bool bind_method(VM * vm, Obj_Class * lox_class, Obj_String * name) {
 	Value method;
 	if (!table_get(&lox_class->methods, name, &method)) {
-		runtime_error("class '%s' doesn't have method '%s'", lox_class->name->chars, name->chars);
+		runtime_error(vm, "class '%s' doesn't have method '%s'", lox_class->name->chars, name->chars);
 		return false;
 	}
 
-	Obj_Bound_Method * bound = new_bound_method(vm_stack_peek(0), AS_FUNCTION(method));
-	vm_stack_pop();
-	vm_stack_push(TO_OBJ(bound));
+	Obj_Bound_Method * bound = new_bound_method(vm, vm_stack_peek(vm, 0), AS_FUNCTION(method));
+	vm_stack_pop(vm);
+	vm_stack_push(vm, TO_OBJ(bound));
 
 	return true;
 }
 
-static Interpret_Result run(void) {
-	Call_Frame * frame = &vm.frames[vm.frame_count - 1];
+static void shadow_native(VM * vm, Obj_String * name) {
+	for (uint32_t i = 0; i < vm->native_count; i++) {
+		if (vm->natives[i]->name == name) {
+			vm->natives[i]->is_shadowed = true;
+		}
+	}
+}
+
+static bool get_index(VM * vm, Value value, uint32_t count, uint32_t * index) {
+	if (IS_INT(value) && (uint32_t)AS_INT(value) < count) {
+		*index = (uint32_t)AS_INT(value);
+		return true;
+	}
+
+	if (!IS_NUMBER(value)) {
+		runtime_error(vm, "index must be a number");
+		return false;
+	}
+
+	double number = AS_NUMBER(value);
+	if (!(number >= 0 && number < count)) {
+		runtime_error(vm, "index %g is out of bounds [0 .. %u)", number, count);
+		return false;
+	}
+
+	*index = (uint32_t)number;
+	if ((double)*index != number) {
+		runtime_error(vm, "index must be an integer");
+		return false;
+	}
+
+	return true;
+}
+
+typedef struct Obj_List Obj_List;
+typedef struct Obj_Map Obj_Map;
+typedef struct Obj_Float_Array Obj_Float_Array;
+
+// consumes the high bits left by `OP_WIDE`
+static inline uint32_t widen(uint32_t * wide, uint32_t operand, uint32_t bits) {
+	operand |= *wide << bits;
+	*wide = 0;
+	return operand;
+}
+
+static Interpret_Result run(VM * vm) {
+	Call_Frame * frame = &vm->frames[vm->frame_count - 1];
+	uint32_t wide = 0;
 
 #define READ_BYTE() (*(frame->ip++))
 #define READ_SHORT() (frame->ip += 2, (uint16_t)(frame->ip[-2] << 8) | (uint16_t)frame->ip[-1])
-#define READ_CONSTANT() (get_frame_function(frame)->chunk.constants.values[READ_BYTE()])
+#define READ_INDEX() widen(&wide, READ_BYTE(), 8)
+#define READ_OFFSET() widen(&wide, READ_SHORT(), 16)
+#define READ_CONSTANT() (frame->constants[READ_INDEX()])
 #define READ_CONSTANT_STRING() AS_STRING(READ_CONSTANT())
 #define READ_CONSTANT_FUNCTION() AS_FUNCTION(READ_CONSTANT())
 
 #define OP_BINARY(to_value, op) \
 	do { \
-		if (!IS_NUMBER(vm_stack_peek(0)) || !IS_NUMBER(vm_stack_peek(1))) { \
-			runtime_error("operands must be numbers"); \
+		if (!IS_NUMBER(vm_stack_peek(vm, 0)) || !IS_NUMBER(vm_stack_peek(vm, 1))) { \
+			runtime_error(vm, "operands must be numbers"); \
 			return INTERPRET_RUNTIME_ERROR; \
 		} \
-		double b = AS_NUMBER(vm_stack_pop()); \
-		double a = AS_NUMBER(vm_stack_pop()); \
-		vm_stack_push(to_value(a op b)); \
+		double b = AS_NUMBER(vm_stack_pop(vm)); \
+		double a = AS_NUMBER(vm_stack_pop(vm)); \
+		vm_stack_push(vm, to_value(a op b)); \
+	} while (false)
+
+#define OP_BINARY_INT(to_value, int_to_value, op) \
+	do { \
+		Value b_value = vm_stack_peek(vm, 0); \
+		Value a_value = vm_stack_peek(vm, 1); \
+		if (IS_INT(a_value) && IS_INT(b_value)) { \
+			vm->stack_top--; \
+			vm_stack_set(vm, 0, int_to_value((int64_t)AS_INT(a_value) op (int64_t)AS_INT(b_value))); \
+			break; \
+		} \
+		OP_BINARY(to_value, op); \
+	} while (false)
+
+#define OP_ADD_VALUES() \
+	do { \
+		if (IS_STRING(vm_stack_peek(vm, 0)) && IS_STRING(vm_stack_peek(vm, 1))) { \
+			/* GC protection */ \
+			Obj_String * b = AS_STRING(vm_stack_peek(vm, 0)); \
+			Obj_String * a = AS_STRING(vm_stack_peek(vm, 1)); \
+			Obj_String * string = strings_concatenate(vm, a, b); \
+			vm_stack_pop(vm); \
+			vm_stack_pop(vm); \
+			vm_stack_push(vm, TO_OBJ(string)); \
+			break; \
+		} \
+		OP_BINARY_INT(TO_NUMBER, int64_to_value, +); \
 	} while (false)
 
 	for (;;) {
 #if defined(DEBUG_TRACE_EXECUTION)
+		output_flush(&vm->output);
 		printf("  stack:  ");
-		for (Value * slot = vm.stack; slot < vm.stack_top; slot++) {
+		for (Value * slot = vm->stack; slot < vm->stack_top; slot++) {
 			printf("[ ");
 			value_print(*slot);
 			printf(" ]");
@@ -320,187 +636,370 @@ static Interpret_Result run(void) {
 		switch (instruction = READ_BYTE()) {
 			case OP_CONSTANT: {
 				Value constant = READ_CONSTANT();
-				vm_stack_push(constant);
+				vm_stack_push(vm, constant);
 				break;
 			}
 
-			case OP_NIL:   vm_stack_push(TO_NIL()); break;
-			case OP_FALSE: vm_stack_push(TO_BOOL(false)); break;
-			case OP_TRUE:  vm_stack_push(TO_BOOL(true)); break;
+			case OP_NIL:   vm_stack_push(vm, TO_NIL()); break;
+			case OP_FALSE: vm_stack_push(vm, TO_BOOL(false)); break;
+			case OP_TRUE:  vm_stack_push(vm, TO_BOOL(true)); break;
 
-			case OP_POP: vm_stack_pop(); break;
+			case OP_POP: vm_stack_pop(vm); break;
 
 			case OP_SET_LOCAL: {
 				uint8_t slot = READ_BYTE();
-				frame->slots[slot] = vm_stack_peek(0);
+				frame->slots[slot] = vm_stack_peek(vm, 0);
 				break;
 			}
 
 			case OP_GET_LOCAL: {
 				uint8_t slot = READ_BYTE();
-				vm_stack_push(frame->slots[slot]);
+				vm_stack_push(vm, frame->slots[slot]);
 				break;
 			}
 
 			case OP_SET_GLOBAL: {
 				Obj_String * name = READ_CONSTANT_STRING();
-				if (table_set(&vm.globals, name, vm_stack_peek(0))) {
-					table_delete(&vm.globals, name);
-					runtime_error("undefined variable '%s'", name->chars);
+				if (table_set(vm, &vm->globals, name, vm_stack_peek(vm, 0))) {
+					table_delete(&vm->globals, name);
+					runtime_error(vm, "undefined variable '%s'", name->chars);
 					return INTERPRET_RUNTIME_ERROR;
 				}
+				if (name->is_native_name) { shadow_native(vm, name); }
 				break;
 			}
 
 			case OP_GET_GLOBAL: {
 				Obj_String * name = READ_CONSTANT_STRING();
 				Value value;
-				if (!table_get(&vm.globals, name, &value)) {
-					runtime_error("undefined variable '%s'", name->chars);
+				if (!table_get(&vm->globals, name, &value)) {
+					runtime_error(vm, "undefined variable '%s'", name->chars);
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				vm_stack_push(value);
+				vm_stack_push(vm, value);
 				break;
 			}
 
 			case OP_SET_UPVALUE: {
 				uint8_t slot = READ_BYTE();
 				Obj_Closure * frame_closure = (Obj_Closure *)frame->function;
-				*frame_closure->upvalues[slot]->location = vm_stack_peek(0);
+				*frame_closure->upvalues[slot]->location = vm_stack_peek(vm, 0);
 				break;
 			}
 
 			case OP_GET_UPVALUE: {
 				uint8_t slot = READ_BYTE();
 				Obj_Closure * frame_closure = (Obj_Closure *)frame->function;
-				vm_stack_push(*frame_closure->upvalues[slot]->location);
+				vm_stack_push(vm, *frame_closure->upvalues[slot]->location);
 				break;
 			}
 
 			case OP_SET_PROPERTY: {
-				if (!IS_INSTANCE(vm_stack_peek(1))) {
-					runtime_error("only instances have fields");
+				if (!IS_INSTANCE(vm_stack_peek(vm, 1))) {
+					runtime_error(vm, "only instances have fields");
 					return INTERPRET_RUNTIME_ERROR;
 				}
 
-				Obj_Instance * instance = AS_INSTANCE(vm_stack_peek(1));
+				Obj_Instance * instance = AS_INSTANCE(vm_stack_peek(vm, 1));
 				Obj_String * name = READ_CONSTANT_STRING();
 
-				table_set(&instance->table, name, vm_stack_peek(0));
+				table_set(vm, &instance->table, name, vm_stack_peek(vm, 0));
 
-				Value value = vm_stack_pop();
-				vm_stack_pop();
-				vm_stack_push(value);
+				Value value = vm_stack_pop(vm);
+				vm_stack_pop(vm);
+				vm_stack_push(vm, value);
 				break;
 			}
 
 			case OP_GET_PROPERTY: {
-				if (!IS_INSTANCE(vm_stack_peek(0))) {
-					runtime_error("only instances have properties");
+				if (!IS_INSTANCE(vm_stack_peek(vm, 0))) {
+					runtime_error(vm, "only instances have properties");
 					return INTERPRET_RUNTIME_ERROR;
 				}
 
-				Obj_Instance * instance = AS_INSTANCE(vm_stack_peek(0));
+				Obj_Instance * instance = AS_INSTANCE(vm_stack_peek(vm, 0));
 				Obj_String * name = READ_CONSTANT_STRING();
 
 				Value value;
 				if (table_get(&instance->table, name, &value)) {
-					vm_stack_pop();
-					vm_stack_push(value);
+					vm_stack_pop(vm);
+					vm_stack_push(vm, value);
 					break;
 				}
 
-				if (bind_method(instance->lox_class, name)) { break; }
+				if (bind_method(vm, instance->lox_class, name)) { break; }
 
-				runtime_error("undefined property '%s'", name->chars);
+				runtime_error(vm, "undefined property '%s'", name->chars);
 				return INTERPRET_RUNTIME_ERROR;
 			}
 
+			case OP_SET_INDEX: {
+				if (IS_MAP(vm_stack_peek(vm, 2))) {
+					if (IS_NIL(vm_stack_peek(vm, 1))) {
+						runtime_error(vm, "map key can't be nil");
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					Obj_Map * map = AS_MAP(vm_stack_peek(vm, 2));
+					value_table_set(vm, &map->table, vm_stack_peek(vm, 1), vm_stack_peek(vm, 0));
+
+					Value value = vm_stack_pop(vm);
+					vm->stack_top -= 2;
+					vm_stack_push(vm, value);
+					break;
+				}
+
+				if (IS_FLOAT_ARRAY(vm_stack_peek(vm, 2))) {
+					if (!IS_NUMBER(vm_stack_peek(vm, 0))) {
+						runtime_error(vm, "float arrays can only store numbers");
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					Obj_Float_Array * array = AS_FLOAT_ARRAY(vm_stack_peek(vm, 2));
+					uint32_t index;
+					if (!get_index(vm, vm_stack_peek(vm, 1), array->count, &index)) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					Value value = vm_stack_pop(vm);
+					array->values[index] = AS_NUMBER(value);
+					vm->stack_top -= 2;
+					vm_stack_push(vm, value);
+					break;
+				}
+
+				if (!IS_LIST(vm_stack_peek(vm, 2))) {
+					runtime_error(vm, "only lists, maps and float arrays can be indexed");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				Obj_List * list = AS_LIST(vm_stack_peek(vm, 2));
+				uint32_t index;
+				if (!get_index(vm, vm_stack_peek(vm, 1), list->values.count, &index)) {
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				Value value = vm_stack_pop(vm);
+				list->values.values[index] = value;
+				vm->stack_top -= 2;
+				vm_stack_push(vm, value);
+				break;
+			}
+
+			case OP_GET_INDEX: {
+				if (IS_MAP(vm_stack_peek(vm, 1))) {
+					Obj_Map * map = AS_MAP(vm_stack_peek(vm, 1));
+					Value value;
+					if (!value_table_get(&map->table, vm_stack_peek(vm, 0), &value)) {
+						value = TO_NIL();
+					}
+					vm->stack_top--;
+					vm_stack_set(vm, 0, value);
+					break;
+				}
+
+				if (IS_FLOAT_ARRAY(vm_stack_peek(vm, 1))) {
+					Obj_Float_Array * array = AS_FLOAT_ARRAY(vm_stack_peek(vm, 1));
+					uint32_t index;
+					if (!get_index(vm, vm_stack_peek(vm, 0), array->count, &index)) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					vm->stack_top--;
+					vm_stack_set(vm, 0, TO_NUMBER(array->values[index]));
+					break;
+				}
+
+				if (!IS_LIST(vm_stack_peek(vm, 1))) {
+					runtime_error(vm, "only lists, maps and float arrays can be indexed");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				Obj_List * list = AS_LIST(vm_stack_peek(vm, 1));
+				uint32_t index;
+				if (!get_index(vm, vm_stack_peek(vm, 0), list->values.count, &index)) {
+					return INTERPRET_RUNTIME_ERROR;
+				}
+
+				vm->stack_top--;
+				vm_stack_set(vm, 0, list->values.values[index]);
+				break;
+			}
+
 			case OP_DEFINE_GLOBAL: {
 				Obj_String * name = READ_CONSTANT_STRING();
-				table_set(&vm.globals, name, vm_stack_peek(0));
-				vm_stack_pop();
+				if (name->is_native_name) { shadow_native(vm, name); }
+				table_set(vm, &vm->globals, name, vm_stack_peek(vm, 0));
+				vm_stack_pop(vm);
 				break;
 			}
 
 			case OP_EQUAL: {
-				Value b = vm_stack_pop();
-				Value a = vm_stack_pop();
-				vm_stack_push(TO_BOOL(values_equal(a, b)));
+				Value b = vm_stack_pop(vm);
+				Value a = vm_stack_pop(vm);
+				vm_stack_push(vm, TO_BOOL(values_equal(a, b)));
 				break;
 			}
 
-			case OP_GREATER: OP_BINARY(TO_BOOL, >); break;
-			case OP_LESS:    OP_BINARY(TO_BOOL, <); break;
-
-			case OP_ADD: {
-				if (IS_STRING(vm_stack_peek(0)) && IS_STRING(vm_stack_peek(1))) {
-					// GC protection
-					Obj_String * b = AS_STRING(vm_stack_peek(0));
-					Obj_String * a = AS_STRING(vm_stack_peek(1));
-					Obj_String * string = strings_concatenate(a, b);
-					vm_stack_pop();
-					vm_stack_pop();
-					vm_stack_push(TO_OBJ(string));
+			case OP_GREATER: OP_BINARY_INT(TO_BOOL, TO_BOOL, >); break;
+			case OP_LESS:    OP_BINARY_INT(TO_BOOL, TO_BOOL, <); break;
+
+			case OP_ADD: OP_ADD_VALUES(); break;
+			case OP_SUBTRACT: OP_BINARY_INT(TO_NUMBER, int64_to_value, -); break;
+			case OP_MULTIPLY: {
+				// `-1 * 0` is a `-0` double
+				Value b = vm_stack_peek(vm, 0);
+				Value a = vm_stack_peek(vm, 1);
+				if (IS_INT(a) && IS_INT(b) && (AS_INT(a) < 0 || AS_INT(b) < 0) && (AS_INT(a) == 0 || AS_INT(b) == 0)) {
+					OP_BINARY(TO_NUMBER, *);
 				}
 				else {
-					OP_BINARY(TO_NUMBER, +);
+					OP_BINARY_INT(TO_NUMBER, int64_to_value, *);
 				}
 				break;
 			}
-
-			case OP_SUBTRACT: OP_BINARY(TO_NUMBER, -); break;
-			case OP_MULTIPLY: OP_BINARY(TO_NUMBER, *); break;
-			case OP_DIVIDE:   OP_BINARY(TO_NUMBER, /); break;
-
-			case OP_NOT: vm_stack_push(TO_BOOL(is_falsey(vm_stack_pop()))); break;
+			case OP_DIVIDE: OP_BINARY(TO_NUMBER, /); break;
+
+			// the right operand is read in place, see `REGISTER_OPERANDS`
+			case OP_ADD_LOCAL:         vm_stack_push(vm, frame->slots[READ_BYTE()]); OP_ADD_VALUES(); break;
+			case OP_ADD_CONSTANT:      vm_stack_push(vm, READ_CONSTANT()); OP_ADD_VALUES(); break;
+			case OP_SUBTRACT_LOCAL:    vm_stack_push(vm, frame->slots[READ_BYTE()]); OP_BINARY_INT(TO_NUMBER, int64_to_value, -); break;
+			case OP_SUBTRACT_CONSTANT: vm_stack_push(vm, READ_CONSTANT()); OP_BINARY_INT(TO_NUMBER, int64_to_value, -); break;
+			case OP_LESS_LOCAL:        vm_stack_push(vm, frame->slots[READ_BYTE()]); OP_BINARY_INT(TO_BOOL, TO_BOOL, <); break;
+			case OP_LESS_CONSTANT:     vm_stack_push(vm, READ_CONSTANT()); OP_BINARY_INT(TO_BOOL, TO_BOOL, <); break;
+			case OP_GREATER_LOCAL:     vm_stack_push(vm, frame->slots[READ_BYTE()]); OP_BINARY_INT(TO_BOOL, TO_BOOL, >); break;
+			case OP_GREATER_CONSTANT:  vm_stack_push(vm, READ_CONSTANT()); OP_BINARY_INT(TO_BOOL, TO_BOOL, >); break;
+
+			case OP_NOT: vm_stack_push(vm, TO_BOOL(is_falsey(vm_stack_pop(vm)))); break;
 			case OP_NEGATE: {
-				if (!IS_NUMBER(vm_stack_peek(0))) {
-					runtime_error("operant must be a number");
+				if (!IS_NUMBER(vm_stack_peek(vm, 0))) {
+					runtime_error(vm, "operant must be a number");
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				vm_stack_push(TO_NUMBER(-AS_NUMBER(vm_stack_pop())));
+				Value value = vm_stack_peek(vm, 0);
+				if (IS_INT(value) && AS_INT(value) != 0 && AS_INT(value) != INT32_MIN) {
+					vm_stack_set(vm, 0, TO_INT(-AS_INT(value)));
+					break;
+				}
+				vm_stack_push(vm, TO_NUMBER(-AS_NUMBER(vm_stack_pop(vm))));
 				break;
 			}
 
 			case OP_LOOP: {
-				uint16_t offset = READ_SHORT();
+				uint32_t offset = READ_OFFSET();
 				frame->ip -= offset;
 				break;
 			}
 
 			case OP_JUMP: {
-				uint16_t offset = READ_SHORT();
+				uint32_t offset = READ_OFFSET();
 				frame->ip += offset;
 				break;
 			}
 
 			case OP_JUMP_IF_FALSE: {
-				uint16_t offset = READ_SHORT();
-				frame->ip += offset * is_falsey(vm_stack_peek(0));
+				uint32_t offset = READ_OFFSET();
+				frame->ip += offset * is_falsey(vm_stack_peek(vm, 0));
 				break;
 			}
 
 			case OP_CALL: {
 				uint8_t arg_count = READ_BYTE();
-				if (!call_value(vm_stack_peek(arg_count), arg_count)) {
+				Value callee = vm_stack_peek(vm, arg_count);
+
+				// Lox functions go straight to the frame setup
+				bool is_ok;
+				if (IS_CLOSURE(callee)) {
+					is_ok = call(vm, AS_OBJ(callee), AS_CLOSURE(callee)->function, arg_count);
+				}
+				else if (IS_FUNCTION(callee)) {
+					is_ok = call(vm, AS_OBJ(callee), AS_FUNCTION(callee), arg_count);
+				}
+				else {
+					is_ok = call_value(vm, callee, arg_count);
+				}
+
+				if (!is_ok) {
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				frame = &vm->frames[vm->frame_count - 1];
+				break;
+			}
+
+			case OP_TAIL_CALL: {
+				uint8_t arg_count = READ_BYTE();
+				Value callee = vm_stack_peek(vm, arg_count);
+
+				Obj_Function * function = NULL;
+				if (IS_CLOSURE(callee)) {
+					function = AS_CLOSURE(callee)->function;
+				}
+				else if (IS_FUNCTION(callee)) {
+					function = AS_FUNCTION(callee);
+				}
+				else {
+					if (!call_value(vm, callee, arg_count)) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+					frame = &vm->frames[vm->frame_count - 1];
+					break;
+				}
+
+				if (arg_count != function->arity) {
+					runtime_error(vm, "expected %d arguments, but got %d", function->arity, arg_count);
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				frame = &vm.frames[vm.frame_count - 1];
+				if (!function_ready(vm, function)) { return INTERPRET_RUNTIME_ERROR; }
+				if (function->inline_kind != INLINE_NONE && call_inline(vm, function, arg_count)) { break; }
+
+				// replace the current frame with the callee and its arguments
+				stack_reserve(vm, (uint32_t)(frame->slots - vm->stack), function);
+				close_upvalues(vm, frame->slots);
+				memmove(frame->slots, vm->stack_top - arg_count - 1, sizeof(Value) * (arg_count + 1));
+				vm->stack_top = frame->slots + arg_count + 1;
+
+				frame->function = AS_OBJ(callee);
+				frame->ip = function->chunk.code;
+				frame->constants = function->chunk.constants.values;
+				break;
+			}
+
+			case OP_CALL_NATIVE: {
+				Obj_Native * native = vm->natives[READ_BYTE()];
+				uint8_t arg_count = READ_BYTE();
+				if (!native->is_shadowed) {
+					if (!call_native(vm, native, arg_count)) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+					frame = &vm->frames[vm->frame_count - 1];
+					break;
+				}
+
+				// the global was redefined after the call site had been bound
+				Value callee;
+				if (!table_get(&vm->globals, native->name, &callee)) {
+					runtime_error(vm, "undefined variable '%s'", native->name->chars);
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				vm_stack_set(vm, arg_count, callee);
+				if (!call_value(vm, callee, arg_count)) {
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				frame = &vm->frames[vm->frame_count - 1];
 				break;
 			}
 
 			case OP_CLOSURE: {
 				Obj_Function * function = READ_CONSTANT_FUNCTION();
-				Obj_Closure * closure = new_closure(function);
-				vm_stack_push(TO_OBJ(closure));
+				Obj_Closure * closure = new_closure(vm, function);
+				vm_stack_push(vm, TO_OBJ(closure));
 
 				Obj_Closure * frame_closure = (Obj_Closure *)frame->function;
 				for (uint32_t i = 0; i < closure->upvalue_count; i++) {
 					uint8_t index = READ_BYTE();
 					uint8_t is_local = READ_BYTE();
 					if (is_local) {
-						closure->upvalues[i] = capture_upvalue(&frame->slots[index]);
+						closure->upvalues[i] = capture_upvalue(vm, &frame->slots[index]);
 					}
 					else {
 						closure->upvalues[i] = frame_closure->upvalues[index];
@@ -511,50 +1010,63 @@ static Interpret_Result run(void) {
 			}
 
 			case OP_CLOSE_UPVALUE: {
-				close_upvalues(vm.stack_top - 1);
-				vm_stack_pop();
+				close_upvalues(vm, vm->stack_top - 1);
+				vm_stack_pop(vm);
+				break;
+			}
+
+			case OP_LIST: {
+				uint8_t count = READ_BYTE();
+				// GC protection
+				Obj_List * list = new_list(vm);
+				vm_stack_push(vm, TO_OBJ(list));
+				for (uint32_t i = count; i > 0; i--) {
+					value_array_write(vm, &list->values, vm_stack_peek(vm, i));
+				}
+				vm->stack_top -= count + 1;
+				vm_stack_push(vm, TO_OBJ(list));
 				break;
 			}
 
 			case OP_CLASS: {
 				Obj_String * name = READ_CONSTANT_STRING();
-				Obj_Class * lox_class = new_class(name);
-				vm_stack_push(TO_OBJ(lox_class));
+				Obj_Class * lox_class = new_class(vm, name);
+				vm_stack_push(vm, TO_OBJ(lox_class));
 				break;
 			}
 
 			case OP_METHOD: {
 				Obj_String * name = READ_CONSTANT_STRING();
-				define_method(name);
+				define_method(vm, name);
 				break;
 			}
 
 			case OP_INVOKE: {
 				Obj_String * name = READ_CONSTANT_STRING();
 				uint8_t arg_count = READ_BYTE();
-				if (!invoke(name, arg_count)) {
+				if (!invoke(vm, name, arg_count)) {
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				frame = &vm.frames[vm.frame_count - 1];
+				frame = &vm->frames[vm->frame_count - 1];
 				break;
 			}
 
 			case OP_INHERIT: {
-				Value superclass = vm_stack_peek(1);
+				Value superclass = vm_stack_peek(vm, 1);
 				if (!IS_CLASS(superclass)) {
-					runtime_error("superclass must be a class");
+					runtime_error(vm, "superclass must be a class");
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				Obj_Class * subclass = AS_CLASS(vm_stack_peek(0));
-				table_add_all(&subclass->methods, &AS_CLASS(superclass)->methods);
-				vm_stack_pop();
+				Obj_Class * subclass = AS_CLASS(vm_stack_peek(vm, 0));
+				table_add_all(vm, &subclass->methods, &AS_CLASS(superclass)->methods);
+				vm_stack_pop(vm);
 				break;
 			}
 
 			case OP_GET_SUPER: {
 				Obj_String * name = READ_CONSTANT_STRING();
-				Obj_Class * superclass = AS_CLASS(vm_stack_pop());
-				if (!bind_method(superclass, name)) {
+				Obj_Class * superclass = AS_CLASS(vm_stack_pop(vm));
+				if (!bind_method(vm, superclass, name)) {
 					return INTERPRET_RUNTIME_ERROR;
 				}
 				break;
@@ -563,79 +1075,216 @@ static Interpret_Result run(void) {
 			case OP_SUPER_INVOKE: {
 				Obj_String * name = READ_CONSTANT_STRING();
 				uint8_t arg_count = READ_BYTE();
-				Obj_Class * superclass = AS_CLASS(vm_stack_pop());
-				if (!invoke_from_class(superclass, name, arg_count)) {
+				Obj_Class * superclass = AS_CLASS(vm_stack_pop(vm));
+				if (!invoke_from_class(vm, superclass, name, arg_count)) {
 					return INTERPRET_RUNTIME_ERROR;
 				}
-				frame = &vm.frames[vm.frame_count - 1];
+				frame = &vm->frames[vm->frame_count - 1];
 				break;
 			}
 
-			case OP_RETURN: {
-				Value result = vm_stack_pop();
-
-				close_upvalues(frame->slots);
+			case OP_GENERATOR: {
+				// calling a generator function returns the call packed into a fiber;
+				// as any return, it might finish the fiber that tail called it
+				uint8_t arg_count = (uint8_t)(vm->stack_top - frame->slots - 1);
+				Obj_Fiber * fiber = new_fiber(vm, frame->function, frame->slots + 1, arg_count);
+				vm_stack_push(vm, TO_OBJ(fiber));
+			}
+			// fallthrough
 
-				vm.frame_count--;
-				if (vm.frame_count == 0) {
-					vm_stack_pop();
+			case OP_RETURN: {
+				Value result = vm_stack_pop(vm);
+
+				close_upvalues(vm, frame->slots);
+
+				vm->frame_count--;
+				if (vm->frame_count == 0) {
+					if (vm->fiber != NULL) {
+						// a finished fiber returns from `resume` or ends the loop over it
+						Obj_Fiber * fiber = vm->fiber;
+						fiber_leave(vm, FIBER_DONE, result);
+						frame = &vm->frames[vm->frame_count - 1];
+						if (fiber->loop_exit != NULL) {
+							vm_stack_pop(vm);
+							frame->ip = fiber->loop_exit;
+						}
+						break;
+					}
+					vm_stack_pop(vm);
 					return INTERPRET_OK;
 				}
 
-				vm.stack_top = frame->slots;
-				vm_stack_push(result);
+				vm->stack_top = frame->slots;
+				vm_stack_push(vm, result);
+
+				frame = &vm->frames[vm->frame_count - 1];
+				break;
+			}
+
+			case OP_YIELD: {
+				if (vm->fiber == NULL) {
+					runtime_error(vm, "can't yield from the main fiber");
+					return INTERPRET_RUNTIME_ERROR;
+				}
 
-				frame = &vm.frames[vm.frame_count - 1];
+				// the slot of the value receives the next `resume` value
+				fiber_leave(vm, FIBER_SUSPENDED, vm_stack_peek(vm, 0));
+				frame = &vm->frames[vm->frame_count - 1];
 				break;
 			}
+
+			case OP_FOR_ITER: {
+				// the iterable is followed by the iteration state
+				Value * iterator = &frame->slots[READ_BYTE()];
+				uint32_t offset = READ_OFFSET();
+
+				if (IS_LIST(iterator[0])) {
+					Obj_List * list = AS_LIST(iterator[0]);
+					uint32_t index = (uint32_t)AS_INT(iterator[1]);
+					if (index >= list->values.count) {
+						frame->ip += offset;
+						break;
+					}
+					iterator[1] = TO_INT((int32_t)index + 1);
+					vm_stack_push(vm, list->values.values[index]);
+					break;
+				}
+
+				if (IS_FIBER(iterator[0])) {
+					Obj_Fiber * fiber = AS_FIBER(iterator[0]);
+					if (fiber->state == FIBER_DONE) {
+						frame->ip += offset;
+						break;
+					}
+					if (fiber->state == FIBER_RUNNING) {
+						runtime_error(vm, "fiber is already running");
+						return INTERPRET_RUNTIME_ERROR;
+					}
+					if (fiber->state == FIBER_WAITING) {
+						runtime_error(vm, "fiber is waiting for I/O");
+						return INTERPRET_RUNTIME_ERROR;
+					}
+
+					// the slot receives the yielded value
+					fiber->loop_exit = frame->ip + offset;
+					vm_stack_push(vm, TO_NIL());
+					if (!fiber_enter(vm, fiber, TO_NIL())) {
+						return INTERPRET_RUNTIME_ERROR;
+					}
+					frame = &vm->frames[vm->frame_count - 1];
+					break;
+				}
+
+				runtime_error(vm, "can only iterate over lists and fibers");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+
+			case OP_WIDE: wide = READ_SHORT(); break;
 		}
 	}
 
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_INDEX
+#undef READ_OFFSET
 #undef READ_CONSTANT
 #undef READ_CONSTANT_STRING
 #undef READ_CONSTANT_FUNCTION
 #undef OP_BINARY
+#undef OP_BINARY_INT
+#undef OP_ADD_VALUES
 }
 
 typedef struct Chunk Chunk;
 
-void vm_stack_push(Value value) {
-	*vm.stack_top = value;
-	vm.stack_top++;
+void vm_stack_push(VM * vm, Value value) {
+	*vm->stack_top = value;
+	vm->stack_top++;
 }
 
-Value vm_stack_pop(void) {
-	vm.stack_top--;
-	return *vm.stack_top;
+Value vm_stack_pop(VM * vm) {
+	vm->stack_top--;
+	return *vm->stack_top;
 }
 
-Value vm_stack_peek(uint32_t distance) {
-	return vm.stack_top[-(int32_t)(distance + 1)];
+Value vm_stack_peek(VM * vm, uint32_t distance) {
+	return vm->stack_top[-(int32_t)(distance + 1)];
 }
 
-void vm_stack_set(uint32_t distance, Value value) {
-	vm.stack_top[-(int32_t)(distance + 1)] = value;
+void vm_stack_set(VM * vm, uint32_t distance, Value value) {
+	vm->stack_top[-(int32_t)(distance + 1)] = value;
 }
 
-Interpret_Result vm_interpret(char const * source) {
-	Obj_Function * function = compile(source);
+Interpret_Result vm_interpret(VM * vm, char const * source, size_t length) {
+	Obj_Function * function = compile(vm, source, length);
 	if (function == NULL) { return INTERPRET_COMPILE_ERROR; }
+	return vm_execute(vm, function);
+}
 
-	vm_stack_push(TO_OBJ(function));
-	call_function(function, 0);
+Interpret_Result vm_execute(VM * vm, Obj_Function * function) {
+	vm_stack_push(vm, TO_OBJ(function));
+	call_frame(vm, (Obj *)function, function, 0);
 
-	return run();
+	Interpret_Result result = run(vm);
+	output_flush(&vm->output);
+	return result;
 }
 
-void vm_define_native(char const * name, Native_Fn * function, uint8_t arity) {
+void vm_define_native(VM * vm, char const * name, Native_Fn * function, uint8_t arity, bool is_variadic) {
+	if (vm->native_count == UINT8_MAX + 1) {
+		fprintf(stderr, "too many natives\n");
+		exit(1);
+	}
+
 	// GC protection
-	Obj_String * obj_name = copy_string(name, (uint32_t)strlen(name));
-	vm_stack_push(TO_OBJ(obj_name));
-	Obj_Native * obj_native = new_native(function, arity);
-	vm_stack_push(TO_OBJ(obj_native));
-	table_set(&vm.globals, obj_name, TO_OBJ(obj_native));
-	vm_stack_pop();
-	vm_stack_pop();
+	Obj_String * obj_name = copy_string(vm, name, (uint32_t)strlen(name));
+	vm_stack_push(vm, TO_OBJ(obj_name));
+	Obj_Native * obj_native = new_native(vm, obj_name, function, arity, is_variadic);
+	vm_stack_push(vm, TO_OBJ(obj_native));
+	table_set(vm, &vm->globals, obj_name, TO_OBJ(obj_native));
+	vm_stack_pop(vm);
+	vm_stack_pop(vm);
+
+	obj_name->is_native_name = true;
+	vm->natives[vm->native_count++] = obj_native;
+}
+
+uint32_t vm_find_native(VM * vm, Obj_String * name) {
+	if (!name->is_native_name) { return UINT32_MAX; }
+	for (uint32_t i = 0; i < vm->native_count; i++) {
+		Obj_Native * native = vm->natives[i];
+		if (native->name == name && !native->is_shadowed) { return i; }
+	}
+	return UINT32_MAX;
+}
+
+bool vm_fiber_resume(VM * vm, Value fiber_value, Value value, Value * result) {
+	if (!IS_FIBER(fiber_value)) {
+		runtime_error(vm, "expected a fiber");
+		return false;
+	}
+	Obj_Fiber * fiber = AS_FIBER(fiber_value);
+	switch (fiber->state) {
+		case FIBER_RUNNING:
+			runtime_error(vm, "fiber is already running");
+			return false;
+		case FIBER_WAITING:
+			runtime_error(vm, "fiber is waiting for I/O");
+			return false;
+		case FIBER_DONE:
+			runtime_error(vm, "can't resume a finished fiber");
+			return false;
+		default: break;
+	}
+
+	*result = value;
+	fiber->loop_exit = NULL;
+	vm->fiber_switch = fiber;
+	return true;
+}
+
+void vm_fiber_wait(VM * vm) {
+	// the native's result goes to the caller's `resume`,
+	// the event loop's value becomes the native's result
+	vm->fiber_switch = vm->fiber;
 }
@@ -1,24 +1,32 @@
 #if !defined(LOX_VM)
 #define LOX_VM
 
+#include "output.h"
 #include "table.h"
 
 struct Obj;
+struct Obj_Function;
+struct Parser;
+struct Isolate_Pool;
+struct Event_Loop;
 
-typedef struct {
+typedef struct Call_Frame {
 	struct Obj * function;
 	uint8_t * ip;
+	Value * constants; // cached `chunk.constants.values` of the function
 	Value * slots;
 } Call_Frame;
 
 struct Chunk;
 
 struct VM {
-	Call_Frame frames[FRAMES_MAX];
-	uint32_t frame_count;
+	Call_Frame * frames;
+	uint32_t frame_count, frame_capacity;
+	uint32_t frames_limit;
 
-	Value stack[STACK_MAX];
+	Value * stack;
 	Value * stack_top;
+	uint32_t stack_capacity;
 	Table globals;
 	Table strings;
 	struct Obj_String * init_string;
@@ -28,32 +36,59 @@ struct VM {
 	uint32_t greyCapacity, greyCount;
 	struct Obj ** greyStack;
 
+	// set while `compile` runs, its functions are roots
+	struct Parser * parser;
+	bool is_lazy; // function bodies compile on their first call, see `compile_body`
+	bool is_optimizing; // compiled functions go through `optimize_function`
+
+	// the running fiber, NULL for the main one;
+	// the `resume` native requests a switch, see `call_native`
+	struct Obj_Fiber * fiber;
+	struct Obj_Fiber * fiber_switch;
+	struct Obj_Fiber * fibers;
+
+	// shared with the other isolates, see `isolate.h`
+	struct Isolate_Pool * isolates;
+
+	// created on the first asynchronous I/O, see `event.h`
+	struct Event_Loop * events;
+
+	// `print` goes here; flushed when full, on errors and once the script ends
+	Output output;
+
 	size_t bytes_allocated;
 	size_t next_gc;
 
+	// call sites bind natives by index, see `OP_CALL_NATIVE`
+	struct Obj_Native * natives[UINT8_MAX + 1];
+	uint32_t native_count;
+
 	bool had_error;
 };
 
-extern struct VM vm;
-
 typedef enum {
 	INTERPRET_OK,
 	INTERPRET_COMPILE_ERROR,
 	INTERPRET_RUNTIME_ERROR,
 } Interpret_Result;
 
-void runtime_error(char const * format, ...);
+void runtime_error(struct VM * vm, char const * format, ...);
 
-void vm_init(void);
-void vm_free(void);
-Interpret_Result vm_interpret(char const * source);
-void vm_stack_push(Value value);
-Value vm_stack_pop(void);
-Value vm_stack_peek(uint32_t distance);
-void vm_stack_set(uint32_t distance, Value value);
+void vm_init(struct VM * vm);
+void vm_free(struct VM * vm);
+Interpret_Result vm_interpret(struct VM * vm, char const * source, size_t length);
+Interpret_Result vm_execute(struct VM * vm, struct Obj_Function * function); // a compiled script
+void vm_stack_push(struct VM * vm, Value value);
+Value vm_stack_pop(struct VM * vm);
+Value vm_stack_peek(struct VM * vm, uint32_t distance);
+void vm_stack_set(struct VM * vm, uint32_t distance, Value value);
 
 struct Obj_Native;
 
-void vm_define_native(char const * name, Native_Fn * function, uint8_t arity);
+void vm_define_native(struct VM * vm, char const * name, Native_Fn * function, uint8_t arity, bool is_variadic);
+uint32_t vm_find_native(struct VM * vm, struct Obj_String * name);
+
+bool vm_fiber_resume(struct VM * vm, Value fiber, Value value, Value * result);
+void vm_fiber_wait(struct VM * vm);
 
 #endif
@@ -2,10 +2,19 @@
 #include "code/value.c"
 #include "code/object.c"
 #include "code/table.c"
+#include "code/numeric.c"
+#include "code/output.c"
 #include "code/chunk.c"
+#include "code/source.c"
 #include "code/scanner.c"
 #include "code/compiler.c"
+#include "code/optimizer.c"
+#include "code/bytecode.c"
+#include "code/cache.c"
+#include "code/image.c"
 #include "code/vm.c"
+#include "code/isolate.c"
+#include "code/event.c"
 #include "code/main.c"
 
 #if defined(DEBUG_TRACE_EXECUTION) || defined(DEBUG_PRINT_BYTECODE)